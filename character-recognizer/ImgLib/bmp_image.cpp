@@ -134,6 +134,8 @@ Image LoadBMP(const Path& file) {
     // Палитра для 8-битных bmp
     std::vector<Color> palette;
     if (info_header.bpp == 8) {
+        // Палитра идёт сразу за заголовком, его размер может быть больше 40 байт
+        ifs.seekg(sizeof(BitmapFileHeader) + info_header.header_size);
         palette.resize(256);
         for (int i = 0; i < 256; ++i) {
             RgbQuad quad;
@@ -145,7 +147,8 @@ Image LoadBMP(const Path& file) {
         }
     }
 
-    // Прочитать данные
+    // Прочитать данные, они начинаются со смещения из BitmapFileHeader
+    ifs.seekg(file_header.indentation);
     for (int y = h - 1; y >= 0; --y) {
         Color* line = iamge.GetLine(y);
         ifs.read(buff.data(), buff.size());
@@ -0,0 +1,53 @@
+#pragma once
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+// Alignment of all numeric buffers: one cache line,
+// which is also the width of an AVX-512 register
+constexpr size_t buffer_alignment = 64;
+
+// Allocator for std::vector that places the storage
+// on the buffer_alignment boundary
+template <typename T>
+class AlignedAllocator {
+public:
+    using value_type = T;
+
+    AlignedAllocator() noexcept = default;
+
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U>&) noexcept {
+    }
+
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T),
+                                              std::align_val_t(buffer_alignment)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        ::operator delete(p, std::align_val_t(buffer_alignment));
+    }
+
+    template <typename U>
+    bool operator==(const AlignedAllocator<U>&) const noexcept {
+        return true;
+    }
+
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U>&) const noexcept {
+        return false;
+    }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+// Rounds the number of elements up, so that the next block
+// of the same type starts on the buffer_alignment boundary
+template <typename T>
+constexpr size_t AlignedSize(size_t count) {
+    constexpr size_t per_line = buffer_alignment / sizeof(T);
+    return (count + per_line - 1) / per_line * per_line;
+}
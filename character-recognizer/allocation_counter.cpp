@@ -0,0 +1,91 @@
+#include "allocation_counter.h"
+
+#include <cstdlib>
+#include <new>
+
+#ifdef ALLOCATION_COUNTER_ENABLED
+
+namespace {
+
+thread_local size_t thread_allocations = 0;
+
+void* Allocate(std::size_t size, std::size_t alignment) {
+    ++thread_allocations;
+    if (size == 0) {
+        size = 1;
+    }
+    while (true) {
+        void* p;
+        if (alignment <= alignof(std::max_align_t)) {
+            p = std::malloc(size);
+        } else {
+#ifdef _MSC_VER
+            p = _aligned_malloc(size, alignment);
+#else
+            // The size of aligned_alloc must be a multiple of the alignment
+            p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+#endif
+        }
+        if (p) {
+            return p;
+        }
+        std::new_handler handler = std::get_new_handler();
+        if (!handler) {
+            throw std::bad_alloc();
+        }
+        handler();
+    }
+}
+
+}
+
+namespace allocation_counter {
+
+size_t GetThreadAllocations() {
+    return thread_allocations;
+}
+
+}
+
+// The other forms (arrays, nothrow) call these ones by default, the sized
+// deletes are defined too for -Wsized-deallocation
+
+void* operator new(std::size_t size) {
+    return Allocate(size, alignof(std::max_align_t));
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment) {
+    return Allocate(size, static_cast<std::size_t>(alignment));
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+#ifdef _MSC_VER
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    operator delete(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t alignment) noexcept {
+    operator delete(p, alignment);
+}
+
+#else
+
+namespace allocation_counter {
+
+size_t GetThreadAllocations() {
+    return 0;
+}
+
+}
+
+#endif
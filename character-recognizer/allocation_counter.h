@@ -0,0 +1,24 @@
+#pragma once
+
+#include <cstddef>
+
+// Counter of heap allocations. The global operator new (all its forms)
+// is replaced by one that counts the allocations of every thread, which
+// costs an increment of a thread-local variable per allocation. It lets
+// tests check that hot paths don't allocate in the steady state.
+//
+// The replacement is compiled in only if ALLOCATION_COUNTER_ENABLED
+// is defined (the RECOGNIZER_COUNT_ALLOCATIONS option of CMake)
+
+namespace allocation_counter {
+
+#ifdef ALLOCATION_COUNTER_ENABLED
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+// Allocations made by the calling thread since it started, 0 if not enabled
+size_t GetThreadAllocations();
+
+}
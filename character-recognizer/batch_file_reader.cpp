@@ -0,0 +1,426 @@
+#include "batch_file_reader.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define BATCH_READER_POSIX
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+// Linked requests with direct descriptors need Linux 5.17
+#if defined(IO_URING_ENABLED) && defined(__linux__) && __has_include(<linux/io_uring.h>)
+    #include <linux/io_uring.h>
+    #ifdef IORING_FEAT_LINKED_FILE
+        #define BATCH_READER_IO_URING
+        #include <cerrno>
+        #include <sys/mman.h>
+        #include <sys/syscall.h>
+    #endif
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+void ThrowUnreadable(const std::filesystem::path& file) {
+    throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+}
+
+// Requests of a file, the low bits of the user data
+enum Request : uint64_t {
+    OPEN = 0,
+    READ = 1,
+    CLOSE = 2
+};
+
+}
+
+#ifdef BATCH_READER_IO_URING
+
+// Submission and completion queues shared with the kernel
+struct BatchFileReader::Ring {
+    int fd = -1;
+    void* sq_map = MAP_FAILED;
+    size_t sq_map_size = 0;
+    void* cq_map = MAP_FAILED;
+    size_t cq_map_size = 0;
+    io_uring_sqe* sqes = static_cast<io_uring_sqe*>(MAP_FAILED);
+    size_t sqes_size = 0;
+
+    unsigned* sq_tail = nullptr;
+    unsigned* sq_mask = nullptr;
+    unsigned* sq_array = nullptr;
+    unsigned* cq_head = nullptr;
+    unsigned* cq_tail = nullptr;
+    unsigned* cq_mask = nullptr;
+    io_uring_cqe* cqes = nullptr;
+
+    ~Ring() {
+        if (sqes != MAP_FAILED) {
+            munmap(sqes, sqes_size);
+        }
+        if (cq_map != MAP_FAILED && cq_map != sq_map) {
+            munmap(cq_map, cq_map_size);
+        }
+        if (sq_map != MAP_FAILED) {
+            munmap(sq_map, sq_map_size);
+        }
+        if (fd >= 0) {
+            close(fd);
+        }
+    }
+
+    // Returns nullptr if io_uring is not available
+    static std::unique_ptr<Ring> Create(unsigned entries, unsigned files) {
+        io_uring_params params;
+        std::memset(&params, 0, sizeof(params));
+        auto ring = std::make_unique<Ring>();
+        ring->fd = static_cast<int>(syscall(__NR_io_uring_setup, entries, &params));
+        if (ring->fd < 0 || !(params.features & IORING_FEAT_LINKED_FILE)) {
+            return nullptr;
+        }
+
+        ring->sq_map_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        ring->cq_map_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+        const bool single_map = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_map) {
+            ring->sq_map_size = ring->cq_map_size = std::max(ring->sq_map_size, ring->cq_map_size);
+        }
+        ring->sq_map = mmap(nullptr, ring->sq_map_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_SQ_RING);
+        if (ring->sq_map == MAP_FAILED) {
+            return nullptr;
+        }
+        ring->cq_map = single_map ? ring->sq_map
+                                  : mmap(nullptr, ring->cq_map_size, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, ring->fd, IORING_OFF_CQ_RING);
+        if (ring->cq_map == MAP_FAILED) {
+            return nullptr;
+        }
+        ring->sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+        ring->sqes = static_cast<io_uring_sqe*>(mmap(nullptr, ring->sqes_size, PROT_READ | PROT_WRITE,
+                                                     MAP_SHARED | MAP_POPULATE, ring->fd,
+                                                     IORING_OFF_SQES));
+        if (ring->sqes == MAP_FAILED) {
+            return nullptr;
+        }
+
+        auto* sq = static_cast<char*>(ring->sq_map);
+        ring->sq_tail = reinterpret_cast<unsigned*>(sq + params.sq_off.tail);
+        ring->sq_mask = reinterpret_cast<unsigned*>(sq + params.sq_off.ring_mask);
+        ring->sq_array = reinterpret_cast<unsigned*>(sq + params.sq_off.array);
+        auto* cq = static_cast<char*>(ring->cq_map);
+        ring->cq_head = reinterpret_cast<unsigned*>(cq + params.cq_off.head);
+        ring->cq_tail = reinterpret_cast<unsigned*>(cq + params.cq_off.tail);
+        ring->cq_mask = reinterpret_cast<unsigned*>(cq + params.cq_off.ring_mask);
+        ring->cqes = reinterpret_cast<io_uring_cqe*>(cq + params.cq_off.cqes);
+
+        // Empty table of direct descriptors, a file opened into an entry
+        // is read and closed by the linked requests without a usual descriptor
+        std::vector<int> table(files, -1);
+        if (syscall(__NR_io_uring_register, ring->fd, IORING_REGISTER_FILES, table.data(), files) < 0) {
+            return nullptr;
+        }
+        return ring;
+    }
+
+    // The entry is published at once, the kernel takes it on the next Enter
+    io_uring_sqe& Push() {
+        std::atomic_ref<unsigned> tail(*sq_tail);
+        const unsigned index = tail.load(std::memory_order_relaxed);
+        io_uring_sqe& sqe = sqes[index & *sq_mask];
+        std::memset(&sqe, 0, sizeof(sqe));
+        sq_array[index & *sq_mask] = index & *sq_mask;
+        tail.store(index + 1, std::memory_order_release);
+        return sqe;
+    }
+
+    // Returns the number of submitted entries
+    unsigned Enter(unsigned to_submit, unsigned min_complete) {
+        while (true) {
+            long result = syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                                  min_complete > 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+            if (result >= 0) {
+                return static_cast<unsigned>(result);
+            }
+            if (errno != EINTR) {
+                throw std::runtime_error("io_uring_enter failed: "s + std::strerror(errno));
+            }
+        }
+    }
+
+    template <typename Handler>
+    void Reap(Handler handler) {
+        std::atomic_ref<unsigned> head(*cq_head);
+        const unsigned tail = std::atomic_ref<unsigned>(*cq_tail).load(std::memory_order_acquire);
+        unsigned index = head.load(std::memory_order_relaxed);
+        for (; index != tail; ++index) {
+            const io_uring_cqe& cqe = cqes[index & *cq_mask];
+            handler(cqe.user_data, cqe.res);
+        }
+        head.store(index, std::memory_order_release);
+    }
+};
+
+#else
+
+struct BatchFileReader::Ring {
+};
+
+#endif
+
+BatchFileReader::BatchFileReader(size_t capacity, size_t buffer_size, bool use_io_uring)
+: buffer_size_(buffer_size)
+, slots_(capacity)
+, buffers_(capacity * (buffer_size + padding)) {
+    assert(capacity > 0);
+#ifdef BATCH_READER_IO_URING
+    if (use_io_uring) {
+        ring_ = Ring::Create(static_cast<unsigned>(capacity * 3), static_cast<unsigned>(capacity));
+    }
+#else
+    (void)use_io_uring;
+#endif
+}
+
+BatchFileReader::~BatchFileReader() {
+#ifdef BATCH_READER_IO_URING
+    // The kernel must not write into the buffers after they are freed.
+    // Requests that were never submitted are dropped with the ring
+    if (ring_) {
+        try {
+            for (size_t i = queued_ - unsubmitted_; i < queued_; ++i) {
+                slots_[(first_ + i) % slots_.size()].pending = 0;
+            }
+            auto in_flight = [this]() {
+                return std::any_of(slots_.begin(), slots_.end(), [](const Slot& slot) {
+                    return slot.pending > 0;
+                });
+            };
+            while (in_flight()) {
+                ring_->Enter(0, 1);
+                ring_->Reap([this](uint64_t user_data, int) {
+                    --slots_[user_data >> 2].pending;
+                });
+            }
+        } catch (...) {
+            // The ring is closed anyway, the kernel cancels the requests
+        }
+    }
+#endif
+}
+
+bool BatchFileReader::IsIoUringUsed() const {
+    return ring_ != nullptr;
+}
+
+size_t BatchFileReader::GetCapacity() const {
+    return slots_.size();
+}
+
+size_t BatchFileReader::GetQueued() const {
+    return queued_;
+}
+
+uint8_t* BatchFileReader::Buffer(size_t slot) {
+    return buffers_.data() + slot * (buffer_size_ + padding);
+}
+
+void BatchFileReader::Add(const std::filesystem::path& file) {
+    assert(queued_ < slots_.size());
+    const size_t index = (first_ + queued_) % slots_.size();
+    Slot& slot = slots_[index];
+    // The assignment keeps the storage of the path
+    slot.path = file;
+    ++queued_;
+#ifdef BATCH_READER_IO_URING
+    if (!ring_) {
+        return;
+    }
+    // Open into the direct descriptor of the slot, read the file
+    // into the buffer and close it. The close runs even if the read fails
+    slot.open_result = 0;
+    slot.read_result = 0;
+    slot.pending = 3;
+    const uint64_t user_data = static_cast<uint64_t>(index) << 2;
+
+    io_uring_sqe& open = ring_->Push();
+    open.opcode = IORING_OP_OPENAT;
+    open.flags = IOSQE_IO_LINK;
+    open.fd = AT_FDCWD;
+    open.addr = reinterpret_cast<uint64_t>(slot.path.c_str());
+    open.open_flags = O_RDONLY;
+    open.file_index = static_cast<uint32_t>(index + 1);
+    open.user_data = user_data | OPEN;
+
+    io_uring_sqe& read = ring_->Push();
+    read.opcode = IORING_OP_READ;
+    read.flags = IOSQE_FIXED_FILE | IOSQE_IO_HARDLINK;
+    read.fd = static_cast<int>(index);
+    read.addr = reinterpret_cast<uint64_t>(Buffer(index));
+    read.len = static_cast<uint32_t>(buffer_size_);
+    read.off = 0;
+    read.user_data = user_data | READ;
+
+    io_uring_sqe& close = ring_->Push();
+    close.opcode = IORING_OP_CLOSE;
+    close.file_index = static_cast<uint32_t>(index + 1);
+    close.user_data = user_data | CLOSE;
+
+    ++unsubmitted_;
+#endif
+}
+
+void BatchFileReader::Submit(bool wait) {
+#ifdef BATCH_READER_IO_URING
+    const unsigned submitted = ring_->Enter(static_cast<unsigned>(unsubmitted_ * 3), wait ? 1 : 0);
+    assert(submitted % 3 == 0);
+    unsubmitted_ -= submitted / 3;
+    ring_->Reap([this](uint64_t user_data, int result) {
+        Slot& slot = slots_[user_data >> 2];
+        if ((user_data & 3) == OPEN) {
+            slot.open_result = result;
+        } else if ((user_data & 3) == READ) {
+            slot.read_result = result;
+        }
+        --slot.pending;
+    });
+#else
+    (void)wait;
+#endif
+}
+
+std::span<const uint8_t> BatchFileReader::Take() {
+    assert(queued_ > 0);
+    const size_t index = first_;
+    Slot& slot = slots_[index];
+    first_ = (first_ + 1) % slots_.size();
+    --queued_;
+    if (!ring_) {
+        return ReadWithSystemCalls(slot.path);
+    }
+
+    // The requests are submitted in batches: when the file is not read yet,
+    // or when half of the queue waits for the submission
+    while (slot.pending > 0) {
+        Submit(true);
+    }
+    if (unsubmitted_ > 0 && unsubmitted_ * 2 >= slots_.size()) {
+        Submit(false);
+    }
+    // A full buffer may hold only the beginning of the file. Failed
+    // requests are repeated with system calls, which also explain the error
+    if (slot.open_result < 0 || slot.read_result < 0
+        || static_cast<size_t>(slot.read_result) >= buffer_size_) {
+        return ReadWithSystemCalls(slot.path);
+    }
+    return {Buffer(index), static_cast<size_t>(slot.read_result)};
+}
+
+std::span<const uint8_t> BatchFileReader::ReadWithSystemCalls(const std::filesystem::path& file) {
+#ifdef BATCH_READER_POSIX
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        ThrowUnreadable(file);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        ThrowUnreadable(file);
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    if (large_buffer_.size() < size + padding) {
+        large_buffer_.resize(size + padding);
+    }
+    size_t done = 0;
+    while (done < size) {
+        ssize_t result = read(fd, large_buffer_.data() + done, size - done);
+        if (result <= 0) {
+            close(fd);
+            ThrowUnreadable(file);
+        }
+        done += static_cast<size_t>(result);
+    }
+    close(fd);
+    return {large_buffer_.data(), size};
+#else
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in) {
+        ThrowUnreadable(file);
+    }
+    const size_t size = static_cast<size_t>(in.tellg());
+    if (large_buffer_.size() < size + padding) {
+        large_buffer_.resize(size + padding);
+    }
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(large_buffer_.data()), size)) {
+        ThrowUnreadable(file);
+    }
+    return {large_buffer_.data(), size};
+#endif
+}
+
+namespace tests {
+
+void BatchFileReaderReads() {
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "batch_file_reader_test";
+    fs::remove_all(dir);
+    fs::create_directories(dir);
+
+    // Sizes around the buffer size of 256 bytes, an empty file and a missing one
+    const std::vector<size_t> sizes = {100, 0, 255, 256, 257, 1000, 3, 256, 50, 7, 300, 1};
+    std::vector<fs::path> files;
+    for (size_t i = 0; i < sizes.size(); ++i) {
+        files.push_back(dir / ("file_"s + std::to_string(i)));
+        std::ofstream out(files.back(), std::ios::binary);
+        for (size_t j = 0; j < sizes[i]; ++j) {
+            out.put(static_cast<char>(i * 31 + j));
+        }
+    }
+    const size_t missing = 5;
+    fs::remove(files[missing]);
+
+    for (bool use_io_uring : {true, false}) {
+        BatchFileReader reader(4, 256, use_io_uring);
+        assert(use_io_uring || !reader.IsIoUringUsed());
+        // Two rounds, so the slots are reused
+        for (int round = 0; round < 2; ++round) {
+            size_t added = 0;
+            for (size_t i = 0; i < files.size(); ++i) {
+                while (added < files.size() && reader.GetQueued() < reader.GetCapacity()) {
+                    reader.Add(files[added++]);
+                }
+                bool failed = false;
+                std::span<const uint8_t> data;
+                try {
+                    data = reader.Take();
+                } catch (const std::runtime_error&) {
+                    failed = true;
+                }
+                assert(failed == (i == missing));
+                if (!failed) {
+                    assert(data.size() == sizes[i]);
+                    for (size_t j = 0; j < sizes[i]; ++j) {
+                        assert(data[j] == static_cast<uint8_t>(i * 31 + j));
+                    }
+                }
+            }
+            assert(reader.GetQueued() == 0);
+        }
+        // Files left in the queue are dropped by the destructor
+        reader.Add(files[0]);
+        reader.Add(files[1]);
+    }
+    fs::remove_all(dir);
+}
+
+}
@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Reader of many small files with few system calls. Files are queued
+// with Add and taken in the same order with Take. On Linux the open,
+// read and close of every queued file are linked io_uring requests:
+// the requests of many files are submitted with one system call and
+// the contents land in a ring of preallocated buffers. Files larger
+// than a buffer, and all files where io_uring is unavailable (other
+// systems, old kernels, io_uring disabled by a sandbox or by the
+// RECOGNIZER_IO_URING build option), are read with open, read and close.
+// A reader must not be shared between threads
+
+class BatchFileReader {
+public:
+    // Readable bytes after the data returned by Take, for SIMD decoders
+    static constexpr size_t padding = 64;
+
+    // Capacity is the number of files queued at once, the files
+    // of the usual size fit the buffers of buffer_size bytes
+    explicit BatchFileReader(size_t capacity = 64, size_t buffer_size = 8192,
+                             bool use_io_uring = true);
+    ~BatchFileReader();
+
+    BatchFileReader(const BatchFileReader&) = delete;
+    BatchFileReader& operator=(const BatchFileReader&) = delete;
+
+    bool IsIoUringUsed() const;
+    size_t GetCapacity() const;
+    size_t GetQueued() const;
+
+    // The number of queued files must be less than the capacity
+    void Add(const std::filesystem::path& file);
+    // Returns the contents of the oldest queued file, valid until the next
+    // call of Add or Take. Throws if the file cannot be read, the file is
+    // removed from the queue anyway
+    std::span<const uint8_t> Take();
+
+private:
+    struct Slot {
+        std::filesystem::path path;
+        int open_result = 0;
+        int read_result = 0;
+        int pending = 0; // completions of the requests not yet received
+    };
+
+    struct Ring;
+
+    size_t buffer_size_;
+    std::vector<Slot> slots_;
+    std::vector<uint8_t> buffers_; // of all slots, each one with the padding
+    std::vector<uint8_t> large_buffer_; // of the files read with system calls
+    size_t first_ = 0; // index of the oldest queued file
+    size_t queued_ = 0;
+    size_t unsubmitted_ = 0; // the newest queued files, their requests are not submitted
+    std::unique_ptr<Ring> ring_; // nullptr without io_uring
+
+    uint8_t* Buffer(size_t slot);
+    // Submits the requests of the queued files, waits for a completion if wait is set
+    void Submit(bool wait);
+    std::span<const uint8_t> ReadWithSystemCalls(const std::filesystem::path& file);
+};
+
+namespace tests {
+
+void BatchFileReaderReads();
+
+}
@@ -0,0 +1,526 @@
+#include "bmp_image.h"
+#include "kernels.h"
+#include "request_handler.h"
+#include "snn.h"
+#include "training_database.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <regex>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// Result of a benchmark for the JSON report and the comparison
+struct Result {
+    std::string name;
+    double value;
+    std::string unit;
+    bool higher_is_better;
+};
+
+using Results = std::vector<Result>;
+
+// Network of the recognizer with random weights
+Snn CreateBenchSnn() {
+    Snn snn(1024, 2, 128, 10);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    return snn;
+}
+
+std::vector<float> CreateRandomInputs(size_t count, size_t width) {
+    std::default_random_engine e2(42);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> inputs(count * width);
+    for (float& value : inputs) {
+        value = dist(e2);
+    }
+    return inputs;
+}
+
+// Runs the function until the minimum time passes,
+// returns the number of calls per second
+template <typename Function>
+double MeasureRate(Function function) {
+    constexpr auto min_time = 300ms;
+    size_t calls = 0;
+    const auto start = Clock::now();
+    auto elapsed = Clock::duration::zero();
+    while (elapsed < min_time) {
+        function();
+        ++calls;
+        elapsed = Clock::now() - start;
+    }
+    return calls / std::chrono::duration<double>(elapsed).count();
+}
+
+// Throughput of batched inference against the batch size
+void BenchInferBatch(std::ostream& out, Results& results) {
+    constexpr size_t image_count = 1024;
+    const Snn snn = CreateBenchSnn();
+    const std::vector<float> inputs = CreateRandomInputs(image_count, 1024);
+
+    out << "Inference throughput, network 1024x128x128x10, "s
+        << image_count << " images per pass"s << std::endl;
+    out << std::setw(12) << "batch"s << std::setw(16) << "images/s"s
+        << std::setw(12) << "speedup"s << std::endl;
+
+    // Per-image Infer is the reference
+    SnnWorkspace workspace = snn.CreateWorkspace();
+    std::vector<float> output(10);
+    double reference = image_count * MeasureRate([&]() {
+        for (size_t i = 0; i < image_count; ++i) {
+            snn.Infer({inputs.data() + i * 1024, 1024}, workspace, output);
+        }
+    });
+    out << std::setw(12) << "Infer"s << std::setw(16) << std::fixed << std::setprecision(0)
+        << reference << std::setw(12) << std::setprecision(2) << 1.0 << std::endl;
+    results.push_back({"infer"s, reference, "images/s"s, true});
+
+    SnnBatch batch;
+    std::vector<float> outputs(image_count * 10);
+    for (size_t batch_size = 1; batch_size <= 256; batch_size *= 2) {
+        double rate = image_count * MeasureRate([&]() {
+            for (size_t begin = 0; begin < image_count; begin += batch_size) {
+                snn.InferBatch({inputs.data() + begin * 1024, batch_size * 1024}, batch,
+                               {outputs.data() + begin * 10, batch_size * 10});
+            }
+        });
+        out << std::setw(12) << batch_size << std::setw(16) << std::setprecision(0) << rate
+            << std::setw(12) << std::setprecision(2) << rate / reference << std::endl;
+        results.push_back({"infer_batch/"s + std::to_string(batch_size), rate, "images/s"s, true});
+    }
+}
+
+// Time of each layer of the network, its matrix part and its
+// activation, for every implementation of the sigmoid
+void BenchSigmoid(std::ostream& out, Results& results) {
+    const std::vector<float> inputs = CreateRandomInputs(1, 1024);
+    // Layer sizes of the recognizer and the net inputs of a typical range
+    const std::vector<std::pair<size_t, size_t>> layers = {{1024, 128}, {128, 128}, {128, 10}};
+    std::vector<float> net = CreateRandomInputs(1, 128);
+    for (float& value : net) {
+        value = value * 16.0f - 8.0f;
+    }
+    const std::vector<float> biases(128, 0.05f);
+    const std::vector<float> weights = CreateRandomInputs(128, 1024);
+
+    struct Mode {
+        kernels::Sigmoid sigmoid;
+        std::string name;
+    };
+    const std::vector<Mode> modes = {{kernels::Sigmoid::EXACT, "exact"s},
+                                     {kernels::Sigmoid::POLYNOMIAL, "polynomial"s},
+                                     {kernels::Sigmoid::TABLE, "table"s}};
+
+    out << std::endl << "Cost per layer, ns (kernels: "s << kernels::Active().name << ")"s << std::endl;
+    out << std::setw(12) << "layer"s << std::setw(12) << "matrix"s;
+    for (const Mode& mode : modes) {
+        out << std::setw(12) << mode.name;
+    }
+    out << std::endl;
+
+    const kernels::KernelSet& k = kernels::Active();
+    std::vector<float> values(128);
+    for (auto [in_size, out_size] : layers) {
+        double matrix = 1e9 / MeasureRate([&]() {
+            for (size_t i = 0; i < out_size; ++i) {
+                values[i] = k.dot(weights.data() + i * in_size, inputs.data(), in_size);
+            }
+        });
+        const std::string layer = std::to_string(in_size) + "x"s + std::to_string(out_size);
+        out << std::setw(12) << layer << std::setw(12) << std::fixed << std::setprecision(1) << matrix;
+        results.push_back({"layer/"s + layer + "/matrix"s, matrix, "ns"s, false});
+        for (const Mode& mode : modes) {
+            double activation = 1e9 / MeasureRate([&]() {
+                std::copy_n(net.begin(), out_size, values.begin());
+                kernels::ApplySigmoid(mode.sigmoid, biases.data(), values.data(), out_size);
+            });
+            out << std::setw(12) << activation;
+            results.push_back({"layer/"s + layer + "/"s + mode.name, activation, "ns"s, false});
+        }
+        out << std::endl;
+    }
+
+    out << std::endl << "Inference with each sigmoid"s << std::endl;
+    out << std::setw(12) << "sigmoid"s << std::setw(16) << "images/s"s << std::endl;
+    Snn mode_snn = CreateBenchSnn();
+    SnnWorkspace workspace = mode_snn.CreateWorkspace();
+    std::vector<float> output(10);
+    for (const Mode& mode : modes) {
+        mode_snn.SetSigmoid(mode.sigmoid);
+        double rate = MeasureRate([&]() {
+            mode_snn.Infer(inputs, workspace, output);
+        });
+        out << std::setw(12) << mode.name << std::setw(16) << std::setprecision(0) << rate << std::endl;
+        results.push_back({"infer/sigmoid/"s + mode.name, rate, "images/s"s, true});
+    }
+}
+
+// Training passes of one sample for several sizes of the hidden layers
+void BenchSnnPasses(std::ostream& out, Results& results) {
+    const std::vector<float> input = CreateRandomInputs(1, 1024);
+    std::vector<float> target(10, 0.0f);
+    target[3] = 1.0f;
+
+    out << std::endl << "Training passes of one sample, calls/s"s << std::endl;
+    out << std::setw(12) << "h_n"s << std::setw(16) << "forward"s << std::setw(16) << "backward"s
+        << std::endl;
+    for (size_t h_n : {32, 128, 512}) {
+        Snn snn(1024, 2, h_n, 10);
+        snn.InitializeWeightsWithRandom();
+        snn.InitializeBiasesWithRandom();
+        double forward = MeasureRate([&]() {
+            snn.CalculateOutput(input);
+        });
+        // The errors are taken from the outputs of the last forward pass
+        double backward = MeasureRate([&]() {
+            snn.PropagateErrorBack(target);
+        });
+        out << std::setw(12) << h_n << std::setw(16) << std::fixed << std::setprecision(0) << forward
+            << std::setw(16) << backward << std::endl;
+        results.push_back({"snn/forward/h_n="s + std::to_string(h_n), forward, "calls/s"s, true});
+        results.push_back({"snn/backward/h_n="s + std::to_string(h_n), backward, "calls/s"s, true});
+    }
+}
+
+// Folder of generated glyphs with the layout of the training folder:
+// a folder per digit and a folder of non-chars. The images are 8-bit
+// gray 32x32 BMP files like the ones of training_chars.zip.
+// The folder is removed by the destructor
+class SyntheticDataset {
+public:
+    static constexpr size_t images_per_class = 200;
+    static constexpr size_t non_char_images = 100;
+
+    SyntheticDataset()
+    : folder_(std::filesystem::temp_directory_path() / "recognizer_bench_dataset") {
+        std::filesystem::remove_all(folder_);
+        std::default_random_engine e2(42);
+        for (char c = '0'; c <= '9'; ++c) {
+            CreateFolder(std::string(1, c), images_per_class, e2);
+        }
+        CreateFolder("not_chars"s, non_char_images, e2);
+    }
+
+    ~SyntheticDataset() {
+        std::error_code error;
+        std::filesystem::remove_all(folder_, error);
+    }
+
+    SyntheticDataset(const SyntheticDataset&) = delete;
+    SyntheticDataset& operator=(const SyntheticDataset&) = delete;
+
+    const std::filesystem::path& GetFolder() const {
+        return folder_;
+    }
+
+    std::filesystem::path GetImage() const {
+        return folder_ / "0"s / "0.bmp"s;
+    }
+
+    size_t GetImageCount() const {
+        return 10 * images_per_class + non_char_images;
+    }
+
+private:
+    std::filesystem::path folder_;
+
+    // Random strokes on a white background
+    void CreateFolder(const std::string& name, size_t count, std::default_random_engine& e2) {
+        const std::filesystem::path folder = folder_ / name;
+        std::filesystem::create_directories(folder);
+        std::uniform_int_distribution<int> position(4, 27);
+        for (size_t i = 0; i < count; ++i) {
+            std::vector<uint8_t> pixels(1024, 255);
+            for (int stroke = 0; stroke < 3; ++stroke) {
+                int x = position(e2);
+                int y = position(e2);
+                const bool vertical = stroke % 2 == 0;
+                for (int step = 0; step < 12; ++step) {
+                    pixels[std::clamp(y, 0, 31) * 32 + std::clamp(x, 0, 31)] = 0;
+                    (vertical ? y : x) += step < 6 ? 1 : -1;
+                    (vertical ? x : y) += 1;
+                }
+            }
+            WriteGlyph(folder / (std::to_string(i) + ".bmp"s), pixels);
+        }
+    }
+
+    // Pixels go from the top row
+    static void WriteGlyph(const std::filesystem::path& file, const std::vector<uint8_t>& pixels) {
+        std::vector<uint8_t> bmp(14 + 40 + 256 * 4 + 32 * 32, 0);
+        auto write32 = [&bmp](size_t offset, uint32_t value) {
+            for (size_t i = 0; i < 4; ++i) {
+                bmp[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+            }
+        };
+        bmp[0] = 'B';
+        bmp[1] = 'M';
+        write32(2, static_cast<uint32_t>(bmp.size()));
+        write32(10, 14 + 40 + 256 * 4);
+        write32(14, 40);
+        write32(18, 32);
+        write32(22, 32);
+        write32(26, 1 | 8 << 16); // planes, bits per pixel
+        for (uint32_t i = 0; i < 256; ++i) {
+            write32(54 + i * 4, i * 0x010101);
+        }
+        for (size_t row = 0; row < 32; ++row) { // from the bottom
+            std::memcpy(bmp.data() + 54 + 256 * 4 + row * 32, pixels.data() + (31 - row) * 32, 32);
+        }
+        std::ofstream out(file, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(bmp.data()), bmp.size());
+    }
+};
+
+// One thread and all hardware threads
+std::vector<size_t> BenchThreadCounts() {
+    const size_t threads = std::thread::hardware_concurrency();
+    if (threads > 1) {
+        return {1, threads};
+    }
+    return {1};
+}
+
+// Decoding of one image and building of the training database
+void BenchLoading(std::ostream& out, Results& results, const SyntheticDataset& dataset) {
+    const std::filesystem::path image = dataset.GetImage();
+    out << std::endl << "Loading of the synthetic dataset, "s << dataset.GetImageCount()
+        << " images"s << std::endl;
+    out << std::setw(28) << "operation"s << std::setw(16) << "images/s"s << std::endl;
+
+    double load_bmp = MeasureRate([&]() {
+        img_lib::Image loaded = img_lib::LoadBMP(image);
+        if (!loaded) {
+            throw std::runtime_error("Unable to load "s + image.string());
+        }
+    });
+    out << std::setw(28) << "img_lib::LoadBMP"s << std::setw(16) << std::fixed
+        << std::setprecision(0) << load_bmp << std::endl;
+    results.push_back({"load/img_lib_bmp"s, load_bmp, "images/s"s, true});
+
+    const ImageFileNormalizer normalizer(1024);
+    std::vector<float> values(1024);
+    double normalize = MeasureRate([&]() {
+        normalizer.Load(image, values);
+    });
+    out << std::setw(28) << "ImageFileNormalizer::Load"s << std::setw(16) << normalize << std::endl;
+    results.push_back({"load/normalizer"s, normalize, "images/s"s, true});
+
+    // Without the cache every build decodes all files
+    for (size_t t : BenchThreadCounts()) {
+        double build = dataset.GetImageCount() * MeasureRate([&]() {
+            TrainingDatabase db(&normalizer);
+            db.SetThreads(t);
+            db.BuildFromFolder(dataset.GetFolder());
+        });
+        const std::string name = "BuildFromFolder, "s + std::to_string(t) + " threads"s;
+        out << std::setw(28) << name << std::setw(16) << build << std::endl;
+        results.push_back({"load/build_db/threads="s + std::to_string(t), build, "images/s"s, true});
+    }
+}
+
+// Training epoch and folder recognition as the commands run them
+void BenchEndToEnd(std::ostream& out, Results& results, const SyntheticDataset& dataset) {
+    std::ostream null_output(nullptr);
+
+    out << std::endl << "End to end on the synthetic dataset, network 1024x128x128x10"s << std::endl;
+    out << std::setw(28) << "operation"s << std::setw(16) << "images/s"s << std::endl;
+
+    RequestHandler handler;
+    handler.CreateNewSnn(128);
+    handler.LoadDb(dataset.GetFolder());
+    handler.SetAlgorithm(RequestHandler::SHUFFLED_WITH_NOT_SYM);
+    double epoch = MeasureRate([&]() {
+        handler.Train(1, null_output);
+    });
+    // An epoch has a char sample and a non-char sample per char image
+    double train = epoch * 2 * 10 * SyntheticDataset::images_per_class;
+    out << std::setw(28) << "train epoch"s << std::setw(16) << std::fixed << std::setprecision(0)
+        << train << std::endl;
+    results.push_back({"train/epoch"s, train, "samples/s"s, true});
+
+    for (size_t t : BenchThreadCounts()) {
+        handler.SetThreads(static_cast<int>(t));
+        double recognize = dataset.GetImageCount() * MeasureRate([&]() {
+            handler.Recognize(dataset.GetFolder(), null_output);
+        });
+        const std::string name = "recognize folder, "s + std::to_string(t) + " threads"s;
+        out << std::setw(28) << name << std::setw(16) << recognize << std::endl;
+        results.push_back({"recognize/folder/threads="s + std::to_string(t), recognize, "images/s"s, true});
+    }
+}
+
+void WriteJson(const Results& results, std::ostream& out) {
+    out << "{\n  \"kernels\": \""s << kernels::Active().name << "\",\n  \"results\": [\n"s;
+    out << std::setprecision(6) << std::defaultfloat;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const Result& result = results[i];
+        out << "    {\"name\": \""s << result.name << "\", \"value\": "s << result.value
+            << ", \"unit\": \""s << result.unit << "\", \"higher_is_better\": "s
+            << (result.higher_is_better ? "true"s : "false"s) << "}"s
+            << (i + 1 < results.size() ? ",\n"s : "\n"s);
+    }
+    out << "  ]\n}\n"s;
+}
+
+// Reads the results of a file written by WriteJson
+Results ReadJson(const std::filesystem::path& file) {
+    std::ifstream in(file);
+    if (!in) {
+        throw std::runtime_error("Unable to open file "s + file.string());
+    }
+    std::stringstream text;
+    text << in.rdbuf();
+    const std::string json = text.str();
+
+    static const std::regex result_regex(
+        R"re(\{\s*"name"\s*:\s*"([^"]*)"\s*,\s*"value"\s*:\s*([-+0-9.eE]+)\s*,)re"
+        R"re(\s*"unit"\s*:\s*"([^"]*)"\s*,\s*"higher_is_better"\s*:\s*(true|false)\s*\})re");
+    Results results;
+    for (auto it = std::sregex_iterator(json.begin(), json.end(), result_regex);
+         it != std::sregex_iterator(); ++it) {
+        const std::smatch& match = *it;
+        results.push_back({match[1].str(), std::stod(match[2].str()), match[3].str(),
+                           match[4].str() == "true"sv});
+    }
+    return results;
+}
+
+// Prints the change of every result against the baseline,
+// returns the number of results worse by more than the tolerance
+size_t CompareWithBaseline(const Results& results, const Results& baseline, double tolerance,
+                           std::ostream& out) {
+    out << std::endl << "Comparison with the baseline, tolerance "s << std::fixed
+        << std::setprecision(0) << tolerance * 100 << "%"s << std::endl;
+    out << std::setw(36) << std::left << "benchmark"s << std::right << std::setw(14) << "baseline"s
+        << std::setw(14) << "current"s << std::setw(10) << "change"s << std::endl;
+    size_t regressions = 0;
+    for (const Result& result : results) {
+        auto it = std::find_if(baseline.begin(), baseline.end(), [&result](const Result& base) {
+            return base.name == result.name;
+        });
+        if (it == baseline.end() || it->value <= 0.0) {
+            continue;
+        }
+        // Positive changes are improvements for both kinds of units
+        double change = result.value / it->value - 1.0;
+        if (!result.higher_is_better) {
+            change = it->value / result.value - 1.0;
+        }
+        const bool regression = change < -tolerance;
+        regressions += regression;
+        out << std::setw(36) << std::left << result.name << std::right << std::setw(14)
+            << std::setprecision(1) << it->value << std::setw(14) << result.value
+            << std::setw(9) << std::showpos << change * 100 << std::noshowpos << "%"s
+            << (regression ? "  REGRESSION"s : ""s) << std::endl;
+    }
+    return regressions;
+}
+
+struct BenchOptions {
+    std::string filter; // runs the benchmark groups whose names contain it
+    std::string json_path;
+    std::string baseline_path;
+    double tolerance = 0.1;
+};
+
+BenchOptions ParseOptions(int argc, char** argv) {
+    BenchOptions options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view argument = argv[i];
+        size_t equal_pos = argument.find('=');
+        if (argument.size() < 2 || argument[0] != '-' || equal_pos == std::string_view::npos) {
+            throw std::invalid_argument("Parameters are -name=value, got '"s
+                                        + std::string(argument) + "'"s);
+        }
+        std::string_view name = argument.substr(1, equal_pos - 1);
+        std::string value(argument.substr(equal_pos + 1));
+        if (name == "filter"sv) {
+            options.filter = value;
+        } else if (name == "json"sv) {
+            options.json_path = value;
+        } else if (name == "baseline"sv) {
+            options.baseline_path = value;
+        } else if (name == "tolerance"sv) {
+            options.tolerance = std::stod(value);
+        } else {
+            throw std::invalid_argument("Unsupported parameter '"s + std::string(name) + "'"s);
+        }
+    }
+    return options;
+}
+
+}
+
+// Options:
+//     -filter=<text> - runs only the groups whose names contain the text:
+//      infer, sigmoid, snn, load, end_to_end
+//     -json=<path> - saves the results as JSON
+//     -baseline=<path> - compares the results with a JSON saved earlier,
+//      the exit code is 1 if any of them is worse by more than the tolerance
+//     -tolerance=<fraction> - allowed slowdown, default 0.1
+int main(int argc, char** argv) {
+    try {
+        const BenchOptions options = ParseOptions(argc, argv);
+        auto selected = [&options](std::string_view group) {
+            return group.find(options.filter) != std::string_view::npos;
+        };
+
+        Results results;
+        if (selected("infer"sv)) {
+            BenchInferBatch(std::cout, results);
+        }
+        if (selected("sigmoid"sv)) {
+            BenchSigmoid(std::cout, results);
+        }
+        if (selected("snn"sv)) {
+            BenchSnnPasses(std::cout, results);
+        }
+        if (selected("load"sv) || selected("end_to_end"sv)) {
+            const SyntheticDataset dataset;
+            if (selected("load"sv)) {
+                BenchLoading(std::cout, results, dataset);
+            }
+            if (selected("end_to_end"sv)) {
+                BenchEndToEnd(std::cout, results, dataset);
+            }
+        }
+
+        if (!options.json_path.empty()) {
+            std::ofstream json(options.json_path);
+            if (!json) {
+                throw std::runtime_error("Unable to open file "s + options.json_path);
+            }
+            WriteJson(results, json);
+        }
+        if (!options.baseline_path.empty()) {
+            const Results baseline = ReadJson(options.baseline_path);
+            size_t regressions = CompareWithBaseline(results, baseline, options.tolerance, std::cout);
+            std::cout << std::endl << regressions << " regressions"s << std::endl;
+            if (regressions > 0) {
+                return 1;
+            }
+        }
+    } catch (const std::exception& e) {
+        std::cout << "An error has occurred: "s << e.what() << std::endl;
+        return 2;
+    }
+    return 0;
+}
@@ -0,0 +1,146 @@
+#include "checkpoint_writer.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+CheckpointWriter::CheckpointWriter(std::filesystem::path file)
+: file_(std::move(file))
+, thread_([this]() {
+    Run();
+}) {
+}
+
+CheckpointWriter::~CheckpointWriter() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    changed_.notify_all();
+    thread_.join();
+}
+
+void CheckpointWriter::Submit(const Snn& snn, const TrainingState& state,
+                              std::shared_ptr<const Snn> best) {
+    PROFILE_SCOPE("checkpoint");
+    int index;
+    {
+        std::lock_guard lock(mutex_);
+        RethrowError();
+        // The writer doesn't take a buffer while it is filled: it isn't
+        // the written one, and it stops being the waiting one
+        index = writing_ == 0 ? 1 : 0;
+        if (waiting_ == index) {
+            waiting_ = -1;
+        }
+    }
+
+    Buffer& buffer = buffers_[index];
+    const SnnLayout& layout = snn.GetLayout();
+    if (!buffer.snn || buffer.snn->GetLayout().weights_size != layout.weights_size
+        || buffer.snn->GetLayout().biases_size != layout.biases_size
+        || buffer.snn->GetLearningCoefficient() != snn.GetLearningCoefficient()) {
+        buffer.parameters = std::make_shared<AlignedVector<float>>(layout.weights_size + layout.biases_size);
+        const float* weights = buffer.parameters->data();
+        buffer.snn = std::make_unique<Snn>(layout, snn.GetLearningCoefficient(), weights,
+                                           weights + layout.weights_size, buffer.parameters);
+    }
+    std::copy(snn.GetWeights().begin(), snn.GetWeights().end(), buffer.parameters->begin());
+    std::copy(snn.GetBiases().begin(), snn.GetBiases().end(),
+              buffer.parameters->begin() + layout.weights_size);
+    buffer.state = state;
+    buffer.best = std::move(best);
+
+    {
+        std::lock_guard lock(mutex_);
+        waiting_ = index;
+    }
+    changed_.notify_all();
+}
+
+void CheckpointWriter::Flush() {
+    std::unique_lock lock(mutex_);
+    changed_.wait(lock, [this]() {
+        return waiting_ < 0 && writing_ < 0;
+    });
+    RethrowError();
+}
+
+void CheckpointWriter::Run() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        changed_.wait(lock, [this]() {
+            return waiting_ >= 0 || stop_;
+        });
+        if (waiting_ < 0) {
+            return;
+        }
+        const int index = std::exchange(waiting_, -1);
+        writing_ = index;
+        lock.unlock();
+
+        std::exception_ptr error;
+        try {
+            PROFILE_SCOPE("write checkpoint");
+            const Buffer& buffer = buffers_[index];
+            SaveCheckpoint(file_, *buffer.snn, buffer.state, buffer.best.get());
+        } catch (...) {
+            error = std::current_exception();
+        }
+
+        lock.lock();
+        if (error) {
+            error_ = error;
+        }
+        writing_ = -1;
+        changed_.notify_all();
+    }
+}
+
+void CheckpointWriter::RethrowError() {
+    if (error_) {
+        std::rethrow_exception(std::exchange(error_, nullptr));
+    }
+}
+
+namespace tests {
+
+void WriteCheckpointsInBackground() {
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "snn_checkpoint_writer_test";
+    Snn snn(20, 1, 8, 5);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    {
+        CheckpointWriter writer(file);
+        TrainingState state;
+        for (int epoch = 1; epoch <= 5; ++epoch) {
+            state.epoch = epoch;
+            writer.Submit(snn, state, nullptr);
+        }
+        writer.Flush();
+    }
+
+    // The last submitted checkpoint is the one in the file
+    const Checkpoint checkpoint = LoadCheckpoint(file);
+    assert(checkpoint.state.epoch == 5);
+    assert(std::ranges::equal(checkpoint.snn->GetWeights(), snn.GetWeights()));
+    assert(std::ranges::equal(checkpoint.snn->GetBiases(), snn.GetBiases()));
+    assert(!checkpoint.best);
+
+    // A failed write is reported by the next call
+    [[maybe_unused]] bool reported = false;
+    {
+        CheckpointWriter writer(file / "missing_folder" / "checkpoint");
+        writer.Submit(snn, TrainingState(), nullptr);
+        try {
+            writer.Flush();
+        } catch (const std::exception&) {
+            reported = true;
+        }
+    }
+    assert(reported);
+    std::filesystem::remove(file);
+}
+
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "snn.h"
+#include "state_saver.h"
+
+#include <array>
+#include <condition_variable>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+// Writes checkpoints of the training in a background thread, so the
+// training never waits for the disk. There are two buffers of the
+// parameters: the writer saves one of them while Submit copies the
+// network to the other. If the writer is still busy when the next
+// checkpoint comes, the waiting one is replaced by it, so the newest
+// state is always written next
+
+class CheckpointWriter {
+public:
+    explicit CheckpointWriter(std::filesystem::path file);
+    // Writes the waiting checkpoint and stops the thread
+    ~CheckpointWriter();
+
+    CheckpointWriter(const CheckpointWriter&) = delete;
+    CheckpointWriter& operator=(const CheckpointWriter&) = delete;
+
+    // Copies the parameters to the free buffer and returns without waiting.
+    // The best network must not be changed afterwards (e.g. a snapshot).
+    // Rethrows the error of a failed write
+    void Submit(const Snn& snn, const TrainingState& state, std::shared_ptr<const Snn> best);
+
+    // Waits until the submitted checkpoints are written,
+    // rethrows the error of a failed write
+    void Flush();
+
+private:
+    struct Buffer {
+        std::shared_ptr<AlignedVector<float>> parameters;
+        std::unique_ptr<Snn> snn; // network over the parameters
+        TrainingState state;
+        std::shared_ptr<const Snn> best;
+    };
+
+    std::filesystem::path file_;
+    std::array<Buffer, 2> buffers_;
+
+    std::mutex mutex_;
+    std::condition_variable changed_;
+    int writing_ = -1; // index of the buffer being written, -1 if none
+    int waiting_ = -1; // index of the buffer to write next, -1 if none
+    bool stop_ = false;
+    std::exception_ptr error_;
+    std::thread thread_;
+
+    void Run();
+    void RethrowError(); // the mutex must be locked
+};
+
+namespace tests {
+
+void WriteCheckpointsInBackground();
+
+}
@@ -1,4 +1,5 @@
 #include "command_interpreter.h"
+#include "profiler.h"
 
 #include <cassert>
 #include <cstring>
@@ -57,6 +58,45 @@ int StringViewToInt(std::string_view value) {
     }
 }
 
+double StringViewToDouble(std::string_view value) {
+    try {
+        return std::stod(std::string(value));
+    } catch (...) {
+        throw std::invalid_argument(std::string(value) + " is not a number"s);
+    }
+}
+
+kernels::Sigmoid StringViewToSigmoid(std::string_view value) {
+    int sigmoid = StringViewToInt(value);
+    if (sigmoid < static_cast<int>(kernels::Sigmoid::EXACT)
+        || sigmoid > static_cast<int>(kernels::Sigmoid::TABLE)) {
+        throw std::invalid_argument("Only sigmoids 0 (exact), "
+            "1 (polynomial), 2 (table) are supported"s);
+    }
+    return static_cast<kernels::Sigmoid>(sigmoid);
+}
+
+std::string StringViewToProfilePath(std::string_view value) {
+    if (!profiler::enabled) {
+        throw std::invalid_argument("The program is built without profiling, "
+            "configure it with -DRECOGNIZER_PROFILE=ON"s);
+    }
+    return std::string(value);
+}
+
+// Summary table, or Chrome trace for a path with the .json extension
+void SaveProfile(const std::filesystem::path& path) {
+    std::ofstream profile_file(path);
+    if (!profile_file) {
+        throw std::runtime_error("Unable to open file "s + path.string() + " for saving profile"s);
+    }
+    if (path.extension() == ".json"sv) {
+        profiler::WriteChromeTrace(profile_file);
+    } else {
+        profiler::WriteSummary(profile_file);
+    }
+}
+
 }
 
 Command ParseStrings(const std::vector<std::string_view>& strings) {
@@ -81,6 +121,9 @@ Command ParseStrings(const std::vector<std::string_view>& strings) {
             } else if (name == "db_path"sv) {
                 train_command.db_path = std::string(value);
 
+            } else if (name == "db_cache"sv) {
+                train_command.db_cache = std::string(value);
+
             } else if (name == "path_to_save"sv) {
                 train_command.path_to_save = std::string(value);
 
@@ -108,6 +151,98 @@ Command ParseStrings(const std::vector<std::string_view>& strings) {
                 }
                 train_command.hidden_neurons = h_n;
 
+            } else if (name == "batch"sv) {
+                int batch_size = StringViewToInt(value);
+                if (batch_size < 1) {
+                    throw std::invalid_argument("Batch size must be greater than 0"s);
+                }
+                train_command.batch_size = batch_size;
+
+            } else if (name == "threads"sv) {
+                int threads = StringViewToInt(value);
+                if (threads < 1) {
+                    throw std::invalid_argument("Number of threads must be greater than 0"s);
+                }
+                train_command.threads = threads;
+
+            } else if (name == "strategy"sv) {
+                int strategy = StringViewToInt(value);
+                if (strategy < RequestHandler::HOGWILD
+                    || strategy > RequestHandler::SYNCHRONOUS) {
+                    throw std::invalid_argument("Only strategies 0 (hogwild), "
+                        "1 (synchronous) are supported"s);
+                }
+                train_command.strategy = static_cast<RequestHandler::ParallelStrategy>(strategy);
+
+            } else if (name == "metrics"sv) {
+                int metrics = StringViewToInt(value);
+                if (metrics < RequestHandler::COUNTER
+                    || metrics > RequestHandler::JSON_LINES) {
+                    throw std::invalid_argument("Only metrics formats 0 (cycle counter), "
+                        "1 (text), 2 (JSON lines) are supported"s);
+                }
+                train_command.metrics = static_cast<RequestHandler::MetricsFormat>(metrics);
+
+            } else if (name == "validation"sv) {
+                double validation = StringViewToDouble(value);
+                if (validation < 0.0 || validation >= 1.0) {
+                    throw std::invalid_argument("Validation fraction must be in [0, 1)"s);
+                }
+                train_command.validation = validation;
+
+            } else if (name == "monitor"sv) {
+                int monitor = StringViewToInt(value);
+                if (monitor < RequestHandler::ACCURACY || monitor > RequestHandler::RMSE) {
+                    throw std::invalid_argument("Only monitored metrics 0 (accuracy), "
+                        "1 (rmse) are supported"s);
+                }
+                train_command.stopping.monitor = static_cast<RequestHandler::Monitor>(monitor);
+
+            } else if (name == "patience"sv) {
+                int patience = StringViewToInt(value);
+                if (patience < 0) {
+                    throw std::invalid_argument("Patience must not be negative"s);
+                }
+                train_command.stopping.patience = patience;
+
+            } else if (name == "min_delta"sv) {
+                double min_delta = StringViewToDouble(value);
+                if (min_delta < 0.0) {
+                    throw std::invalid_argument("Min delta must not be negative"s);
+                }
+                train_command.stopping.min_delta = min_delta;
+
+            } else if (name == "target_accuracy"sv) {
+                double target_accuracy = StringViewToDouble(value);
+                if (target_accuracy < 0.0 || target_accuracy > 1.0) {
+                    throw std::invalid_argument("Target accuracy must be in [0, 1]"s);
+                }
+                train_command.stopping.target_accuracy = target_accuracy;
+
+            } else if (name == "checkpoint"sv) {
+                train_command.checkpoint = std::string(value);
+
+            } else if (name == "checkpoint_interval"sv) {
+                int interval = StringViewToInt(value);
+                if (interval < 1) {
+                    throw std::invalid_argument("Checkpoint interval must be positive"s);
+                }
+                train_command.checkpoint_interval = interval;
+
+            } else if (name == "resume"sv) {
+                int resume = StringViewToInt(value);
+                if (resume != 0 && resume != 1) {
+                    throw std::invalid_argument("Only resume values 0 (new training), "
+                        "1 (from the checkpoint) are supported"s);
+                }
+                train_command.resume = resume == 1;
+
+            } else if (name == "sigmoid"sv) {
+                train_command.sigmoid = StringViewToSigmoid(value);
+
+            } else if (name == "profile"sv) {
+                train_command.profile_path = StringViewToProfilePath(value);
+
             } else {
                 throw ParsingError("Unsupported parameter '"s
                         + std::string(name) + "'"s);
@@ -130,6 +265,41 @@ Command ParseStrings(const std::vector<std::string_view>& strings) {
             } else if (name == "result_path"sv) {
                 recognize_command.result_path = std::string(value);
 
+            } else if (name == "threads"sv) {
+                int threads = StringViewToInt(value);
+                if (threads < 1) {
+                    throw std::invalid_argument("Number of threads must be greater than 0"s);
+                }
+                recognize_command.threads = threads;
+
+            } else if (name == "prefetch"sv) {
+                int prefetch = StringViewToInt(value);
+                if (prefetch < 0) {
+                    throw std::invalid_argument("Prefetch depth must not be negative"s);
+                }
+                recognize_command.prefetch = prefetch;
+
+            } else if (name == "readers"sv) {
+                int readers = StringViewToInt(value);
+                if (readers < 1) {
+                    throw std::invalid_argument("Number of readers must be greater than 0"s);
+                }
+                recognize_command.readers = readers;
+
+            } else if (name == "int8"sv) {
+                int int8 = StringViewToInt(value);
+                if (int8 != 0 && int8 != 1) {
+                    throw std::invalid_argument("Only int8 values 0 (float network), "
+                        "1 (int8 network) are supported"s);
+                }
+                recognize_command.int8 = int8 == 1;
+
+            } else if (name == "sigmoid"sv) {
+                recognize_command.sigmoid = StringViewToSigmoid(value);
+
+            } else if (name == "profile"sv) {
+                recognize_command.profile_path = StringViewToProfilePath(value);
+
             } else {
                 throw ParsingError("Unsupported parameter '"s
                         + std::string(name) + "'"s);
@@ -137,6 +307,108 @@ Command ParseStrings(const std::vector<std::string_view>& strings) {
         }
         command = recognize_command;
 
+    } else if (name == "compare"sv) {
+        CompareCommand compare_command;
+        for (int i = 1; i < strings.size(); ++i) {
+            std::string_view str = strings[i];
+            auto [name, value] = ParseParameter(str);
+
+            if (name == "snn_data_path"sv) {
+                compare_command.snn_data_path = std::string(value);
+
+            } else if (name == "db_path"sv) {
+                compare_command.db_path = std::string(value);
+
+            } else if (name == "result_path"sv) {
+                compare_command.result_path = std::string(value);
+
+            } else {
+                throw ParsingError("Unsupported parameter '"s
+                        + std::string(name) + "'"s);
+            }
+        }
+        command = compare_command;
+
+    } else if (name == "quantize"sv) {
+        QuantizeCommand quantize_command;
+        for (int i = 1; i < strings.size(); ++i) {
+            std::string_view str = strings[i];
+            auto [name, value] = ParseParameter(str);
+
+            if (name == "snn_data_path"sv) {
+                quantize_command.snn_data_path = std::string(value);
+
+            } else if (name == "path_to_save"sv) {
+                quantize_command.path_to_save = std::string(value);
+
+            } else {
+                throw ParsingError("Unsupported parameter '"s
+                        + std::string(name) + "'"s);
+            }
+        }
+        command = quantize_command;
+
+    } else if (name == "serve"sv) {
+        ServeCommand serve_command;
+        for (int i = 1; i < strings.size(); ++i) {
+            std::string_view str = strings[i];
+            auto [name, value] = ParseParameter(str);
+
+            if (name == "snn_data_path"sv) {
+                serve_command.snn_data_path = std::string(value);
+
+            } else if (name == "socket_path"sv) {
+                serve_command.socket_path = std::string(value);
+
+            } else if (name == "threads"sv) {
+                int threads = StringViewToInt(value);
+                if (threads < 1) {
+                    throw std::invalid_argument("Number of threads must be greater than 0"s);
+                }
+                serve_command.threads = threads;
+
+            } else if (name == "int8"sv) {
+                int int8 = StringViewToInt(value);
+                if (int8 != 0 && int8 != 1) {
+                    throw std::invalid_argument("Only int8 values 0 (float network), "
+                        "1 (int8 network) are supported"s);
+                }
+                serve_command.int8 = int8 == 1;
+
+            } else if (name == "sigmoid"sv) {
+                serve_command.sigmoid = StringViewToSigmoid(value);
+
+            } else {
+                throw ParsingError("Unsupported parameter '"s
+                        + std::string(name) + "'"s);
+            }
+        }
+        command = serve_command;
+
+    } else if (name == "pack"sv || name == "unpack"sv) {
+        std::string db_path = "training_chars"s;
+        std::string bundle_path = "training_chars.glyphs"s;
+        for (int i = 1; i < strings.size(); ++i) {
+            std::string_view str = strings[i];
+            auto [name, value] = ParseParameter(str);
+
+            if (name == "db_path"sv) {
+                db_path = std::string(value);
+
+            } else if (name == "bundle_path"sv) {
+                bundle_path = std::string(value);
+
+            } else {
+                throw ParsingError("Unsupported parameter '"s
+                        + std::string(name) + "'"s);
+            }
+        }
+        if (name == "pack"sv) {
+            command = PackCommand{db_path, bundle_path};
+        } else {
+            command = UnpackCommand{bundle_path, db_path};
+        }
+
     } else {
         throw ParsingError("Unsupported command '"s
                 + std::string(name) + "'"s);
@@ -153,24 +425,124 @@ const std::string help_string =
     "    -snn_data_path - Path to the pre-trained neural network.\n"
     "    Default value is an empty string, which creates an untrained\n"
     "    neural network.\n\n"
-    "    -db_path - Path to the folder with images. Default value\n"
-    "    is \"training_chars\".\n\n"
+    "    -db_path - Path to the folder with images, to a glyph bundle or\n"
+    "    to a zip archive of the folder, which is read without extraction.\n"
+    "    Default value is \"training_chars\".\n\n"
+    "    -db_cache - Path to the cache of decoded images. Later runs decode\n"
+    "    only new and changed files. Default value is the folder path with\n"
+    "    the \".samples_cache\" suffix, \"none\" disables the cache.\n\n"
     "    -path_to_save= - Path to save the trained neural network data.\n"
     "    Default value is \"snn_data\".\n\n"
-    "    -cycles - Number of training cycles. Default value is 1000.\n\n"
+    "    -cycles - Number of training cycles, the maximal one if a stopping\n"
+    "    criterion is set. Default value is 1000.\n\n"
     "    -algorithm - Training algorithm. Default value is 1. Algorithms\n"
     "     0 (sequential), 1 (shuffled), 2 (shuffled_with_not_sym) are supported.\n\n"
     "    -h_n - The number of neurons in each hidden layer. Default value is 128.\n\n"
+    "    -batch - Number of samples trained together as a mini-batch. Gradients\n"
+    "    are summed over the batch and applied once. Default value is 1.\n\n"
+    "    -threads - Number of training threads, they also decode the images.\n"
+    "    Default value is 1.\n\n"
+    "    -strategy - How threads share the network. Default value is 0. Strategies\n"
+    "     0 (hogwild, lock-free updates of shared weights), 1 (synchronous,\n"
+    "     gradients of the threads are averaged after each step) are supported.\n\n"
+    "    -metrics - How the epochs are reported. Default value is 0. Formats\n"
+    "     0 (cycle counter), 1 (text), 2 (JSON lines) are supported, 1 and 2\n"
+    "     give the mean RMSE, the accuracy, samples/s and the time of each epoch.\n\n"
+    "    -validation - Part of the images of each folder held out of the training\n"
+    "    and evaluated after each epoch. Default value is 0 (no validation).\n\n"
+    "    -patience - Stop the training after so many epochs without an\n"
+    "    improvement of the monitored metric (validation one if there is\n"
+    "    validation) and keep the best network. Default value is 0 (disabled).\n\n"
+    "    -monitor - Metric of -patience: 0 (accuracy), 1 (rmse). Default value is 0.\n\n"
+    "    -min_delta - Smaller changes of the monitored metric are not\n"
+    "    improvements. Default value is 0.\n\n"
+    "    -target_accuracy - Stop the training when the accuracy reaches it\n"
+    "    and keep the best network. Default value is 0 (disabled).\n\n"
+    "    -checkpoint - Path of the checkpoint that is written in the background\n"
+    "    during the training: the network, the epoch, the order of samples and\n"
+    "    the best network. Default value is an empty string (no checkpoints).\n\n"
+    "    -checkpoint_interval - Epochs between checkpoints, the last epoch is\n"
+    "    always saved. Default value is 1.\n\n"
+    "    -resume - 1 to continue the training from the checkpoint, if it exists,\n"
+    "    with the same options. -cycles counts the epochs of the checkpoint.\n"
+    "    Default value is 0.\n\n"
+    "    -sigmoid - Implementation of the activation. Default value is 0.\n"
+    "     0 (exact std::exp), 1 (vectorized polynomial, max error 1e-7),\n"
+    "     2 (table with interpolation, max error 3e-6) are supported.\n\n"
+    "    -profile - Path to save the time profile of the training phases, a table\n"
+    "    or a Chrome trace for the .json extension. Only for the program built\n"
+    "    with -DRECOGNIZER_PROFILE=ON. Default value is an empty string.\n\n"
     "2. recognize - Loads the neural network data and recognizes an image or\n"
     "a folder with images.\n\n"
     "Options:\n"
-    "    -snn_data_path - Path to the pre-trained neural network. Default value\n"
-    "    is \"snn_data\".\n\n"
+    "    -snn_data_path - Path to the pre-trained neural network or to its\n"
+    "    int8 model made by the quantize command. Default value is \"snn_data\".\n\n"
     "    -target_path - Path to the image file or folder with images for\n"
     "    recognition. Default value is \"target_chars\".\n\n"
     "    -result_path - Path to save the report as a text file. If not specified,\n"
     "    the report will be displayed in the terminal. Default value is\n"
-    "    an empty string."s;
+    "    an empty string.\n\n"
+    "    -threads - Number of threads that traverse the folder, decode and\n"
+    "    recognize images. The report order doesn't depend on it. Default\n"
+    "    value is 1.\n\n"
+    "    -prefetch - Number of images read and decoded ahead of the recognition\n"
+    "    with one thread, it hides the latency of slow storage. Default value\n"
+    "    is 0, which disables it.\n\n"
+    "    -readers - Number of threads that read the images ahead with\n"
+    "    -prefetch. Default value is 2.\n\n"
+    "    -int8 - Recognize with the network quantized to int8 weights, it is\n"
+    "    faster, the outputs differ slightly. An int8 model is always used so.\n"
+    "    Default value is 0.\n\n"
+    "    -sigmoid - Implementation of the activation of the float network\n"
+    "    as in the train command. Default value is 0.\n\n"
+    "    -profile - Path to save the time profile as in the train command.\n\n"
+    "3. compare - Recognizes the images of a training folder with the float\n"
+    "and the int8 network and reports the accuracy of both.\n\n"
+    "Options:\n"
+    "    -snn_data_path - Path to the pre-trained neural network. Default value\n"
+    "    is \"snn_data\".\n\n"
+    "    -db_path - Path to the folder with labelled images. Default value\n"
+    "    is \"training_chars\".\n\n"
+    "    -result_path - Path to save the report as a text file. If not specified,\n"
+    "    the report will be displayed in the terminal.\n\n"
+    "4. quantize - Quantizes the network to int8 weights and saves the int8\n"
+    "model, about 4 times smaller than the network data. The recognize and\n"
+    "serve commands map it instead of quantizing the network every run.\n\n"
+    "Options:\n"
+    "    -snn_data_path - Path to the pre-trained neural network. Default value\n"
+    "    is \"snn_data\".\n\n"
+    "    -path_to_save - Path to save the int8 model. Default value\n"
+    "    is \"snn_data.int8\".\n\n"
+    "5. serve - Loads the neural network data once and recognizes images sent\n"
+    "by clients over a Unix domain socket until it is interrupted. A request\n"
+    "is a path of an image file or 1024 gray levels of a 32x32 glyph, the\n"
+    "response is the class and the 10 outputs (see readme.md).\n\n"
+    "Options:\n"
+    "    -snn_data_path - Path to the pre-trained neural network or to its\n"
+    "    int8 model as in the recognize command. Default value is \"snn_data\".\n\n"
+    "    -socket_path - Path of the socket file. Default value\n"
+    "    is \"recognizer.sock\".\n\n"
+    "    -threads - Number of threads that serve the requests of all clients.\n"
+    "    Default value is 4.\n\n"
+    "    -int8 - Recognize with the network quantized to int8 weights as in\n"
+    "    the recognize command. Default value is 0.\n\n"
+    "    -sigmoid - Implementation of the activation of the float network\n"
+    "    as in the train command. Default value is 0.\n\n"
+    "6. pack - Packs a folder with the layout of the training folder into\n"
+    "a glyph bundle: one mapped file with the 8-bit pixels of all images.\n"
+    "The train and recognize commands accept a bundle instead of a folder.\n\n"
+    "Options:\n"
+    "    -db_path - Path to the folder with images. Default value\n"
+    "    is \"training_chars\".\n\n"
+    "    -bundle_path - Path to save the bundle. Default value\n"
+    "    is \"training_chars.glyphs\".\n\n"
+    "7. unpack - Restores the folder of a glyph bundle, a subfolder per\n"
+    "label with a gray BMP image per glyph.\n\n"
+    "Options:\n"
+    "    -bundle_path - Path to the bundle. Default value\n"
+    "    is \"training_chars.glyphs\".\n\n"
+    "    -db_path - Path to the folder to create. Default value\n"
+    "    is \"training_chars\"."s;
 
 void InterpretCommand(Command command) {
     RequestHandler handler;
@@ -181,20 +553,55 @@ void InterpretCommand(Command command) {
         
     } else if (std::holds_alternative<TrainCommand>(command)) {
         TrainCommand train_command = std::get<TrainCommand>(command);
-        if (train_command.snn_data_path.empty()) {
+        if (train_command.resume && train_command.checkpoint.empty()) {
+            throw std::invalid_argument("Resume requires the checkpoint path"s);
+        }
+        if (train_command.resume && std::filesystem::exists(train_command.checkpoint)) {
+            handler.ResumeFromCheckpoint(train_command.checkpoint);
+        } else if (train_command.snn_data_path.empty()) {
             handler.CreateNewSnn(train_command.hidden_neurons);
         } else {
             handler.LoadSnn(train_command.snn_data_path);
         }
 
-        handler.LoadDb(train_command.db_path);
+        std::filesystem::path db_cache = train_command.db_cache;
+        if (train_command.db_cache.empty()) {
+            // Next to the folder: the recognize command reads every file in it
+            db_cache = std::filesystem::path(train_command.db_path).lexically_normal();
+            if (!db_cache.has_filename()) {
+                db_cache = db_cache.parent_path();
+            }
+            db_cache += ".samples_cache"s;
+        } else if (train_command.db_cache == "none"sv) {
+            db_cache.clear();
+        }
+        handler.SetThreads(train_command.threads);
+        handler.LoadDb(train_command.db_path, db_cache);
         handler.SetAlgorithm(train_command.algorithm);
+        handler.SetBatchSize(train_command.batch_size);
+        handler.SetParallelStrategy(train_command.strategy);
+        handler.SetMetricsFormat(train_command.metrics);
+        handler.SetValidationFraction(train_command.validation);
+        handler.SetStoppingCriteria(train_command.stopping);
+        if (!train_command.checkpoint.empty()) {
+            handler.SetCheckpoint(train_command.checkpoint, train_command.checkpoint_interval);
+        }
+        handler.SetSigmoid(train_command.sigmoid);
         handler.Train(train_command.training_cycles, std::cout);
         handler.SaveSnn(train_command.path_to_save);
+        if (!train_command.profile_path.empty()) {
+            SaveProfile(train_command.profile_path);
+        }
 
     } else if (std::holds_alternative<RecognizeCommand>(command)) {
         RecognizeCommand recogn_command = std::get<RecognizeCommand>(command);
-        handler.LoadSnn(recogn_command.snn_data_path);
+        handler.MapSnn(recogn_command.snn_data_path);
+        handler.SetThreads(recogn_command.threads);
+        handler.SetPrefetch(recogn_command.prefetch, recogn_command.readers);
+        handler.SetSigmoid(recogn_command.sigmoid);
+        if (recogn_command.int8) {
+            handler.QuantizeSnn();
+        }
 
         std::ostream *os;
         std::ofstream result_file; 
@@ -209,8 +616,53 @@ void InterpretCommand(Command command) {
             os = &result_file;
         }
         handler.Recognize(recogn_command.target_path, *os);
+        if (!recogn_command.profile_path.empty()) {
+            SaveProfile(recogn_command.profile_path);
+        }
         
  
+    } else if (std::holds_alternative<CompareCommand>(command)) {
+        CompareCommand compare_command = std::get<CompareCommand>(command);
+        handler.MapSnn(compare_command.snn_data_path);
+
+        std::ostream *os;
+        std::ofstream result_file;
+        if (compare_command.result_path.empty()) {
+            os = &std::cout;
+        } else {
+            result_file.open(compare_command.result_path);
+            if (!result_file) {
+                throw std::runtime_error("Unable to open file "s
+                    + compare_command.result_path + " for saving result"s);
+            }
+            os = &result_file;
+        }
+        handler.CompareQuantized(compare_command.db_path, *os);
+
+    } else if (std::holds_alternative<QuantizeCommand>(command)) {
+        QuantizeCommand quantize_command = std::get<QuantizeCommand>(command);
+        handler.MapSnn(quantize_command.snn_data_path);
+        handler.QuantizeSnn();
+        handler.SaveQuantizedSnn(quantize_command.path_to_save);
+
+    } else if (std::holds_alternative<ServeCommand>(command)) {
+        ServeCommand serve_command = std::get<ServeCommand>(command);
+        handler.MapSnn(serve_command.snn_data_path);
+        handler.SetThreads(serve_command.threads);
+        handler.SetSigmoid(serve_command.sigmoid);
+        if (serve_command.int8) {
+            handler.QuantizeSnn();
+        }
+        handler.Serve(serve_command.socket_path, std::cout);
+
+    } else if (std::holds_alternative<PackCommand>(command)) {
+        PackCommand pack_command = std::get<PackCommand>(command);
+        handler.Pack(pack_command.db_path, pack_command.bundle_path, std::cout);
+
+    } else if (std::holds_alternative<UnpackCommand>(command)) {
+        UnpackCommand unpack_command = std::get<UnpackCommand>(command);
+        handler.Unpack(unpack_command.bundle_path, unpack_command.db_path, std::cout);
+
     } else {
         std::cout << "Unrealized command"s << std::endl;
     }
@@ -18,23 +18,70 @@ using namespace std::literals;
 struct TrainCommand {
     std::string snn_data_path = ""s;
     std::string db_path = "training_chars"s;
+    std::string db_cache = ""s; // empty for the default place next to the db folder
     std::string path_to_save = "snn_data"s;
     int training_cycles = 1000;
     RequestHandler::Algorithm algorithm = RequestHandler::SHUFFLED;
     int hidden_neurons = 128;
+    int batch_size = 1;
+    int threads = 1;
+    RequestHandler::ParallelStrategy strategy = RequestHandler::HOGWILD;
+    RequestHandler::MetricsFormat metrics = RequestHandler::COUNTER;
+    double validation = 0.0;
+    RequestHandler::StoppingCriteria stopping;
+    std::string checkpoint = ""s; // empty if there are no checkpoints
+    int checkpoint_interval = 1;
+    bool resume = false;
+    kernels::Sigmoid sigmoid = kernels::Sigmoid::EXACT;
+    std::string profile_path = ""s; // empty if the profile is not saved
 };
 
 struct RecognizeCommand {
     std::string snn_data_path = "snn_data"s;
     std::string target_path = "target_chars"s;
     std::string result_path = ""s;
+    int threads = 1;
+    int prefetch = 0; // images read ahead, 0 disables the prefetch
+    int readers = 2;
+    bool int8 = false;
+    kernels::Sigmoid sigmoid = kernels::Sigmoid::EXACT;
+    std::string profile_path = ""s;
+};
+
+struct CompareCommand {
+    std::string snn_data_path = "snn_data"s;
+    std::string db_path = "training_chars"s;
+    std::string result_path = ""s;
+};
+
+struct QuantizeCommand {
+    std::string snn_data_path = "snn_data"s;
+    std::string path_to_save = "snn_data.int8"s;
+};
+
+struct ServeCommand {
+    std::string snn_data_path = "snn_data"s;
+    std::string socket_path = "recognizer.sock"s;
+    int threads = 4;
+    bool int8 = false;
+    kernels::Sigmoid sigmoid = kernels::Sigmoid::EXACT;
+};
+
+struct PackCommand {
+    std::string db_path = "training_chars"s;
+    std::string bundle_path = "training_chars.glyphs"s;
+};
+
+struct UnpackCommand {
+    std::string bundle_path = "training_chars.glyphs"s;
+    std::string db_path = "training_chars"s;
 };
 
 struct HelpCommand {
 };
 
-using Command = std::variant<std::monostate,
-    TrainCommand, RecognizeCommand, HelpCommand>;
+using Command = std::variant<std::monostate, TrainCommand, RecognizeCommand,
+    CompareCommand, QuantizeCommand, ServeCommand, PackCommand, UnpackCommand, HelpCommand>;
 
 Command ParseStrings(const std::vector<std::string_view>& strings);
 void InterpretCommand(Command command);
@@ -0,0 +1,113 @@
+#include "directory_reader.h"
+
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define DIRECTORY_READER_POSIX
+    #include <dirent.h>
+    #include <sys/stat.h>
+#endif
+
+using namespace std::literals;
+
+#ifdef DIRECTORY_READER_POSIX
+
+struct DirectoryReader::Handle {
+    DIR* dir = nullptr;
+};
+
+#else
+
+struct DirectoryReader::Handle {
+    std::filesystem::directory_iterator it;
+    bool started = false;
+};
+
+#endif
+
+DirectoryReader::DirectoryReader()
+    : handle_(std::make_unique<Handle>()) {
+}
+
+DirectoryReader::~DirectoryReader() {
+    Close();
+}
+
+void DirectoryReader::Open(const std::filesystem::path& directory) {
+    Close();
+    directory_ = directory;
+#ifdef DIRECTORY_READER_POSIX
+    handle_->dir = opendir(directory_.c_str());
+    if (!handle_->dir) {
+        throw std::runtime_error("Unable to read directory "s + directory_.string());
+    }
+#else
+    handle_->it = std::filesystem::directory_iterator(directory_);
+    handle_->started = false;
+#endif
+}
+
+bool DirectoryReader::Next() {
+#ifdef DIRECTORY_READER_POSIX
+    if (!handle_->dir) {
+        return false;
+    }
+    while (const dirent* entry = readdir(handle_->dir)) {
+        const std::string_view name = entry->d_name;
+        if (name == "."sv || name == ".."sv) {
+            continue;
+        }
+        // The assignment keeps the storage of the path
+        path_ = directory_;
+        path_ /= name;
+        unsigned char d_type = entry->d_type;
+        if (d_type == DT_UNKNOWN || d_type == DT_LNK) {
+            // Some file systems don't report the type, links are followed
+            struct stat st;
+            if (stat(path_.c_str(), &st) != 0) {
+                d_type = DT_UNKNOWN;
+            } else if (S_ISREG(st.st_mode)) {
+                d_type = DT_REG;
+            } else if (S_ISDIR(st.st_mode)) {
+                d_type = DT_DIR;
+            }
+        }
+        type_ = d_type == DT_REG ? REGULAR_FILE : d_type == DT_DIR ? DIRECTORY : OTHER;
+        return true;
+    }
+    Close();
+    return false;
+#else
+    auto& it = handle_->it;
+    if (handle_->started && it != std::filesystem::directory_iterator()) {
+        ++it;
+    }
+    handle_->started = true;
+    if (it == std::filesystem::directory_iterator()) {
+        return false;
+    }
+    path_ = it->path();
+    type_ = it->is_regular_file() ? REGULAR_FILE : it->is_directory() ? DIRECTORY : OTHER;
+    return true;
+#endif
+}
+
+const std::filesystem::path& DirectoryReader::GetPath() const {
+    return path_;
+}
+
+DirectoryReader::EntryType DirectoryReader::GetType() const {
+    return type_;
+}
+
+void DirectoryReader::Close() {
+#ifdef DIRECTORY_READER_POSIX
+    if (handle_->dir) {
+        closedir(handle_->dir);
+        handle_->dir = nullptr;
+    }
+#else
+    handle_->it = std::filesystem::directory_iterator();
+#endif
+}
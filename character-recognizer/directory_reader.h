@@ -0,0 +1,45 @@
+#pragma once
+
+#include <filesystem>
+#include <memory>
+
+// Reader of the entries of a directory that doesn't allocate per entry,
+// unlike std::filesystem::directory_iterator, which builds a path for
+// each of them. The path of the current entry is kept in a path object
+// that is reused, so it allocates only when it gets longer than before.
+// Where the POSIX directory functions are not available it falls back
+// to std::filesystem::directory_iterator
+
+class DirectoryReader {
+public:
+    enum EntryType {
+        REGULAR_FILE,
+        DIRECTORY,
+        OTHER
+    };
+
+    DirectoryReader();
+    ~DirectoryReader();
+
+    DirectoryReader(const DirectoryReader&) = delete;
+    DirectoryReader& operator=(const DirectoryReader&) = delete;
+
+    // Starts reading the directory, the previous one is closed
+    void Open(const std::filesystem::path& directory);
+    // Moves to the next entry ("." and ".." are skipped),
+    // returns false at the end of the directory
+    bool Next();
+
+    // The current entry, valid until the next call of Next or Open
+    const std::filesystem::path& GetPath() const;
+    EntryType GetType() const;
+
+private:
+    struct Handle;
+    std::unique_ptr<Handle> handle_;
+    std::filesystem::path directory_;
+    std::filesystem::path path_;
+    EntryType type_ = OTHER;
+
+    void Close();
+};
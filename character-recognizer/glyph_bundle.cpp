@@ -0,0 +1,307 @@
+#include "glyph_bundle.h"
+#include "batch_file_reader.h"
+#include "bmp_image.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+using namespace std::literals;
+
+namespace {
+
+// All numbers are little-endian.
+// Header:
+//  offset size
+//     0    4  version
+//     4    4  header size (64)
+//     8    4  bytes of a record
+//    12    4  number of labels
+//    16    8  number of records
+//    24    8  offset of the records (a multiple of 64)
+//    32   32  zeros
+// Label table after the header, 24 bytes per label:
+//     0    8  index of the first record
+//     8    8  number of records
+//    16    4  offset of the name in the name table
+//    20    4  length of the name
+// Name table after the label table, then zeros up to the records
+constexpr uint32_t bundle_version = 0x26101624;
+constexpr size_t header_size = 64;
+constexpr size_t label_size = 24;
+constexpr size_t records_alignment = 64;
+
+template <typename T>
+void StoreLe(std::byte* dst, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        dst[i] = static_cast<std::byte>(value >> (8 * i));
+    }
+}
+
+template <typename T>
+T LoadLe(const std::byte* src) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(src[i]) << (8 * i);
+    }
+    return value;
+}
+
+size_t AlignUp(size_t value) {
+    return (value + records_alignment - 1) / records_alignment * records_alignment;
+}
+
+// Entries of the folder of the given type in the order of their names
+std::vector<std::filesystem::path> ListSorted(const std::filesystem::path& folder, bool folders) {
+    std::vector<std::filesystem::path> result;
+    for (const auto& entry : std::filesystem::directory_iterator(folder)) {
+        if (folders ? entry.is_directory() : entry.is_regular_file()) {
+            result.push_back(entry.path());
+        }
+    }
+    std::sort(result.begin(), result.end());
+    return result;
+}
+
+}
+
+GlyphBundle::GlyphBundle(const std::filesystem::path& file)
+: mapping_(std::make_unique<MappedFile>(file)) {
+    const std::byte* data = mapping_->GetData();
+    const size_t file_size = mapping_->GetSize();
+    auto check = [&file](bool condition) {
+        if (!condition) {
+            throw std::runtime_error("The glyph bundle "s + file.string() + " is damaged"s);
+        }
+    };
+
+    check(file_size >= header_size && LoadLe<uint32_t>(data) == bundle_version
+          && LoadLe<uint32_t>(data + 4) == header_size);
+    width_ = LoadLe<uint32_t>(data + 8);
+    const uint64_t label_count = LoadLe<uint32_t>(data + 12);
+    const uint64_t count = LoadLe<uint64_t>(data + 16);
+    const uint64_t records_offset = LoadLe<uint64_t>(data + 24);
+
+    // Every part must lie inside the file
+    const uint64_t names_offset = header_size + label_count * label_size;
+    check(width_ > 0 && names_offset <= records_offset && records_offset <= file_size
+          && records_offset % records_alignment == 0
+          && count <= (file_size - records_offset) / width_);
+    count_ = static_cast<size_t>(count);
+    records_ = reinterpret_cast<const uint8_t*>(data + records_offset);
+
+    const char* names = reinterpret_cast<const char*>(data + names_offset);
+    const uint64_t names_size = records_offset - names_offset;
+    uint64_t next = 0;
+    for (uint64_t i = 0; i < label_count; ++i) {
+        const std::byte* entry = data + header_size + i * label_size;
+        const uint64_t first = LoadLe<uint64_t>(entry);
+        const uint64_t records = LoadLe<uint64_t>(entry + 8);
+        const uint64_t name_offset = LoadLe<uint32_t>(entry + 16);
+        const uint64_t name_length = LoadLe<uint32_t>(entry + 20);
+        check(first == next && records <= count - first && name_length > 0
+              && name_offset + name_length <= names_size);
+        labels_.push_back({{names + name_offset, name_length}, first, records});
+        next = first + records;
+    }
+    check(next == count);
+}
+
+bool GlyphBundle::IsBundle(const std::filesystem::path& file) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(file, error)) {
+        return false;
+    }
+    std::ifstream in(file, std::ios::binary);
+    std::byte version[4];
+    in.read(reinterpret_cast<char*>(version), sizeof(version));
+    return in && LoadLe<uint32_t>(version) == bundle_version;
+}
+
+void GlyphBundle::Write(const std::filesystem::path& file, size_t width,
+                        std::span<const LabelRecords> labels) {
+    std::vector<std::byte> head(header_size + labels.size() * label_size);
+    std::string names;
+    uint64_t count = 0;
+    for (size_t i = 0; i < labels.size(); ++i) {
+        const LabelRecords& label = labels[i];
+        if (label.name.empty() || label.records.size() % width != 0) {
+            throw std::runtime_error("Unexpected records of the label "s + label.name);
+        }
+        std::byte* entry = head.data() + header_size + i * label_size;
+        StoreLe(entry, count);
+        StoreLe(entry + 8, static_cast<uint64_t>(label.records.size() / width));
+        StoreLe(entry + 16, static_cast<uint32_t>(names.size()));
+        StoreLe(entry + 20, static_cast<uint32_t>(label.name.size()));
+        names += label.name;
+        count += label.records.size() / width;
+    }
+    const size_t names_end = head.size() + names.size();
+    names.resize(AlignUp(names_end) - head.size(), '\0');
+    StoreLe(head.data(), bundle_version);
+    StoreLe(head.data() + 4, static_cast<uint32_t>(header_size));
+    StoreLe(head.data() + 8, static_cast<uint32_t>(width));
+    StoreLe(head.data() + 12, static_cast<uint32_t>(labels.size()));
+    StoreLe(head.data() + 16, count);
+    StoreLe(head.data() + 24, static_cast<uint64_t>(AlignUp(names_end)));
+
+    std::filesystem::path temp_file = file;
+    temp_file += ".tmp"s;
+    {
+        std::ofstream out(temp_file, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Unable to open file "s + temp_file.string()
+                                     + " for saving the glyph bundle"s);
+        }
+        out.write(reinterpret_cast<const char*>(head.data()), head.size());
+        out.write(names.data(), names.size());
+        for (const LabelRecords& label : labels) {
+            out.write(reinterpret_cast<const char*>(label.records.data()), label.records.size());
+        }
+        if (!out) {
+            throw std::runtime_error("Unable to write file "s + temp_file.string());
+        }
+    }
+    std::filesystem::rename(temp_file, file);
+}
+
+size_t GlyphBundle::GetWidth() const {
+    return width_;
+}
+
+size_t GlyphBundle::GetCount() const {
+    return count_;
+}
+
+std::span<const GlyphBundle::Label> GlyphBundle::GetLabels() const {
+    return labels_;
+}
+
+const uint8_t* GlyphBundle::GetRecord(size_t index) const {
+    assert(index < count_);
+    return records_ + index * width_;
+}
+
+void PackFolder(const std::filesystem::path& folder, const std::filesystem::path& bundle,
+                const FileNormalizerInterface& normalizer) {
+    PROFILE_SCOPE("pack");
+    if (!std::filesystem::is_directory(folder)) {
+        throw std::runtime_error(folder.string() + " is not a directory"s);
+    }
+    const size_t width = normalizer.GetWidth();
+    std::vector<std::vector<uint8_t>> records;
+    std::vector<GlyphBundle::LabelRecords> labels;
+    BatchFileReader reader;
+    for (const auto& sub : ListSorted(folder, true)) {
+        const std::vector<std::filesystem::path> files = ListSorted(sub, false);
+        if (files.empty()) {
+            continue;
+        }
+        std::vector<uint8_t>& data = records.emplace_back(files.size() * width);
+        size_t added = 0;
+        for (size_t i = 0; i < files.size(); ++i) {
+            while (added < files.size() && reader.GetQueued() < reader.GetCapacity()) {
+                reader.Add(files[added++]);
+            }
+            normalizer.DecodeBytes(reader.Take(), files[i], {data.data() + i * width, width});
+        }
+        labels.push_back({sub.filename().string(), {}});
+    }
+    for (size_t i = 0; i < labels.size(); ++i) {
+        labels[i].records = records[i];
+    }
+    if (labels.empty()) {
+        throw std::runtime_error(folder.string() + " has no images"s);
+    }
+    GlyphBundle::Write(bundle, width, labels);
+}
+
+size_t UnpackBundle(const std::filesystem::path& bundle, const std::filesystem::path& folder) {
+    PROFILE_SCOPE("unpack");
+    using namespace img_lib;
+    const GlyphBundle glyphs(bundle);
+    const int side = static_cast<int>(std::lround(std::sqrt(static_cast<double>(glyphs.GetWidth()))));
+    if (static_cast<size_t>(side) * side != glyphs.GetWidth()) {
+        throw std::runtime_error("The glyphs of "s + bundle.string() + " are not square"s);
+    }
+
+    Image image(side, side, Color::Black());
+    for (const GlyphBundle::Label& label : glyphs.GetLabels()) {
+        const std::filesystem::path sub = folder / std::string(label.name);
+        std::filesystem::create_directories(sub);
+        for (size_t i = 0; i < label.count; ++i) {
+            const uint8_t* record = glyphs.GetRecord(label.first + i);
+            for (int y = 0; y < side; ++y) {
+                for (int x = 0; x < side; ++x) {
+                    const std::byte gray{record[y * side + x]};
+                    image.GetPixel(x, y) = Color{gray, gray, gray, std::byte{255}};
+                }
+            }
+            // Numbers of the same length keep the order of the records in the order of names
+            std::string name = std::to_string(i + 1);
+            name.insert(0, std::to_string(label.count).size() - name.size(), '0');
+            const std::filesystem::path file = sub / (name + ".bmp"s);
+            if (!SaveBMP(file, image)) {
+                throw std::runtime_error("Unable to save file "s + file.string());
+            }
+        }
+    }
+    return glyphs.GetCount();
+}
+
+namespace tests {
+
+void PackAndUnpackBundle() {
+    using namespace img_lib;
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "glyph_bundle_test";
+    fs::remove_all(dir);
+
+    // Two chars and a non-char folder of gray glyphs
+    const std::vector<std::pair<std::string, int>> folders = {{"3", 4}, {"7", 2}, {"not_chars", 3}};
+    Image image(32, 32, Color::Black());
+    for (const auto& [name, count] : folders) {
+        fs::create_directories(dir / "folder" / name);
+        for (int i = 0; i < count; ++i) {
+            for (int y = 0; y < 32; ++y) {
+                for (int x = 0; x < 32; ++x) {
+                    const std::byte gray = static_cast<std::byte>(x * 8 + y + i + name[0]);
+                    image.GetPixel(x, y) = Color{gray, gray, gray, std::byte{255}};
+                }
+            }
+            [[maybe_unused]] bool saved = SaveBMP(dir / "folder" / name / (std::to_string(i) + ".bmp"s), image);
+            assert(saved);
+        }
+    }
+
+    const ImageFileNormalizer normalizer(1024);
+    PackFolder(dir / "folder", dir / "glyphs.bundle", normalizer);
+    assert(GlyphBundle::IsBundle(dir / "glyphs.bundle"));
+    assert(!GlyphBundle::IsBundle(dir / "folder" / "3" / "0.bmp"));
+    const GlyphBundle bundle(dir / "glyphs.bundle");
+    assert(bundle.GetWidth() == 1024 && bundle.GetCount() == 9);
+    assert(bundle.GetLabels().size() == folders.size());
+
+    // The unpacked folder packs into the same records
+    [[maybe_unused]] const size_t unpacked = UnpackBundle(dir / "glyphs.bundle", dir / "unpacked");
+    assert(unpacked == 9);
+    std::vector<uint8_t> sample(1024);
+    for (size_t l = 0; l < folders.size(); ++l) {
+        const GlyphBundle::Label& label = bundle.GetLabels()[l];
+        assert(label.name == folders[l].first && label.count == static_cast<size_t>(folders[l].second));
+        for (size_t i = 0; i < label.count; ++i) {
+            [[maybe_unused]] const uint8_t* record = bundle.GetRecord(label.first + i);
+            normalizer.LoadBytes(dir / "folder" / folders[l].first / (std::to_string(i) + ".bmp"s), sample);
+            assert(std::equal(sample.begin(), sample.end(), record));
+            normalizer.LoadBytes(dir / "unpacked" / folders[l].first / (std::to_string(i + 1) + ".bmp"s), sample);
+            assert(std::equal(sample.begin(), sample.end(), record));
+        }
+    }
+    fs::remove_all(dir);
+}
+
+}
@@ -0,0 +1,71 @@
+#pragma once
+
+#include "mapped_file.h"
+#include "training_database.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+
+// Packed bundle of glyphs: a header, a table of labels and the glyphs
+// as fixed-size records of 8-bit pixels (the byte form of
+// TrainingDatabase). The records of a label are contiguous. A label is
+// the name of a folder of the training layout, so a bundle replaces
+// a folder of images for the train and recognize commands. The bundle
+// is mapped to memory, the records are used in place
+
+class GlyphBundle {
+public:
+    struct Label {
+        std::string_view name;
+        size_t first; // index of the first record
+        size_t count;
+    };
+
+    // Records of a label for writing
+    struct LabelRecords {
+        std::string name;
+        std::span<const uint8_t> records; // [count x width]
+    };
+
+    // Maps the bundle, throws if it is damaged
+    explicit GlyphBundle(const std::filesystem::path& file);
+
+    // True if the file starts as a bundle
+    static bool IsBundle(const std::filesystem::path& file);
+
+    // Writes the bundle through a temporary file
+    static void Write(const std::filesystem::path& file, size_t width,
+                      std::span<const LabelRecords> labels);
+
+    size_t GetWidth() const; // bytes of a record
+    size_t GetCount() const; // number of records
+    std::span<const Label> GetLabels() const;
+    const uint8_t* GetRecord(size_t index) const;
+
+private:
+    std::unique_ptr<MappedFile> mapping_;
+    size_t width_ = 0;
+    size_t count_ = 0;
+    std::vector<Label> labels_;
+    const uint8_t* records_ = nullptr;
+};
+
+// Packs the folder of the training layout: every subfolder is a label,
+// its files are the glyphs. Labels and files go in the order of their names
+void PackFolder(const std::filesystem::path& folder, const std::filesystem::path& bundle,
+                const FileNormalizerInterface& normalizer);
+
+// Restores the folder layout: a subfolder per label with a gray BMP per record.
+// Returns the number of records
+size_t UnpackBundle(const std::filesystem::path& bundle, const std::filesystem::path& folder);
+
+namespace tests {
+
+void PackAndUnpackBundle();
+
+}
@@ -0,0 +1,338 @@
+#include "glyph_loader.h"
+#include "batch_file_reader.h"
+#include "bmp_image.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define GLYPH_LOADER_POSIX
+    #include <fcntl.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define GLYPH_LOADER_X86
+    #include <immintrin.h>
+    #define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace std::literals;
+
+namespace {
+
+constexpr size_t file_header_size = 14;
+constexpr size_t min_info_header_size = 40;
+
+constexpr size_t buffer_padding = GlyphLoader::padding;
+static_assert(buffer_padding <= BatchFileReader::padding);
+
+constexpr float value_scale = 1.0f / 16777216.0f;
+
+uint16_t Read16(const uint8_t* data) {
+    return static_cast<uint16_t>(data[0] | data[1] << 8);
+}
+
+uint32_t Read32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8
+           | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+// Reads the whole file with one call, returns its size
+size_t ReadFile(const std::filesystem::path& file, std::vector<uint8_t>& buffer) {
+#ifdef GLYPH_LOADER_POSIX
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+    }
+    const size_t size = static_cast<size_t>(st.st_size);
+    if (buffer.size() < size + buffer_padding) {
+        buffer.resize(size + buffer_padding);
+    }
+    ssize_t result = read(fd, buffer.data(), size);
+    close(fd);
+    if (result != static_cast<ssize_t>(size)) {
+        throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+    }
+    return size;
+#else
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+    }
+    const size_t size = static_cast<size_t>(in.tellg());
+    if (buffer.size() < size + buffer_padding) {
+        buffer.resize(size + buffer_padding);
+    }
+    in.seekg(0);
+    if (!in.read(reinterpret_cast<char*>(buffer.data()), size)) {
+        throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+    }
+    return size;
+#endif
+}
+
+uint8_t RgbToByte(uint32_t rgb) {
+    // The nearest multiple of 65793 (0x010101), which is exact for gray
+    return static_cast<uint8_t>((rgb + 32896) / 65793);
+}
+
+void ConvertRow24Scalar(const uint8_t* row, size_t width, float* out) {
+    for (size_t x = 0; x < width; ++x) {
+        const uint8_t* p = row + 3 * x; // b, g, r
+        out[x] = static_cast<float>(p[0] | p[1] << 8 | p[2] << 16) * value_scale;
+    }
+}
+
+#ifdef GLYPH_LOADER_X86
+
+// 8 pixels per step: the two 128-bit lanes get 4 pixels each,
+// the shuffle spreads their 3 bytes into 32-bit integers
+TARGET("avx2")
+void ConvertRow24Avx2(const uint8_t* row, size_t width, float* out) {
+    const __m256i spread = _mm256_setr_epi8(
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+        0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+    const __m256 scale = _mm256_set1_ps(value_scale);
+    size_t x = 0;
+    for (; x + 8 <= width; x += 8) {
+        const uint8_t* p = row + 3 * x;
+        __m256i bytes = _mm256_inserti128_si256(
+            _mm256_castsi128_si256(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p))),
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12)), 1);
+        __m256i rgb = _mm256_shuffle_epi8(bytes, spread);
+        _mm256_storeu_ps(out + x, _mm256_mul_ps(_mm256_cvtepi32_ps(rgb), scale));
+    }
+    ConvertRow24Scalar(row + 3 * x, width - x, out + x);
+}
+
+#endif
+
+using ConvertRow = void (*)(const uint8_t* row, size_t width, float* out);
+
+ConvertRow SelectConvertRow24() {
+#ifdef GLYPH_LOADER_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return ConvertRow24Avx2;
+    }
+#endif
+    return ConvertRow24Scalar;
+}
+
+const ConvertRow convert_row_24 = SelectConvertRow24();
+
+}
+
+void GlyphLoader::Parse(std::span<const uint8_t> file_data, const std::filesystem::path& file,
+                        size_t pixel_count, Pixels& pixels) {
+    const size_t size = file_data.size();
+    const uint8_t* data = file_data.data();
+    auto check = [&file](bool condition) {
+        if (!condition) {
+            throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
+        }
+    };
+
+    check(size >= file_header_size + min_info_header_size && data[0] == 'B' && data[1] == 'M');
+    const uint32_t pixels_offset = Read32(data + 10);
+    const uint8_t* info = data + file_header_size;
+    const uint32_t info_size = Read32(info);
+    check(info_size >= min_info_header_size && info_size <= size - file_header_size);
+    const int32_t width = static_cast<int32_t>(Read32(info + 4));
+    const int32_t height = static_cast<int32_t>(Read32(info + 8));
+    const uint16_t planes = Read16(info + 12);
+    pixels.bpp = Read16(info + 14);
+    const uint32_t compression = Read32(info + 16);
+    const uint32_t used_colors = Read32(info + 32);
+
+    // Uncompressed images with 8 or 24 bits per pixel are supported,
+    // rows go from the bottom for a positive height
+    check(planes == 1 && (pixels.bpp == 8 || pixels.bpp == 24) && compression == 0);
+    check(width > 0 && height != 0 && height != INT32_MIN);
+    const size_t side = static_cast<size_t>(width);
+    const size_t rows = static_cast<size_t>(std::abs(height));
+    if (side != rows) {
+        throw std::runtime_error("The sides of the image must be the same"s);
+    }
+    if (side * side != pixel_count) {
+        throw std::runtime_error("Pixel count does not match the input width of the network"s);
+    }
+    pixels.side = side;
+
+    const size_t stride = (side * pixels.bpp / 8 + 3) / 4 * 4;
+    check(pixels_offset <= size && (size - pixels_offset) / stride >= rows);
+    if (height > 0) {
+        pixels.first_row = data + pixels_offset + (rows - 1) * stride;
+        pixels.row_step = -static_cast<ptrdiff_t>(stride);
+    } else {
+        pixels.first_row = data + pixels_offset;
+        pixels.row_step = static_cast<ptrdiff_t>(stride);
+    }
+
+    if (pixels.bpp == 8) {
+        // The palette follows the info header, missing colors are black
+        const size_t colors = used_colors == 0 ? 256 : used_colors;
+        const size_t palette_offset = file_header_size + info_size;
+        check(colors <= 256 && palette_offset + colors * 4 <= size);
+        std::fill(std::begin(pixels.palette), std::end(pixels.palette), 0);
+        for (size_t i = 0; i < colors; ++i) {
+            pixels.palette[i] = Read32(data + palette_offset + i * 4) & 0xFFFFFF;
+        }
+    }
+}
+
+void GlyphLoader::Load(const std::filesystem::path& file, std::span<float> values) {
+    const size_t size = ReadFile(file, buffer_);
+    Decode({buffer_.data(), size}, file, values);
+}
+
+void GlyphLoader::LoadBytes(const std::filesystem::path& file, std::span<uint8_t> bytes) {
+    const size_t size = ReadFile(file, buffer_);
+    DecodeBytes({buffer_.data(), size}, file, bytes);
+}
+
+void GlyphLoader::Decode(std::span<const uint8_t> data, const std::filesystem::path& file,
+                         std::span<float> values) {
+    Pixels pixels;
+    Parse(data, file, values.size(), pixels);
+    const uint8_t* row = pixels.first_row;
+    float* out = values.data();
+    if (pixels.bpp == 24) {
+        for (size_t y = 0; y < pixels.side; ++y, row += pixels.row_step, out += pixels.side) {
+            convert_row_24(row, pixels.side, out);
+        }
+    } else {
+        float table[256];
+        for (size_t i = 0; i < 256; ++i) {
+            table[i] = static_cast<float>(pixels.palette[i]) * value_scale;
+        }
+        for (size_t y = 0; y < pixels.side; ++y, row += pixels.row_step, out += pixels.side) {
+            for (size_t x = 0; x < pixels.side; ++x) {
+                out[x] = table[row[x]];
+            }
+        }
+    }
+}
+
+void GlyphLoader::DecodeBytes(std::span<const uint8_t> data, const std::filesystem::path& file,
+                              std::span<uint8_t> bytes) {
+    Pixels pixels;
+    Parse(data, file, bytes.size(), pixels);
+    const uint8_t* row = pixels.first_row;
+    uint8_t* out = bytes.data();
+    if (pixels.bpp == 24) {
+        for (size_t y = 0; y < pixels.side; ++y, row += pixels.row_step, out += pixels.side) {
+            for (size_t x = 0; x < pixels.side; ++x) {
+                const uint8_t* p = row + 3 * x;
+                out[x] = RgbToByte(p[0] | p[1] << 8 | p[2] << 16);
+            }
+        }
+    } else {
+        uint8_t table[256];
+        for (size_t i = 0; i < 256; ++i) {
+            table[i] = RgbToByte(pixels.palette[i]);
+        }
+        for (size_t y = 0; y < pixels.side; ++y, row += pixels.row_step, out += pixels.side) {
+            for (size_t x = 0; x < pixels.side; ++x) {
+                out[x] = table[row[x]];
+            }
+        }
+    }
+}
+
+namespace tests {
+
+void GlyphLoaderDecodes() {
+    using namespace img_lib;
+    const std::filesystem::path dir = std::filesystem::temp_directory_path();
+    GlyphLoader loader;
+    std::vector<float> values(1024);
+    std::vector<uint8_t> bytes(1024);
+
+    // 24 bits: the values are the normalized colors of img_lib
+    Image image(32, 32, Color::Black());
+    for (int y = 0; y < 32; ++y) {
+        for (int x = 0; x < 32; ++x) {
+            image.GetPixel(x, y) = Color{static_cast<std::byte>(x * 7 + y),
+                                         static_cast<std::byte>(x * y),
+                                         static_cast<std::byte>(255 - x),
+                                         std::byte{255}};
+        }
+    }
+    const std::filesystem::path file_24 = dir / "glyph_loader_test_24.bmp";
+    [[maybe_unused]] bool saved = SaveBMP(file_24, image);
+    assert(saved);
+    loader.Load(file_24, values);
+    for (int y = 0; y < 32; ++y) {
+        for (int x = 0; x < 32; ++x) {
+            const Color color = image.GetPixel(x, y);
+            [[maybe_unused]] uint32_t uval = static_cast<uint32_t>(color.r) << 24
+                            | static_cast<uint32_t>(color.g) << 16
+                            | static_cast<uint32_t>(color.b) << 8;
+            assert(values[y * 32 + x] == static_cast<float>(uval) / static_cast<float>(UINT32_MAX));
+        }
+    }
+    std::filesystem::remove(file_24);
+
+    // 8 bits with a gray palette: the bytes are the gray levels
+    std::vector<uint8_t> bmp(14 + 40 + 256 * 4 + 32 * 32, 0);
+    auto write32 = [&bmp](size_t offset, uint32_t value) {
+        for (size_t i = 0; i < 4; ++i) {
+            bmp[offset + i] = static_cast<uint8_t>(value >> (8 * i));
+        }
+    };
+    bmp[0] = 'B';
+    bmp[1] = 'M';
+    write32(2, static_cast<uint32_t>(bmp.size()));
+    write32(10, 14 + 40 + 256 * 4);
+    write32(14, 40);
+    write32(18, 32);
+    write32(22, 32);
+    write32(26, 1 | 8 << 16); // planes, bits per pixel
+    for (uint32_t i = 0; i < 256; ++i) {
+        write32(54 + i * 4, i * 0x010101);
+    }
+    for (size_t row = 0; row < 32; ++row) { // from the bottom
+        for (size_t x = 0; x < 32; ++x) {
+            bmp[54 + 256 * 4 + row * 32 + x] = static_cast<uint8_t>(x + 8 * (31 - row));
+        }
+    }
+    const std::filesystem::path file_8 = dir / "glyph_loader_test_8.bmp";
+    {
+        std::ofstream out(file_8, std::ios::binary);
+        out.write(reinterpret_cast<const char*>(bmp.data()), bmp.size());
+    }
+    loader.Load(file_8, values);
+    loader.LoadBytes(file_8, bytes);
+    for (size_t y = 0; y < 32; ++y) {
+        for (size_t x = 0; x < 32; ++x) {
+            [[maybe_unused]] const uint8_t gray = static_cast<uint8_t>(x + 8 * y);
+            assert(bytes[y * 32 + x] == gray);
+            assert(values[y * 32 + x] == static_cast<float>(gray * 0x010101) * value_scale);
+        }
+    }
+
+    // Wrong sizes are reported
+    [[maybe_unused]] bool detected = false;
+    try {
+        loader.Load(file_8, std::span<float>(values.data(), 256));
+    } catch (const std::runtime_error&) {
+        detected = true;
+    }
+    assert(detected);
+    std::filesystem::remove(file_8);
+}
+
+}
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <cstdint>
+#include <filesystem>
+#include <span>
+#include <vector>
+
+// Decoder of square uncompressed BMP images (8-bit palette or 24 bits
+// per pixel) straight into network inputs, without building an image.
+// The file is read with one call into the buffer of the loader, which
+// is reused for the next files, so a loader must not be shared between
+// threads. The input value of a pixel is (r << 16 | g << 8 | b) / 2^24,
+// the byte of a pixel is the nearest multiple of 65793 / 2^24 (the gray
+// level for gray pixels)
+
+class GlyphLoader {
+public:
+    // The image must have values.size() pixels, rows go from the top
+    void Load(const std::filesystem::path& file, std::span<float> values);
+    void LoadBytes(const std::filesystem::path& file, std::span<uint8_t> bytes);
+    // Decode the contents of a file read by the caller (e.g. with
+    // BatchFileReader), padding readable bytes must follow the data.
+    // The path is only for the errors
+    void Decode(std::span<const uint8_t> data, const std::filesystem::path& file,
+                std::span<float> values);
+    void DecodeBytes(std::span<const uint8_t> data, const std::filesystem::path& file,
+                     std::span<uint8_t> bytes);
+
+    // The SIMD row conversion may read a few bytes past the pixel data
+    static constexpr size_t padding = 32;
+
+private:
+    std::vector<uint8_t> buffer_;
+
+    // Validated pixel data in the buffer
+    struct Pixels {
+        const uint8_t* first_row; // top row
+        ptrdiff_t row_step;
+        size_t side;
+        uint16_t bpp;
+        uint32_t palette[256]; // 0x00RRGGBB, for 8 bits per pixel
+    };
+
+    static void Parse(std::span<const uint8_t> data, const std::filesystem::path& file,
+                      size_t pixel_count, Pixels& pixels);
+};
+
+namespace tests {
+
+void GlyphLoaderDecodes();
+
+}
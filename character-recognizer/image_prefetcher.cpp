@@ -0,0 +1,167 @@
+#include "image_prefetcher.h"
+#include "profiler.h"
+
+#include <algorithm>
+#include <cassert>
+#include <utility>
+
+ImagePrefetcher::ImagePrefetcher(const FileNormalizerInterface& normalizer,
+                                 const std::filesystem::path& folder, size_t depth, size_t readers)
+: normalizer_(normalizer)
+, folder_(folder)
+, slots_(depth) {
+    assert(depth > 0 && readers > 0);
+    for (auto& slot : slots_) {
+        slot.values.resize(normalizer_.GetWidth());
+    }
+    const profiler::Context context = profiler::Context::Current();
+    traversal_ = std::thread([this, context]() {
+        const profiler::ContextScope context_scope(context);
+        Traverse();
+    });
+    for (size_t i = 0; i < readers; ++i) {
+        readers_.emplace_back([this, context]() {
+            const profiler::ContextScope context_scope(context);
+            Read();
+        });
+    }
+}
+
+ImagePrefetcher::~ImagePrefetcher() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    slot_freed_.notify_all();
+    image_queued_.notify_all();
+    entry_ready_.notify_all();
+    traversal_.join();
+    for (auto& reader : readers_) {
+        reader.join();
+    }
+}
+
+void ImagePrefetcher::Pop(Entry& entry, std::span<float> input) {
+    std::unique_lock lock(mutex_);
+    entry_ready_.wait(lock, [this]() {
+        return popped_ < pushed_ && slots_[popped_ % slots_.size()].state == READY;
+    });
+    Slot& slot = slots_[popped_ % slots_.size()];
+    entry.kind = slot.entry.kind;
+    if (slot.entry.kind == END) {
+        // The last slot stays, the next calls return it again
+        return;
+    }
+    // The assignment keeps the storage of the path
+    entry.path = slot.entry.path;
+    entry.error = std::exchange(slot.entry.error, nullptr);
+    if (entry.kind == IMAGE && !entry.error) {
+        assert(input.size() == slot.values.size());
+        std::copy(slot.values.begin(), slot.values.end(), input.begin());
+    }
+    slot.state = FREE;
+    ++popped_;
+    lock.unlock();
+    slot_freed_.notify_one();
+}
+
+bool ImagePrefetcher::IsNextReady() {
+    std::lock_guard lock(mutex_);
+    return popped_ < pushed_ && slots_[popped_ % slots_.size()].state == READY;
+}
+
+void ImagePrefetcher::Traverse() {
+    if (TraverseFolder(folder_, 0)) {
+        Push(END, {}, nullptr);
+    }
+}
+
+bool ImagePrefetcher::TraverseFolder(const std::filesystem::path& folder, size_t depth) {
+    if (!Push(FOLDER, folder, nullptr)) {
+        return false;
+    }
+    try {
+        if (folder_readers_.size() <= depth) {
+            folder_readers_.push_back(std::make_unique<DirectoryReader>());
+        }
+        DirectoryReader& reader = *folder_readers_[depth];
+        reader.Open(folder);
+        while (reader.Next()) {
+            if (reader.GetType() == DirectoryReader::DIRECTORY) {
+                if (!TraverseFolder(reader.GetPath(), depth + 1)) {
+                    return false;
+                }
+            } else if (reader.GetType() == DirectoryReader::REGULAR_FILE) {
+                if (!Push(IMAGE, reader.GetPath(), nullptr)) {
+                    return false;
+                }
+            }
+        }
+    } catch (...) {
+        Push(ERROR, {}, std::current_exception());
+        return false;
+    }
+    return true;
+}
+
+bool ImagePrefetcher::Push(EntryKind kind, const std::filesystem::path& path,
+                           std::exception_ptr error) {
+    std::unique_lock lock(mutex_);
+    {
+        PROFILE_SCOPE("prefetch backpressure");
+        slot_freed_.wait(lock, [this]() {
+            return pushed_ - popped_ < slots_.size() || stop_;
+        });
+    }
+    if (stop_) {
+        return false;
+    }
+    Slot& slot = slots_[pushed_ % slots_.size()];
+    slot.entry.kind = kind;
+    slot.entry.path = path;
+    slot.entry.error = std::move(error);
+    slot.state = kind == IMAGE ? QUEUED : READY;
+    ++pushed_;
+    lock.unlock();
+    if (kind == IMAGE) {
+        image_queued_.notify_one();
+    } else {
+        entry_ready_.notify_one();
+    }
+    return true;
+}
+
+void ImagePrefetcher::Read() {
+    std::unique_lock lock(mutex_);
+    while (true) {
+        image_queued_.wait(lock, [this]() {
+            return FindQueued() || stop_;
+        });
+        if (stop_) {
+            return;
+        }
+        // Nobody else touches the slot until it is ready
+        Slot& slot = slots_[claimed_++ % slots_.size()];
+        slot.state = DECODING;
+        lock.unlock();
+        std::exception_ptr error;
+        try {
+            PROFILE_SCOPE("decode");
+            normalizer_.Load(slot.entry.path, slot.values);
+        } catch (...) {
+            error = std::current_exception();
+        }
+        lock.lock();
+        slot.entry.error = std::move(error);
+        slot.state = READY;
+        entry_ready_.notify_one();
+    }
+}
+
+bool ImagePrefetcher::FindQueued() {
+    // Entries other than images are ready when they are pushed
+    while (claimed_ < pushed_ && slots_[claimed_ % slots_.size()].state != QUEUED) {
+        ++claimed_;
+    }
+    return claimed_ < pushed_;
+}
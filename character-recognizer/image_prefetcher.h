@@ -0,0 +1,97 @@
+#pragma once
+
+#include "directory_reader.h"
+#include "training_database.h"
+
+#include <condition_variable>
+#include <cstddef>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <thread>
+#include <vector>
+
+// Producer/consumer pipeline that reads the images of a folder ahead of
+// the recognition. A traversal thread walks the folder and its subfolders
+// (as the serial recognition does) and puts the entries into a bounded
+// ring in the report order. Reader threads open, read and decode the
+// images of the ring while the consumer recognizes the preceding ones,
+// which hides the latency of slow storage. When the ring is full the
+// traversal waits for the consumer (backpressure), so at most depth
+// images are held. The slots keep their buffers, the steady state
+// doesn't allocate
+
+class ImagePrefetcher {
+public:
+    enum EntryKind {
+        FOLDER, // a folder is entered, its entries follow
+        IMAGE,
+        ERROR, // the traversal failed and stopped
+        END // the whole folder is traversed
+    };
+
+    struct Entry {
+        EntryKind kind = END;
+        std::filesystem::path path; // of a folder or an image
+        std::exception_ptr error; // of the traversal or of decoding the image
+    };
+
+    // Starts the threads. The normalizer must be thread-safe
+    ImagePrefetcher(const FileNormalizerInterface& normalizer,
+                    const std::filesystem::path& folder, size_t depth, size_t readers);
+    // Stops the threads, the entries not taken are dropped
+    ~ImagePrefetcher();
+
+    ImagePrefetcher(const ImagePrefetcher&) = delete;
+    ImagePrefetcher& operator=(const ImagePrefetcher&) = delete;
+
+    // Waits for the next entry. The values of a decoded image are copied
+    // to the input, its size is the width of the normalizer.
+    // After END it returns END again
+    void Pop(Entry& entry, std::span<float> input);
+    // True if Pop returns without waiting
+    bool IsNextReady();
+
+private:
+    enum SlotState {
+        FREE,
+        QUEUED, // an image waits for a reader
+        DECODING,
+        READY
+    };
+
+    struct Slot {
+        SlotState state = FREE;
+        Entry entry;
+        std::vector<float> values;
+    };
+
+    const FileNormalizerInterface& normalizer_;
+    std::filesystem::path folder_;
+    std::vector<Slot> slots_;
+    // Counters of entries, the slot of an entry is the counter modulo depth
+    size_t popped_ = 0;
+    size_t pushed_ = 0;
+    size_t claimed_ = 0; // entries up to it are taken by readers or aren't images
+
+    std::mutex mutex_;
+    std::condition_variable slot_freed_;
+    std::condition_variable image_queued_;
+    std::condition_variable entry_ready_;
+    bool stop_ = false;
+
+    std::vector<std::unique_ptr<DirectoryReader>> folder_readers_; // one per depth of folders
+    std::thread traversal_;
+    std::vector<std::thread> readers_;
+
+    void Traverse();
+    // Returns false if the traversal must stop
+    bool TraverseFolder(const std::filesystem::path& folder, size_t depth);
+    // Waits for a free slot, returns false if the prefetcher stops
+    bool Push(EntryKind kind, const std::filesystem::path& path, std::exception_ptr error);
+    void Read();
+    // Moves claimed_ to the next queued image, the mutex must be locked
+    bool FindQueued();
+};
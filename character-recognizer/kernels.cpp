@@ -0,0 +1,919 @@
+#include "kernels.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <stdexcept>
+#include <vector>
+
+#if (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+    #define KERNELS_X86
+    #include <immintrin.h>
+    #define TARGET(isa) __attribute__((target(isa)))
+#endif
+
+using namespace std::literals;
+
+namespace kernels {
+
+namespace {
+
+float DotScalar(const float* a, const float* b, size_t n) {
+    float sum = 0.0f;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void AxpyScalar(float alpha, const float* x, float* y, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
+
+void Dot4Scalar(const float* a, const float* b, size_t ldb, float* out, size_t n) {
+    for (size_t r = 0; r < 4; ++r) {
+        out[r] = DotScalar(a, b + r * ldb, n);
+    }
+}
+
+void Axpy4Scalar(const float* alpha, const float* x, size_t ldx, float* y, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        y[i] += alpha[0] * x[i] + alpha[1] * x[ldx + i]
+                + alpha[2] * x[2 * ldx + i] + alpha[3] * x[3 * ldx + i];
+    }
+}
+
+// Sigmoid approximations. The polynomial computes exp(-x) as 2^n * e^r,
+// where n = round(-x / ln 2) and |r| <= ln 2 / 2, e^r is the polynomial
+// of Cephes expf (relative error about 1e-7). The argument is clamped
+// so that 2^n stays a normal float
+constexpr float exp_max_argument = 87.0f;
+constexpr float log2e = 1.44269504088896341f;
+constexpr float ln2_high = 0.693359375f; // ln 2 in two parts, n * ln2_high is exact
+constexpr float ln2_low = -2.12194440e-4f;
+constexpr float exp_p0 = 1.9875691500e-4f;
+constexpr float exp_p1 = 1.3981999507e-3f;
+constexpr float exp_p2 = 8.3334519073e-3f;
+constexpr float exp_p3 = 4.1665795894e-2f;
+constexpr float exp_p4 = 1.6666665459e-1f;
+constexpr float exp_p5 = 5.0000001201e-1f;
+
+float SigmoidPolynomial(float x) {
+    const float t = std::clamp(-x, -exp_max_argument, exp_max_argument);
+    const float n = std::nearbyint(t * log2e);
+    const float r = (t - n * ln2_high) - n * ln2_low;
+    float p = exp_p0;
+    p = p * r + exp_p1;
+    p = p * r + exp_p2;
+    p = p * r + exp_p3;
+    p = p * r + exp_p4;
+    p = p * r + exp_p5;
+    const float e = (p * r * r + r + 1.0f)
+        * std::bit_cast<float>((static_cast<int32_t>(n) + 127) << 23);
+    return 1.0f / (1.0f + e);
+}
+
+void SigmoidPolynomialScalar(const float* bias, float* x, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = SigmoidPolynomial(x[i] + bias[i]);
+    }
+}
+
+// The table covers [-16, 16], outside it the sigmoid differs
+// from 0 or 1 less than the interpolation error
+constexpr float sigmoid_table_range = 16.0f;
+constexpr float sigmoid_table_steps_per_unit = 64.0f;
+constexpr size_t sigmoid_table_size =
+    static_cast<size_t>(2 * sigmoid_table_range * sigmoid_table_steps_per_unit) + 1;
+
+const std::vector<float>& SigmoidTable() {
+    static const std::vector<float> table = []() {
+        std::vector<float> values(sigmoid_table_size + 1);
+        for (size_t i = 0; i < values.size(); ++i) {
+            double x = static_cast<double>(i) / sigmoid_table_steps_per_unit - sigmoid_table_range;
+            values[i] = static_cast<float>(1.0 / (1.0 + std::exp(-x)));
+        }
+        return values;
+    }();
+    return table;
+}
+
+void SigmoidTableScalar(const float* bias, float* x, size_t n) {
+    // The last entry repeats the end of the range for the interpolation
+    const float* table = SigmoidTable().data();
+    constexpr float last = static_cast<float>(sigmoid_table_size - 1);
+    for (size_t i = 0; i < n; ++i) {
+        float position = (x[i] + bias[i] + sigmoid_table_range) * sigmoid_table_steps_per_unit;
+        position = std::clamp(position, 0.0f, last);
+        const size_t index = static_cast<size_t>(position);
+        const float fraction = position - index;
+        x[i] = table[index] + fraction * (table[index + 1] - table[index]);
+    }
+}
+
+void SigmoidExact(const float* bias, float* x, size_t n) {
+    for (size_t i = 0; i < n; ++i) {
+        x[i] = 1.0f / (1.0f + std::exp(-(x[i] + bias[i])));
+    }
+}
+
+// Integer kernels, see the selection below
+
+int32_t DotU8S8Scalar(const uint8_t* a, const int8_t* b, size_t n) {
+    int32_t sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+void Dot4U8S8Scalar(const uint8_t* a, const int8_t* b, size_t ldb, int32_t* out, size_t n) {
+    for (size_t r = 0; r < 4; ++r) {
+        out[r] = DotU8S8Scalar(a, b + r * ldb, n);
+    }
+}
+
+#ifdef KERNELS_X86
+
+TARGET("sse4.2")
+float DotSse42(const float* a, const float* b, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    }
+    __m128 acc = _mm_add_ps(acc0, acc1);
+    acc = _mm_hadd_ps(acc, acc);
+    acc = _mm_hadd_ps(acc, acc);
+    float sum = _mm_cvtss_f32(acc);
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+TARGET("sse4.2")
+void AxpySse42(float alpha, const float* x, float* y, size_t n) {
+    const __m128 va = _mm_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vy = _mm_add_ps(_mm_loadu_ps(y + i), _mm_mul_ps(va, _mm_loadu_ps(x + i)));
+        _mm_storeu_ps(y + i, vy);
+    }
+    for (; i < n; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
+
+TARGET("sse4.2")
+void Dot4Sse42(const float* a, const float* b, size_t ldb, float* out, size_t n) {
+    __m128 acc0 = _mm_setzero_ps();
+    __m128 acc1 = _mm_setzero_ps();
+    __m128 acc2 = _mm_setzero_ps();
+    __m128 acc3 = _mm_setzero_ps();
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 va = _mm_loadu_ps(a + i);
+        acc0 = _mm_add_ps(acc0, _mm_mul_ps(va, _mm_loadu_ps(b + i)));
+        acc1 = _mm_add_ps(acc1, _mm_mul_ps(va, _mm_loadu_ps(b + ldb + i)));
+        acc2 = _mm_add_ps(acc2, _mm_mul_ps(va, _mm_loadu_ps(b + 2 * ldb + i)));
+        acc3 = _mm_add_ps(acc3, _mm_mul_ps(va, _mm_loadu_ps(b + 3 * ldb + i)));
+    }
+    // Horizontal sums of the four accumulators in one register
+    __m128 sums = _mm_hadd_ps(_mm_hadd_ps(acc0, acc1), _mm_hadd_ps(acc2, acc3));
+    _mm_storeu_ps(out, sums);
+    for (; i < n; ++i) {
+        for (size_t r = 0; r < 4; ++r) {
+            out[r] += a[i] * b[r * ldb + i];
+        }
+    }
+}
+
+TARGET("sse4.2")
+void Axpy4Sse42(const float* alpha, const float* x, size_t ldx, float* y, size_t n) {
+    const __m128 a0 = _mm_set1_ps(alpha[0]);
+    const __m128 a1 = _mm_set1_ps(alpha[1]);
+    const __m128 a2 = _mm_set1_ps(alpha[2]);
+    const __m128 a3 = _mm_set1_ps(alpha[3]);
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 vy = _mm_loadu_ps(y + i);
+        vy = _mm_add_ps(vy, _mm_mul_ps(a0, _mm_loadu_ps(x + i)));
+        vy = _mm_add_ps(vy, _mm_mul_ps(a1, _mm_loadu_ps(x + ldx + i)));
+        vy = _mm_add_ps(vy, _mm_mul_ps(a2, _mm_loadu_ps(x + 2 * ldx + i)));
+        vy = _mm_add_ps(vy, _mm_mul_ps(a3, _mm_loadu_ps(x + 3 * ldx + i)));
+        _mm_storeu_ps(y + i, vy);
+    }
+    for (; i < n; ++i) {
+        y[i] += alpha[0] * x[i] + alpha[1] * x[ldx + i]
+                + alpha[2] * x[2 * ldx + i] + alpha[3] * x[3 * ldx + i];
+    }
+}
+
+TARGET("avx2,fma")
+float DotAvx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    }
+    __m256 acc = _mm256_add_ps(acc0, acc1);
+    __m128 half = _mm_add_ps(_mm256_castps256_ps128(acc), _mm256_extractf128_ps(acc, 1));
+    half = _mm_hadd_ps(half, half);
+    half = _mm_hadd_ps(half, half);
+    float sum = _mm_cvtss_f32(half);
+    for (; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+TARGET("avx2,fma")
+void AxpyAvx2(float alpha, const float* x, float* y, size_t n) {
+    const __m256 va = _mm256_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        _mm256_storeu_ps(y + i, _mm256_fmadd_ps(va, _mm256_loadu_ps(x + i), _mm256_loadu_ps(y + i)));
+    }
+    for (; i < n; ++i) {
+        y[i] += alpha * x[i];
+    }
+}
+
+TARGET("avx2,fma")
+void Dot4Avx2(const float* a, const float* b, size_t ldb, float* out, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps();
+    __m256 acc1 = _mm256_setzero_ps();
+    __m256 acc2 = _mm256_setzero_ps();
+    __m256 acc3 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 va = _mm256_loadu_ps(a + i);
+        acc0 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + ldb + i), acc1);
+        acc2 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + 2 * ldb + i), acc2);
+        acc3 = _mm256_fmadd_ps(va, _mm256_loadu_ps(b + 3 * ldb + i), acc3);
+    }
+    __m256 sums8 = _mm256_hadd_ps(_mm256_hadd_ps(acc0, acc1), _mm256_hadd_ps(acc2, acc3));
+    __m128 sums = _mm_add_ps(_mm256_castps256_ps128(sums8), _mm256_extractf128_ps(sums8, 1));
+    _mm_storeu_ps(out, sums);
+    for (; i < n; ++i) {
+        for (size_t r = 0; r < 4; ++r) {
+            out[r] += a[i] * b[r * ldb + i];
+        }
+    }
+}
+
+TARGET("avx2,fma")
+void Axpy4Avx2(const float* alpha, const float* x, size_t ldx, float* y, size_t n) {
+    const __m256 a0 = _mm256_set1_ps(alpha[0]);
+    const __m256 a1 = _mm256_set1_ps(alpha[1]);
+    const __m256 a2 = _mm256_set1_ps(alpha[2]);
+    const __m256 a3 = _mm256_set1_ps(alpha[3]);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 vy = _mm256_loadu_ps(y + i);
+        vy = _mm256_fmadd_ps(a0, _mm256_loadu_ps(x + i), vy);
+        vy = _mm256_fmadd_ps(a1, _mm256_loadu_ps(x + ldx + i), vy);
+        vy = _mm256_fmadd_ps(a2, _mm256_loadu_ps(x + 2 * ldx + i), vy);
+        vy = _mm256_fmadd_ps(a3, _mm256_loadu_ps(x + 3 * ldx + i), vy);
+        _mm256_storeu_ps(y + i, vy);
+    }
+    for (; i < n; ++i) {
+        y[i] += alpha[0] * x[i] + alpha[1] * x[ldx + i]
+                + alpha[2] * x[2 * ldx + i] + alpha[3] * x[3 * ldx + i];
+    }
+}
+
+TARGET("avx512f")
+float DotAvx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    // Masked loads handle the tail without a scalar loop
+    for (; i < n; i += 16) {
+        const size_t rest = n - i < 16 ? n - i : 16;
+        const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, a + i),
+                               _mm512_maskz_loadu_ps(mask, b + i), acc0);
+    }
+    return _mm512_reduce_add_ps(_mm512_add_ps(acc0, acc1));
+}
+
+TARGET("avx512f")
+void AxpyAvx512(float alpha, const float* x, float* y, size_t n) {
+    const __m512 va = _mm512_set1_ps(alpha);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        _mm512_storeu_ps(y + i, _mm512_fmadd_ps(va, _mm512_loadu_ps(x + i), _mm512_loadu_ps(y + i)));
+    }
+    if (i < n) {
+        const __mmask16 mask = static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + i),
+                                    _mm512_maskz_loadu_ps(mask, y + i));
+        _mm512_mask_storeu_ps(y + i, mask, vy);
+    }
+}
+
+TARGET("avx512f")
+void Dot4Avx512(const float* a, const float* b, size_t ldb, float* out, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps();
+    __m512 acc1 = _mm512_setzero_ps();
+    __m512 acc2 = _mm512_setzero_ps();
+    __m512 acc3 = _mm512_setzero_ps();
+    for (size_t i = 0; i < n; i += 16) {
+        const size_t rest = n - i < 16 ? n - i : 16;
+        const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+        __m512 va = _mm512_maskz_loadu_ps(mask, a + i);
+        acc0 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, b + i), acc0);
+        acc1 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, b + ldb + i), acc1);
+        acc2 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, b + 2 * ldb + i), acc2);
+        acc3 = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, b + 3 * ldb + i), acc3);
+    }
+    out[0] = _mm512_reduce_add_ps(acc0);
+    out[1] = _mm512_reduce_add_ps(acc1);
+    out[2] = _mm512_reduce_add_ps(acc2);
+    out[3] = _mm512_reduce_add_ps(acc3);
+}
+
+TARGET("avx512f")
+void Axpy4Avx512(const float* alpha, const float* x, size_t ldx, float* y, size_t n) {
+    const __m512 a0 = _mm512_set1_ps(alpha[0]);
+    const __m512 a1 = _mm512_set1_ps(alpha[1]);
+    const __m512 a2 = _mm512_set1_ps(alpha[2]);
+    const __m512 a3 = _mm512_set1_ps(alpha[3]);
+    for (size_t i = 0; i < n; i += 16) {
+        const size_t rest = n - i < 16 ? n - i : 16;
+        const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+        __m512 vy = _mm512_maskz_loadu_ps(mask, y + i);
+        vy = _mm512_fmadd_ps(a0, _mm512_maskz_loadu_ps(mask, x + i), vy);
+        vy = _mm512_fmadd_ps(a1, _mm512_maskz_loadu_ps(mask, x + ldx + i), vy);
+        vy = _mm512_fmadd_ps(a2, _mm512_maskz_loadu_ps(mask, x + 2 * ldx + i), vy);
+        vy = _mm512_fmadd_ps(a3, _mm512_maskz_loadu_ps(mask, x + 3 * ldx + i), vy);
+        _mm512_mask_storeu_ps(y + i, mask, vy);
+    }
+}
+
+// Vectorized SigmoidPolynomial, the same steps in every lane
+
+TARGET("sse4.2")
+__m128 SigmoidPolynomialSse42(__m128 x) {
+    const __m128 t = _mm_min_ps(_mm_max_ps(_mm_sub_ps(_mm_setzero_ps(), x),
+                                           _mm_set1_ps(-exp_max_argument)),
+                                _mm_set1_ps(exp_max_argument));
+    const __m128 n = _mm_round_ps(_mm_mul_ps(t, _mm_set1_ps(log2e)),
+                                  _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m128 r = _mm_sub_ps(t, _mm_mul_ps(n, _mm_set1_ps(ln2_high)));
+    r = _mm_sub_ps(r, _mm_mul_ps(n, _mm_set1_ps(ln2_low)));
+    __m128 p = _mm_set1_ps(exp_p0);
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p1));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p2));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p3));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p4));
+    p = _mm_add_ps(_mm_mul_ps(p, r), _mm_set1_ps(exp_p5));
+    p = _mm_add_ps(_mm_add_ps(_mm_mul_ps(_mm_mul_ps(p, r), r), r), _mm_set1_ps(1.0f));
+    const __m128i exponent = _mm_slli_epi32(_mm_add_epi32(_mm_cvtps_epi32(n), _mm_set1_epi32(127)), 23);
+    const __m128 e = _mm_mul_ps(p, _mm_castsi128_ps(exponent));
+    return _mm_div_ps(_mm_set1_ps(1.0f), _mm_add_ps(_mm_set1_ps(1.0f), e));
+}
+
+TARGET("sse4.2")
+void SigmoidPolynomialSse42(const float* bias, float* x, size_t n) {
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128 v = _mm_add_ps(_mm_loadu_ps(x + i), _mm_loadu_ps(bias + i));
+        _mm_storeu_ps(x + i, SigmoidPolynomialSse42(v));
+    }
+    for (; i < n; ++i) {
+        x[i] = SigmoidPolynomial(x[i] + bias[i]);
+    }
+}
+
+TARGET("avx2,fma")
+__m256 SigmoidPolynomialAvx2(__m256 x) {
+    const __m256 t = _mm256_min_ps(_mm256_max_ps(_mm256_sub_ps(_mm256_setzero_ps(), x),
+                                                 _mm256_set1_ps(-exp_max_argument)),
+                                   _mm256_set1_ps(exp_max_argument));
+    const __m256 n = _mm256_round_ps(_mm256_mul_ps(t, _mm256_set1_ps(log2e)),
+                                     _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+    __m256 r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_high), t);
+    r = _mm256_fnmadd_ps(n, _mm256_set1_ps(ln2_low), r);
+    __m256 p = _mm256_set1_ps(exp_p0);
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p1));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p2));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p3));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p4));
+    p = _mm256_fmadd_ps(p, r, _mm256_set1_ps(exp_p5));
+    p = _mm256_fmadd_ps(_mm256_mul_ps(p, r), r, _mm256_add_ps(r, _mm256_set1_ps(1.0f)));
+    const __m256i exponent = _mm256_slli_epi32(
+        _mm256_add_epi32(_mm256_cvtps_epi32(n), _mm256_set1_epi32(127)), 23);
+    const __m256 e = _mm256_mul_ps(p, _mm256_castsi256_ps(exponent));
+    return _mm256_div_ps(_mm256_set1_ps(1.0f), _mm256_add_ps(_mm256_set1_ps(1.0f), e));
+}
+
+TARGET("avx2,fma")
+void SigmoidPolynomialAvx2(const float* bias, float* x, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256 v = _mm256_add_ps(_mm256_loadu_ps(x + i), _mm256_loadu_ps(bias + i));
+        _mm256_storeu_ps(x + i, SigmoidPolynomialAvx2(v));
+    }
+    for (; i < n; ++i) {
+        x[i] = SigmoidPolynomial(x[i] + bias[i]);
+    }
+}
+
+TARGET("avx512f")
+void SigmoidPolynomialAvx512(const float* bias, float* x, size_t n) {
+    for (size_t i = 0; i < n; i += 16) {
+        const size_t rest = n - i < 16 ? n - i : 16;
+        const __mmask16 mask = static_cast<__mmask16>((1u << rest) - 1);
+        __m512 v = _mm512_add_ps(_mm512_maskz_loadu_ps(mask, x + i),
+                                 _mm512_maskz_loadu_ps(mask, bias + i));
+        const __m512 t = _mm512_min_ps(_mm512_max_ps(_mm512_sub_ps(_mm512_setzero_ps(), v),
+                                                     _mm512_set1_ps(-exp_max_argument)),
+                                       _mm512_set1_ps(exp_max_argument));
+        const __m512 m = _mm512_roundscale_ps(_mm512_mul_ps(t, _mm512_set1_ps(log2e)),
+                                              _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        __m512 r = _mm512_fnmadd_ps(m, _mm512_set1_ps(ln2_high), t);
+        r = _mm512_fnmadd_ps(m, _mm512_set1_ps(ln2_low), r);
+        __m512 p = _mm512_set1_ps(exp_p0);
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p1));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p2));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p3));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p4));
+        p = _mm512_fmadd_ps(p, r, _mm512_set1_ps(exp_p5));
+        p = _mm512_fmadd_ps(_mm512_mul_ps(p, r), r, _mm512_add_ps(r, _mm512_set1_ps(1.0f)));
+        // p * 2^m without building the exponent bits
+        const __m512 e = _mm512_scalef_ps(p, m);
+        v = _mm512_div_ps(_mm512_set1_ps(1.0f), _mm512_add_ps(_mm512_set1_ps(1.0f), e));
+        _mm512_mask_storeu_ps(x + i, mask, v);
+    }
+}
+
+// Integer kernels
+
+TARGET("ssse3")
+int32_t DotU8S8Ssse3(const uint8_t* a, const int8_t* b, size_t n) {
+    const __m128i ones = _mm_set1_epi16(1);
+    __m128i acc = _mm_setzero_si128();
+    for (size_t i = 0; i < n; i += 16) {
+        __m128i va = _mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i));
+        __m128i vb = _mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i));
+        // u8 * s8 pairs summed to s16, then pairs of s16 summed to s32
+        acc = _mm_add_epi32(acc, _mm_madd_epi16(_mm_maddubs_epi16(va, vb), ones));
+    }
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(1, 0, 3, 2)));
+    acc = _mm_add_epi32(acc, _mm_shuffle_epi32(acc, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(acc);
+}
+
+TARGET("ssse3")
+void Dot4U8S8Ssse3(const uint8_t* a, const int8_t* b, size_t ldb, int32_t* out, size_t n) {
+    for (size_t r = 0; r < 4; ++r) {
+        out[r] = DotU8S8Ssse3(a, b + r * ldb, n);
+    }
+}
+
+TARGET("avx2")
+int32_t HorizontalSumAvx2(__m256i v) {
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return _mm_cvtsi128_si32(sum);
+}
+
+// Sums of 4 neighbouring u8 * s8 products in s32 lanes
+TARGET("avx2")
+__m256i MaddU8S8Avx2(__m256i va, const int8_t* b, __m256i ones) {
+    __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b));
+    return _mm256_madd_epi16(_mm256_maddubs_epi16(va, vb), ones);
+}
+
+TARGET("avx2")
+int32_t DotU8S8Avx2(const uint8_t* a, const int8_t* b, size_t n) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        acc = _mm256_add_epi32(acc, MaddU8S8Avx2(va, b + i, ones));
+    }
+    return HorizontalSumAvx2(acc);
+}
+
+TARGET("avx2")
+void Dot4U8S8Avx2(const uint8_t* a, const int8_t* b, size_t ldb, int32_t* out, size_t n) {
+    const __m256i ones = _mm256_set1_epi16(1);
+    __m256i acc0 = _mm256_setzero_si256();
+    __m256i acc1 = _mm256_setzero_si256();
+    __m256i acc2 = _mm256_setzero_si256();
+    __m256i acc3 = _mm256_setzero_si256();
+    for (size_t i = 0; i < n; i += 32) {
+        __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+        acc0 = _mm256_add_epi32(acc0, MaddU8S8Avx2(va, b + i, ones));
+        acc1 = _mm256_add_epi32(acc1, MaddU8S8Avx2(va, b + ldb + i, ones));
+        acc2 = _mm256_add_epi32(acc2, MaddU8S8Avx2(va, b + 2 * ldb + i, ones));
+        acc3 = _mm256_add_epi32(acc3, MaddU8S8Avx2(va, b + 3 * ldb + i, ones));
+    }
+    out[0] = HorizontalSumAvx2(acc0);
+    out[1] = HorizontalSumAvx2(acc1);
+    out[2] = HorizontalSumAvx2(acc2);
+    out[3] = HorizontalSumAvx2(acc3);
+}
+
+TARGET("avx512f,avx512bw,avx512vnni")
+int32_t DotU8S8Vnni(const uint8_t* a, const int8_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 64) {
+        // Four u8 * s8 products summed into each s32 lane, without saturation
+        acc = _mm512_dpbusd_epi32(acc, _mm512_loadu_si512(a + i), _mm512_loadu_si512(b + i));
+    }
+    return _mm512_reduce_add_epi32(acc);
+}
+
+TARGET("avx512f,avx512bw,avx512vnni")
+void Dot4U8S8Vnni(const uint8_t* a, const int8_t* b, size_t ldb, int32_t* out, size_t n) {
+    __m512i acc0 = _mm512_setzero_si512();
+    __m512i acc1 = _mm512_setzero_si512();
+    __m512i acc2 = _mm512_setzero_si512();
+    __m512i acc3 = _mm512_setzero_si512();
+    for (size_t i = 0; i < n; i += 64) {
+        __m512i va = _mm512_loadu_si512(a + i);
+        acc0 = _mm512_dpbusd_epi32(acc0, va, _mm512_loadu_si512(b + i));
+        acc1 = _mm512_dpbusd_epi32(acc1, va, _mm512_loadu_si512(b + ldb + i));
+        acc2 = _mm512_dpbusd_epi32(acc2, va, _mm512_loadu_si512(b + 2 * ldb + i));
+        acc3 = _mm512_dpbusd_epi32(acc3, va, _mm512_loadu_si512(b + 3 * ldb + i));
+    }
+    out[0] = _mm512_reduce_add_epi32(acc0);
+    out[1] = _mm512_reduce_add_epi32(acc1);
+    out[2] = _mm512_reduce_add_epi32(acc2);
+    out[3] = _mm512_reduce_add_epi32(acc3);
+}
+
+#endif
+
+const KernelSet scalar_set{Isa::SCALAR, "scalar",
+                           DotScalar, AxpyScalar, Dot4Scalar, Axpy4Scalar,
+                           SigmoidPolynomialScalar};
+
+#ifdef KERNELS_X86
+const KernelSet sse42_set{Isa::SSE42, "sse4.2",
+                          DotSse42, AxpySse42, Dot4Sse42, Axpy4Sse42,
+                          SigmoidPolynomialSse42};
+const KernelSet avx2_set{Isa::AVX2, "avx2",
+                         DotAvx2, AxpyAvx2, Dot4Avx2, Axpy4Avx2,
+                         SigmoidPolynomialAvx2};
+const KernelSet avx512_set{Isa::AVX512, "avx512",
+                           DotAvx512, AxpyAvx512, Dot4Avx512, Axpy4Avx512,
+                           SigmoidPolynomialAvx512};
+#endif
+
+const Int8KernelSet int8_scalar_set{Int8Isa::SCALAR, "scalar", DotU8S8Scalar, Dot4U8S8Scalar};
+
+#ifdef KERNELS_X86
+const Int8KernelSet int8_ssse3_set{Int8Isa::SSSE3, "ssse3", DotU8S8Ssse3, Dot4U8S8Ssse3};
+const Int8KernelSet int8_avx2_set{Int8Isa::AVX2, "avx2", DotU8S8Avx2, Dot4U8S8Avx2};
+const Int8KernelSet int8_vnni_set{Int8Isa::AVX512_VNNI, "avx512-vnni", DotU8S8Vnni, Dot4U8S8Vnni};
+#endif
+
+// Number of rows of k floats that fit in a half of a typical L2 cache
+size_t RowsPerBlock(size_t k) {
+    constexpr size_t block_bytes = 128 * 1024;
+    size_t rows = block_bytes / (k * sizeof(float) + 1);
+    return std::max<size_t>(4, rows / 4 * 4);
+}
+
+const KernelSet* DetectBest() {
+#ifdef KERNELS_X86
+    // __builtin_cpu_supports queries cpuid and checks
+    // that the OS saves the wide registers
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        return &avx512_set;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        return &avx2_set;
+    }
+    if (__builtin_cpu_supports("sse4.2")) {
+        return &sse42_set;
+    }
+#endif
+    return &scalar_set;
+}
+
+const KernelSet* active_set = DetectBest();
+
+bool Int8Supported(Int8Isa isa) {
+#ifdef KERNELS_X86
+    __builtin_cpu_init();
+    switch (isa) {
+        case Int8Isa::AVX512_VNNI:
+            return __builtin_cpu_supports("avx512vnni") && __builtin_cpu_supports("avx512bw");
+        case Int8Isa::AVX2:
+            return __builtin_cpu_supports("avx2");
+        case Int8Isa::SSSE3:
+            return __builtin_cpu_supports("ssse3");
+        default:
+            return true;
+    }
+#else
+    return isa == Int8Isa::SCALAR;
+#endif
+}
+
+const Int8KernelSet* DetectBestInt8() {
+    for (Int8Isa isa : {Int8Isa::AVX512_VNNI, Int8Isa::AVX2, Int8Isa::SSSE3}) {
+        if (const Int8KernelSet* set = GetInt8(isa)) {
+            return set;
+        }
+    }
+    return &int8_scalar_set;
+}
+
+}
+
+const KernelSet& Active() {
+    return *active_set;
+}
+
+const KernelSet* Get(Isa isa) {
+    const KernelSet* best = DetectBest();
+    if (isa > best->isa) {
+        return nullptr;
+    }
+    switch (isa) {
+#ifdef KERNELS_X86
+        case Isa::AVX512:
+            return &avx512_set;
+        case Isa::AVX2:
+            return &avx2_set;
+        case Isa::SSE42:
+            return &sse42_set;
+#endif
+        default:
+            return &scalar_set;
+    }
+}
+
+void SetActive(Isa isa) {
+    const KernelSet* set = Get(isa);
+    if (set == nullptr) {
+        throw std::invalid_argument("The instruction set is not supported by the CPU"s);
+    }
+    active_set = set;
+}
+
+const Int8KernelSet& ActiveInt8() {
+    static const Int8KernelSet* best = DetectBestInt8();
+    return *best;
+}
+
+const Int8KernelSet* GetInt8(Int8Isa isa) {
+    if (!Int8Supported(isa)) {
+        return nullptr;
+    }
+    switch (isa) {
+#ifdef KERNELS_X86
+        case Int8Isa::AVX512_VNNI:
+            return &int8_vnni_set;
+        case Int8Isa::AVX2:
+            return &int8_avx2_set;
+        case Int8Isa::SSSE3:
+            return &int8_ssse3_set;
+#endif
+        default:
+            return &int8_scalar_set;
+    }
+}
+
+void ApplySigmoid(Sigmoid mode, const float* bias, float* x, size_t n) {
+    switch (mode) {
+        case Sigmoid::POLYNOMIAL:
+            Active().sigmoid_polynomial(bias, x, n);
+            break;
+        case Sigmoid::TABLE:
+            SigmoidTableScalar(bias, x, n);
+            break;
+        default:
+            SigmoidExact(bias, x, n);
+    }
+}
+
+void GemmNt(const float* a, size_t lda, const float* b, size_t ldb,
+            float* c, size_t ldc, size_t m, size_t n, size_t k) {
+    const KernelSet& set = Active();
+    const size_t block = RowsPerBlock(k);
+    for (size_t j0 = 0; j0 < n; j0 += block) {
+        const size_t j_end = std::min(n, j0 + block);
+        for (size_t i = 0; i < m; ++i) {
+            const float* a_row = a + i * lda;
+            float* c_row = c + i * ldc;
+            size_t j = j0;
+            for (; j + 4 <= j_end; j += 4) {
+                set.dot4(a_row, b + j * ldb, ldb, c_row + j, k);
+            }
+            for (; j < j_end; ++j) {
+                c_row[j] = set.dot(a_row, b + j * ldb, k);
+            }
+        }
+    }
+}
+
+void GemmNnAcc(const float* a, size_t lda, const float* b, size_t ldb,
+               float* c, size_t ldc, size_t m, size_t n, size_t k) {
+    const KernelSet& set = Active();
+    const size_t block = RowsPerBlock(n);
+    for (size_t p0 = 0; p0 < k; p0 += block) {
+        const size_t p_end = std::min(k, p0 + block);
+        for (size_t i = 0; i < m; ++i) {
+            const float* a_row = a + i * lda;
+            float* c_row = c + i * ldc;
+            size_t p = p0;
+            for (; p + 4 <= p_end; p += 4) {
+                set.axpy4(a_row + p, b + p * ldb, ldb, c_row, n);
+            }
+            for (; p < p_end; ++p) {
+                set.axpy(a_row[p], b + p * ldb, c_row, n);
+            }
+        }
+    }
+}
+
+void GemmTnAcc(float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+               float* c, size_t ldc, size_t m, size_t n, size_t k) {
+    const KernelSet& set = Active();
+    const size_t block = RowsPerBlock(n);
+    for (size_t p0 = 0; p0 < k; p0 += block) {
+        const size_t p_end = std::min(k, p0 + block);
+        for (size_t i = 0; i < m; ++i) {
+            float* c_row = c + i * ldc;
+            size_t p = p0;
+            for (; p + 4 <= p_end; p += 4) {
+                const float coefs[4] = {alpha * a[p * lda + i],
+                                        alpha * a[(p + 1) * lda + i],
+                                        alpha * a[(p + 2) * lda + i],
+                                        alpha * a[(p + 3) * lda + i]};
+                set.axpy4(coefs, b + p * ldb, ldb, c_row, n);
+            }
+            for (; p < p_end; ++p) {
+                set.axpy(alpha * a[p * lda + i], b + p * ldb, c_row, n);
+            }
+        }
+    }
+}
+
+}
+
+namespace tests {
+
+void KernelsAgree() {
+    using namespace kernels;
+
+    std::default_random_engine e2(42);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+
+    const KernelSet* scalar = Get(Isa::SCALAR);
+    for (Isa isa : {Isa::SSE42, Isa::AVX2, Isa::AVX512}) {
+        const KernelSet* set = Get(isa);
+        if (set == nullptr) {
+            continue;
+        }
+        // Sizes with and without tails
+        for (size_t n : {1, 3, 10, 16, 31, 128, 1024, 1027}) {
+            std::vector<float> a(n);
+            std::vector<float> b(n);
+            float magnitude = 0.0f;
+            for (size_t i = 0; i < n; ++i) {
+                a[i] = dist(e2);
+                b[i] = dist(e2);
+                magnitude += std::abs(a[i] * b[i]);
+            }
+            // Summation order differs, so compare within a tolerance
+            [[maybe_unused]] const float tolerance = 1e-5f * (magnitude + 1.0f);
+            [[maybe_unused]] float dot_scalar = scalar->dot(a.data(), b.data(), n);
+            [[maybe_unused]] float dot_vector = set->dot(a.data(), b.data(), n);
+            assert(std::abs(dot_scalar - dot_vector) <= tolerance);
+
+            std::vector<float> y_scalar = b;
+            std::vector<float> y_vector = b;
+            scalar->axpy(0.37f, a.data(), y_scalar.data(), n);
+            set->axpy(0.37f, a.data(), y_vector.data(), n);
+            for (size_t i = 0; i < n; ++i) {
+                assert(std::abs(y_scalar[i] - y_vector[i]) <= 1e-6f);
+            }
+
+            // Four rows: a, b, a, b
+            std::vector<float> rows(4 * n);
+            for (size_t i = 0; i < n; ++i) {
+                rows[i] = rows[2 * n + i] = a[i];
+                rows[n + i] = rows[3 * n + i] = b[i];
+            }
+            float dots[4];
+            set->dot4(b.data(), rows.data(), n, dots, n);
+            assert(std::abs(dots[0] - dot_scalar) <= tolerance);
+            assert(std::abs(dots[2] - dot_scalar) <= tolerance);
+
+            const float alpha[4] = {0.1f, -0.2f, 0.3f, 0.4f};
+            y_scalar = a;
+            y_vector = a;
+            scalar->axpy4(alpha, rows.data(), n, y_scalar.data(), n);
+            set->axpy4(alpha, rows.data(), n, y_vector.data(), n);
+            for (size_t i = 0; i < n; ++i) {
+                assert(std::abs(y_scalar[i] - y_vector[i]) <= 1e-5f);
+            }
+        }
+    }
+
+    // Integer sums must be equal, including the extreme values
+    std::uniform_int_distribution<int> dist_a(0, 127);
+    std::uniform_int_distribution<int> dist_b(-127, 127);
+    const Int8KernelSet* int8_scalar = GetInt8(Int8Isa::SCALAR);
+    for (Int8Isa isa : {Int8Isa::SSSE3, Int8Isa::AVX2, Int8Isa::AVX512_VNNI}) {
+        const Int8KernelSet* set = GetInt8(isa);
+        if (set == nullptr) {
+            continue;
+        }
+        for (size_t n : {64, 128, 1024}) {
+            std::vector<uint8_t> a(n);
+            std::vector<int8_t> rows(4 * n);
+            for (size_t i = 0; i < n; ++i) {
+                a[i] = static_cast<uint8_t>(dist_a(e2));
+            }
+            for (size_t i = 0; i < 4 * n; ++i) {
+                rows[i] = static_cast<int8_t>(dist_b(e2));
+            }
+            std::fill(a.begin(), a.begin() + 32, 127);
+            std::fill(rows.begin(), rows.begin() + 32, 127);
+            std::fill(rows.begin() + n, rows.begin() + n + 32, -127);
+
+            int32_t expected[4];
+            int32_t result[4];
+            int8_scalar->dot4(a.data(), rows.data(), n, expected, n);
+            set->dot4(a.data(), rows.data(), n, result, n);
+            for (size_t r = 0; r < 4; ++r) {
+                assert(result[r] == expected[r]);
+                assert(set->dot(a.data(), rows.data() + r * n, n) == expected[r]);
+            }
+        }
+    }
+}
+
+void SigmoidErrorsAreBounded() {
+    using namespace kernels;
+
+    // Dense grid over the range of the net inputs and beyond it
+    std::vector<float> x;
+    for (float value = -30.0f; value <= 30.0f; value += 1.0f / 1024.0f) {
+        x.push_back(value);
+    }
+    const std::vector<float> zero_bias(x.size(), 0.0f);
+
+    // Derivatives taken from the outputs must be as close
+    // to the exact derivative as the outputs to the exact sigmoid
+    auto check = [&]([[maybe_unused]] const std::vector<float>& out,
+                     [[maybe_unused]] float max_error) {
+        for (size_t i = 0; i < x.size(); ++i) {
+            [[maybe_unused]] const double exact = 1.0 / (1.0 + std::exp(-static_cast<double>(x[i])));
+            assert(out[i] >= 0.0f && out[i] <= 1.0f);
+            assert(std::abs(out[i] - exact) <= max_error);
+            assert(std::abs(out[i] * (1.0 - out[i]) - exact * (1.0 - exact)) <= max_error);
+        }
+    };
+
+    for (Isa isa : {Isa::SCALAR, Isa::SSE42, Isa::AVX2, Isa::AVX512}) {
+        const KernelSet* set = Get(isa);
+        if (set == nullptr) {
+            continue;
+        }
+        std::vector<float> out = x;
+        set->sigmoid_polynomial(zero_bias.data(), out.data(), out.size());
+        check(out, sigmoid_polynomial_max_error);
+    }
+
+    std::vector<float> out = x;
+    ApplySigmoid(Sigmoid::TABLE, zero_bias.data(), out.data(), out.size());
+    check(out, sigmoid_table_max_error);
+
+    // The bias is added before the activation
+    const std::vector<float> bias(x.size(), 0.5f);
+    std::vector<float> shifted(x.size(), -0.5f);
+    ApplySigmoid(Sigmoid::POLYNOMIAL, bias.data(), shifted.data(), shifted.size());
+    assert(std::abs(shifted[0] - 0.5f) <= sigmoid_polynomial_max_error);
+}
+
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Vectorized loops of the neural network.
+// Each set is compiled for its own instruction set in one binary,
+// the best one supported by the CPU is selected at startup
+
+namespace kernels {
+
+enum class Isa {
+    SCALAR,
+    SSE42,
+    AVX2,
+    AVX512
+};
+
+// Returns sum of a[i] * b[i]
+using DotFunc = float (*)(const float* a, const float* b, size_t n);
+
+// Performs y[i] += alpha * x[i]
+using AxpyFunc = void (*)(float alpha, const float* x, float* y, size_t n);
+
+// Performs out[r] = sum of a[i] * b[r * ldb + i] for r = 0..3
+// (one row against four rows, the row a is loaded once)
+using Dot4Func = void (*)(const float* a, const float* b, size_t ldb, float* out, size_t n);
+
+// Performs y[i] += sum of alpha[r] * x[r * ldx + i] for r = 0..3
+// (y is loaded and stored once for four rows)
+using Axpy4Func = void (*)(const float* alpha, const float* x, size_t ldx, float* y, size_t n);
+
+// Performs x[i] = sigmoid(x[i] + bias[i])
+using SigmoidFunc = void (*)(const float* bias, float* x, size_t n);
+
+struct KernelSet {
+    Isa isa;
+    const char* name;
+    DotFunc dot;
+    AxpyFunc axpy;
+    Dot4Func dot4;
+    Axpy4Func axpy4;
+    SigmoidFunc sigmoid_polynomial;
+};
+
+// Returns the set used by the network
+const KernelSet& Active();
+
+// Returns the set for the instruction set
+// or nullptr if the CPU doesn't support it
+const KernelSet* Get(Isa isa);
+
+// Replaces the active set (for tests and benchmarks).
+// Throws std::invalid_argument if the CPU doesn't support the instruction set
+void SetActive(Isa isa);
+
+// Implementations of the sigmoid activation. The backward pass takes
+// the derivative from the output as out * (1 - out). For the approximations
+// it is the exact derivative at the point where the sigmoid equals the
+// output, so its error is not greater than the max error of the output.
+// All of them keep the outputs in [0, 1]
+enum class Sigmoid {
+    EXACT, // 1 / (1 + std::exp(-x)), the reference
+    POLYNOMIAL, // vectorized exp: 2^n * degree 5 polynomial, max error 1e-7
+    TABLE // linear interpolation in [-16, 16] with step 1/64, max error 3e-6
+};
+
+// Max absolute errors of the approximations against the exact sigmoid
+constexpr float sigmoid_polynomial_max_error = 1e-7f;
+constexpr float sigmoid_table_max_error = 3e-6f;
+
+// Performs x[i] = sigmoid(x[i] + bias[i]) with the mode,
+// the polynomial is computed by the active set
+void ApplySigmoid(Sigmoid mode, const float* bias, float* x, size_t n);
+
+// Cache-blocked products of row-major matrices, ld* are row strides.
+// They are built on the active set
+
+// C = A * B^T, where A is [m x k], B is [n x k], C is [m x n].
+// B is processed in blocks that stay in the cache for all rows of A
+void GemmNt(const float* a, size_t lda, const float* b, size_t ldb,
+            float* c, size_t ldc, size_t m, size_t n, size_t k);
+
+// C += A * B, where A is [m x k], B is [k x n], C is [m x n]
+void GemmNnAcc(const float* a, size_t lda, const float* b, size_t ldb,
+               float* c, size_t ldc, size_t m, size_t n, size_t k);
+
+// C += alpha * A^T * B, where A is [k x m], B is [k x n], C is [m x n].
+// Each row of C stays in the cache for a block of rows of B
+void GemmTnAcc(float alpha, const float* a, size_t lda, const float* b, size_t ldb,
+               float* c, size_t ldc, size_t m, size_t n, size_t k);
+
+// Integer kernels of the quantized network. They have their own
+// selection: VNNI, pmaddubsw or scalar code, all of them give the
+// same sums, so the results don't depend on the CPU
+
+enum class Int8Isa {
+    SCALAR,
+    SSSE3, // pmaddubsw
+    AVX2, // pmaddubsw
+    AVX512_VNNI // vpdpbusd
+};
+
+// Returns sum of a[i] * b[i] for unsigned a and signed b.
+// The values of a must not exceed 127 (the pairwise sums of pmaddubsw
+// would saturate), n must be a multiple of 64
+using DotU8S8Func = int32_t (*)(const uint8_t* a, const int8_t* b, size_t n);
+
+// Performs out[r] = sum of a[i] * b[r * ldb + i] for r = 0..3
+using Dot4U8S8Func = void (*)(const uint8_t* a, const int8_t* b, size_t ldb,
+                              int32_t* out, size_t n);
+
+struct Int8KernelSet {
+    Int8Isa isa;
+    const char* name;
+    DotU8S8Func dot;
+    Dot4U8S8Func dot4;
+};
+
+// The best set supported by the CPU
+const Int8KernelSet& ActiveInt8();
+
+// Returns nullptr if the CPU doesn't support the instruction set
+const Int8KernelSet* GetInt8(Int8Isa isa);
+
+}
+
+namespace tests {
+
+void KernelsAgree();
+void SigmoidErrorsAreBounded();
+
+}
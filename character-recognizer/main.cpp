@@ -1,8 +1,39 @@
+#include "batch_file_reader.h"
+#include "checkpoint_writer.h"
 #include "command_interpreter.h"
+#include "glyph_bundle.h"
+#include "glyph_loader.h"
+#include "kernels.h"
+#include "quantized_snn.h"
+#include "recognition_server.h"
+#include "request_handler.h"
+#include "sample_cache.h"
 #include "snn.h"
+#include "state_saver.h"
+#include "thread_pool.h"
+#include "zip_archive.h"
 
 void RunTests() {
     tests::Propagate();
+    tests::PropagateBatch();
+    tests::KernelsAgree();
+    tests::SigmoidErrorsAreBounded();
+    tests::SaveAndMapState();
+    tests::SaveAndLoadCheckpoint();
+    tests::SaveAndMapQuantizedState();
+    tests::WriteCheckpointsInBackground();
+    tests::SampleCacheRejectsDamagedFiles();
+    tests::BatchFileReaderReads();
+    tests::GlyphLoaderDecodes();
+    tests::PackAndUnpackBundle();
+    tests::ZipArchiveReads();
+    tests::NestedSubmitsAreWaited();
+    tests::QuantizedInferenceIsClose();
+    tests::ServerAnswersClients();
+    tests::RecognitionDoesNotAllocate();
+    tests::PrefetchedRecognitionMatches();
+    tests::ObserveEpochKeepsTheBest();
+    tests::ResumedTrainingMatches();
 }
 
 int main(int argc, char** argv) {
@@ -0,0 +1,66 @@
+#include "mapped_file.h"
+
+#include <fstream>
+#include <stdexcept>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define MAPPED_FILE_POSIX
+    #include <fcntl.h>
+    #include <sys/mman.h>
+    #include <sys/stat.h>
+    #include <unistd.h>
+#endif
+
+using namespace std::literals;
+
+MappedFile::MappedFile(const std::filesystem::path& file) {
+#ifdef MAPPED_FILE_POSIX
+    int fd = open(file.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("Unable to open file "s + file.string());
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        throw std::runtime_error("Unable to get the size of file "s + file.string());
+    }
+    size_ = static_cast<size_t>(st.st_size);
+    if (size_ > 0) {
+        void* data = mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        close(fd);
+        if (data == MAP_FAILED) {
+            throw std::runtime_error("Unable to map file "s + file.string());
+        }
+        data_ = static_cast<const std::byte*>(data);
+        mapped_ = true;
+    } else {
+        close(fd);
+    }
+#else
+    std::ifstream in(file, std::ios::binary | std::ios::ate);
+    if (!in) {
+        throw std::runtime_error("Unable to open file "s + file.string());
+    }
+    size_ = static_cast<size_t>(in.tellg());
+    buffer_.resize(size_);
+    in.seekg(0);
+    in.read(reinterpret_cast<char*>(buffer_.data()), size_);
+    data_ = buffer_.data();
+#endif
+}
+
+MappedFile::~MappedFile() {
+#ifdef MAPPED_FILE_POSIX
+    if (mapped_) {
+        munmap(const_cast<std::byte*>(data_), size_);
+    }
+#endif
+}
+
+const std::byte* MappedFile::GetData() const {
+    return data_;
+}
+
+size_t MappedFile::GetSize() const {
+    return size_;
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include <cstddef>
+#include <filesystem>
+#include <vector>
+
+// Read-only memory mapping of a whole file.
+// The data starts on a page boundary. Where mapping is not
+// available the file is read into memory instead (the data
+// is then aligned only as a usual heap block)
+
+class MappedFile {
+public:
+    explicit MappedFile(const std::filesystem::path& file);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const std::byte* GetData() const;
+    size_t GetSize() const;
+
+private:
+    const std::byte* data_ = nullptr;
+    size_t size_ = 0;
+    bool mapped_ = false;
+    std::vector<std::byte> buffer_;
+};
@@ -0,0 +1,316 @@
+#include "profiler.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <cstring>
+#include <iomanip>
+#include <limits>
+#include <mutex>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+namespace profiler {
+
+namespace {
+
+using Clock = Zone::Clock;
+
+// Durations in ns fall into buckets of a quarter of an octave:
+// bucket b holds [2^(b/4), 2^((b+1)/4)), percentiles are their upper
+// bounds, so they are within 19% of the exact values
+constexpr size_t buckets_per_octave = 4;
+constexpr size_t bucket_count = 44 * buckets_per_octave; // up to 2^44 ns (4.9 hours)
+
+size_t BucketOf(uint64_t ns) {
+    if (ns < 2) {
+        return 0;
+    }
+    size_t bucket = static_cast<size_t>(std::log2(static_cast<double>(ns)) * buckets_per_octave);
+    return std::min(bucket, bucket_count - 1);
+}
+
+double BucketUpperBound(size_t bucket) {
+    return std::exp2(static_cast<double>(bucket + 1) / buckets_per_octave);
+}
+
+struct Node {
+    const char* name;
+    uint32_t parent;
+    std::vector<uint32_t> children;
+    uint64_t count = 0;
+    uint64_t total = 0; // ns
+    uint64_t min = std::numeric_limits<uint64_t>::max();
+    uint64_t max = 0;
+    std::array<uint64_t, bucket_count> histogram{};
+
+    void Add(const Node& other) {
+        count += other.count;
+        total += other.total;
+        min = std::min(min, other.min);
+        max = std::max(max, other.max);
+        for (size_t b = 0; b < bucket_count; ++b) {
+            histogram[b] += other.histogram[b];
+        }
+    }
+};
+
+// Tree of zones, node 0 is the root
+class Tree {
+public:
+    Tree() {
+        nodes.push_back(Node{"", 0, {}});
+    }
+
+    // Child of the parent with the name, it is added if there is no such child
+    uint32_t GetChild(uint32_t parent, const char* name) {
+        for (uint32_t child : nodes[parent].children) {
+            // Literals with equal contents may have different addresses
+            if (nodes[child].name == name || std::strcmp(nodes[child].name, name) == 0) {
+                return child;
+            }
+        }
+        const uint32_t child = static_cast<uint32_t>(nodes.size());
+        nodes.push_back(Node{name, parent, {}});
+        nodes[parent].children.push_back(child);
+        return child;
+    }
+
+    // Adds the subtree of the other tree to the node of this one
+    void Merge(const Tree& other, uint32_t other_node = 0, uint32_t node = 0) {
+        nodes[node].Add(other.nodes[other_node]);
+        for (uint32_t other_child : other.nodes[other_node].children) {
+            Merge(other, other_child, GetChild(node, other.nodes[other_child].name));
+        }
+    }
+
+    std::vector<Node> nodes;
+};
+
+struct Event {
+    uint32_t node; // in the tree of the thread
+    uint64_t start; // ns since the start of the process
+    uint64_t duration;
+};
+
+struct TraceEvent {
+    const char* name;
+    uint32_t thread;
+    uint64_t start;
+    uint64_t duration;
+};
+
+const Clock::time_point process_start = Clock::now();
+
+uint64_t Nanoseconds(Clock::duration duration) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(duration).count());
+}
+
+// Profile merged from the threads
+struct Profile {
+    std::mutex mutex;
+    Tree tree;
+    std::vector<TraceEvent> events;
+    uint32_t next_thread = 1;
+};
+
+Profile& GetProfile() {
+    // Never destroyed: threads are merged into it up to the end of the process
+    static Profile* profile = new Profile;
+    return *profile;
+}
+
+class ThreadBuffer {
+public:
+    ThreadBuffer() {
+        Profile& profile = GetProfile();
+        std::lock_guard lock(profile.mutex);
+        thread_ = profile.next_thread++;
+    }
+
+    ~ThreadBuffer() {
+        Flush();
+    }
+
+    uint32_t Enter(const char* name) {
+        current_ = tree_.GetChild(current_, name);
+        return current_;
+    }
+
+    void Leave(uint32_t node, Clock::time_point start_time) {
+        const uint64_t start = Nanoseconds(start_time - process_start);
+        const uint64_t duration = Nanoseconds(Clock::now() - start_time);
+        Node& data = tree_.nodes[node];
+        ++data.count;
+        data.total += duration;
+        data.min = std::min(data.min, duration);
+        data.max = std::max(data.max, duration);
+        ++data.histogram[BucketOf(duration)];
+        if (events_.size() < max_trace_events) {
+            events_.push_back({node, start, duration});
+        }
+        current_ = data.parent;
+    }
+
+    std::shared_ptr<const std::vector<const char*>> GetPath() const {
+        if (current_ == 0) {
+            return nullptr;
+        }
+        auto path = std::make_shared<std::vector<const char*>>();
+        for (uint32_t node = current_; node != 0; node = tree_.nodes[node].parent) {
+            path->push_back(tree_.nodes[node].name);
+        }
+        std::reverse(path->begin(), path->end());
+        return path;
+    }
+
+    // Makes the node of the path current, returns the previous one
+    uint32_t Attach(const std::vector<const char*>* path) {
+        const uint32_t previous = current_;
+        current_ = 0;
+        if (path) {
+            for (const char* name : *path) {
+                current_ = tree_.GetChild(current_, name);
+            }
+        }
+        return previous;
+    }
+
+    void Detach(uint32_t previous) {
+        current_ = previous;
+    }
+
+    // Moves the data to the common profile, the open zones stay open
+    void Flush() {
+        Profile& profile = GetProfile();
+        {
+            std::lock_guard lock(profile.mutex);
+            profile.tree.Merge(tree_);
+            for (const Event& event : events_) {
+                profile.events.push_back({tree_.nodes[event.node].name, thread_,
+                                          event.start, event.duration});
+            }
+        }
+        events_.clear();
+        for (Node& node : tree_.nodes) {
+            node.count = node.total = node.max = 0;
+            node.min = std::numeric_limits<uint64_t>::max();
+            node.histogram.fill(0);
+        }
+    }
+
+private:
+    Tree tree_;
+    uint32_t current_ = 0;
+    uint32_t thread_;
+    std::vector<Event> events_;
+};
+
+ThreadBuffer& GetThreadBuffer() {
+    thread_local ThreadBuffer buffer;
+    return buffer;
+}
+
+void WriteNode(const Tree& tree, uint32_t index, size_t depth, std::ostream& output) {
+    const Node& node = tree.nodes[index];
+    if (node.count > 0) {
+        auto percentile = [&node](double fraction) {
+            const uint64_t rank = static_cast<uint64_t>(std::ceil(fraction * node.count));
+            uint64_t seen = 0;
+            for (size_t b = 0; b < bucket_count; ++b) {
+                seen += node.histogram[b];
+                if (seen >= rank) {
+                    // The bound of the bucket, but not above the max
+                    return std::min(BucketUpperBound(b), static_cast<double>(node.max)) / 1e3;
+                }
+            }
+            return node.max / 1e3;
+        };
+        output << std::left << std::setw(36) << std::string(depth * 2, ' ') + node.name
+               << std::right << std::setw(10) << node.count
+               << std::setw(12) << node.total / 1e6
+               << std::setw(12) << node.min / 1e3
+               << std::setw(12) << percentile(0.50)
+               << std::setw(12) << percentile(0.95)
+               << std::setw(12) << percentile(0.99)
+               << std::setw(12) << node.max / 1e3 << std::endl;
+    }
+    // Children in the order of the total time
+    std::vector<uint32_t> children = node.children;
+    std::sort(children.begin(), children.end(), [&tree](uint32_t lhs, uint32_t rhs) {
+        return tree.nodes[lhs].total > tree.nodes[rhs].total;
+    });
+    for (uint32_t child : children) {
+        WriteNode(tree, child, node.count > 0 ? depth + 1 : depth, output);
+    }
+}
+
+}
+
+#ifdef PROFILE_ENABLED
+
+Zone::Zone(const char* name)
+: node_(GetThreadBuffer().Enter(name))
+, start_time_(Clock::now()) {
+}
+
+Zone::~Zone() {
+    GetThreadBuffer().Leave(node_, start_time_);
+}
+
+Context Context::Current() {
+    Context context;
+    context.path_ = GetThreadBuffer().GetPath();
+    return context;
+}
+
+ContextScope::ContextScope(const Context& context)
+: previous_(GetThreadBuffer().Attach(context.path_.get())) {
+}
+
+ContextScope::~ContextScope() {
+    GetThreadBuffer().Detach(previous_);
+}
+
+#endif
+
+void WriteSummary(std::ostream& output) {
+    if (!enabled) {
+        output << "The program is built without profiling"s << std::endl;
+        return;
+    }
+    GetThreadBuffer().Flush();
+    Profile& profile = GetProfile();
+    std::lock_guard lock(profile.mutex);
+
+    output << std::left << std::setw(36) << "zone"s << std::right << std::setw(10) << "count"s
+           << std::setw(12) << "total, ms"s << std::setw(12) << "min, us"s
+           << std::setw(12) << "p50, us"s << std::setw(12) << "p95, us"s
+           << std::setw(12) << "p99, us"s << std::setw(12) << "max, us"s << std::endl;
+    output << std::fixed << std::setprecision(1);
+    WriteNode(profile.tree, 0, 0, output);
+}
+
+void WriteChromeTrace(std::ostream& output) {
+    if (!enabled) {
+        output << "{\"traceEvents\": []}"s << std::endl;
+        return;
+    }
+    GetThreadBuffer().Flush();
+    Profile& profile = GetProfile();
+    std::lock_guard lock(profile.mutex);
+
+    // Timestamps and durations are in microseconds
+    output << "{\"traceEvents\": [\n"s << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < profile.events.size(); ++i) {
+        const TraceEvent& event = profile.events[i];
+        output << "{\"name\": \""s << event.name << "\", \"ph\": \"X\", \"pid\": 1, \"tid\": "s
+               << event.thread << ", \"ts\": "s << event.start / 1e3 << ", \"dur\": "s
+               << event.duration / 1e3 << "}"s << (i + 1 < profile.events.size() ? ",\n"s : "\n"s);
+    }
+    output << "]}"s << std::endl;
+}
+
+}
@@ -1,32 +1,114 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <vector>
+
+// Scoped profiler. PROFILE_SCOPE("name") measures the time until the end
+// of the enclosing scope. Zones opened inside a zone are its children,
+// so the zones form a tree that follows the nesting; a zone reached by
+// different paths has a node for each of them.
+//
+// A thread that hands work to other threads passes them its Context,
+// the zones they open under a ContextScope of it nest under the zone
+// of the submitter. The times of children that ran on several threads
+// add up, so they can exceed the time of their parent. Zones of a thread
+// without a context are children of the root.
+//
+// Every thread records into its own buffer without locking: per node
+// the call count, total, min, max and a histogram of durations for the
+// percentiles, and up to max_trace_events events for the trace. The
+// buffer is merged into the common profile when the thread exits, the
+// writers merge the buffer of the calling thread before writing.
+//
+// It is compiled out unless PROFILE_ENABLED is defined
+// (the RECOGNIZER_PROFILE option of CMake)
 
 #define PROFILE_CONCAT_INTERNAL(X, Y) X##Y
 #define PROFILE_CONCAT(X, Y) PROFILE_CONCAT_INTERNAL(X, Y)
 #define UNIQUE_VAR_NAME_PROFILE PROFILE_CONCAT(profileGuard, __LINE__)
-#define LOG_DURATION(x) LogDuration UNIQUE_VAR_NAME_PROFILE(x)
 
-class LogDuration {
+#ifdef PROFILE_ENABLED
+    // The name must be a string literal, the profiler keeps the pointer
+    #define PROFILE_SCOPE(name) profiler::Zone UNIQUE_VAR_NAME_PROFILE(name)
+#else
+    #define PROFILE_SCOPE(name)
+#endif
+
+namespace profiler {
+
+#ifdef PROFILE_ENABLED
+constexpr bool enabled = true;
+#else
+constexpr bool enabled = false;
+#endif
+
+// Events of a thread beyond it are only aggregated
+constexpr size_t max_trace_events = 1 << 20;
+
+class Zone {
 public:
     using Clock = std::chrono::steady_clock;
 
-    LogDuration(const std::string& id) : id_(id) {
-    }
+    explicit Zone(const char* name);
+    ~Zone();
 
-    ~LogDuration() {
-        using namespace std::chrono;
-        using namespace std::literals;
+    Zone(const Zone&) = delete;
+    Zone& operator=(const Zone&) = delete;
 
-        const auto end_time = Clock::now();
-        const auto dur = end_time - start_time_;
-        std::cerr << id_ << ": "s
-            << duration_cast<milliseconds>(dur).count()
-            << " ms"s << std::endl;
-    }
+private:
+    uint32_t node_;
+    const Clock::time_point start_time_;
+};
+
+// Position of a thread in the zone tree: its innermost open zone.
+// Copies are cheap and may be used by any thread
+class Context {
+public:
+    static Context Current();
 
 private:
-    const std::string id_;
-    const Clock::time_point start_time_ = Clock::now();
-};
\ No newline at end of file
+    friend class ContextScope;
+
+#ifdef PROFILE_ENABLED
+    // Names of the zones from the root, nullptr at the root
+    std::shared_ptr<const std::vector<const char*>> path_;
+#endif
+};
+
+// The zones that the calling thread opens in the scope nest under
+// the zone of the context
+class ContextScope {
+public:
+    explicit ContextScope(const Context& context);
+    ~ContextScope();
+
+    ContextScope(const ContextScope&) = delete;
+    ContextScope& operator=(const ContextScope&) = delete;
+
+#ifdef PROFILE_ENABLED
+private:
+    uint32_t previous_;
+#endif
+};
+
+#ifndef PROFILE_ENABLED
+inline Context Context::Current() {
+    return {};
+}
+
+inline ContextScope::ContextScope(const Context&) {
+}
+
+inline ContextScope::~ContextScope() {
+}
+#endif
+
+// Table of the zone tree: count, total, min, percentiles and max
+void WriteSummary(std::ostream& output);
+// Trace Event Format of chrome://tracing and Perfetto, one complete event per zone call
+void WriteChromeTrace(std::ostream& output);
+
+}
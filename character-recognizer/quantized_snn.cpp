@@ -0,0 +1,183 @@
+#include "quantized_snn.h"
+#include "kernels.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+
+namespace {
+
+// Levels of the quantized weights and layer inputs
+constexpr float weight_levels = 127.0f;
+constexpr float input_levels = 127.0f;
+
+void QuantizeInputs(const float* values, size_t count, uint8_t* out) {
+    for (size_t i = 0; i < count; ++i) {
+        float value = std::clamp(values[i], 0.0f, 1.0f);
+        out[i] = static_cast<uint8_t>(value * input_levels + 0.5f);
+    }
+}
+
+}
+
+QuantizedSnn::QuantizedSnn(const SnnMemento& memento)
+: h_l_(memento.h_l) {
+    Place(memento.i_n, memento.h_l, memento.h_n, memento.o_n);
+
+    // The padding of rows is zero, the kernels process whole strides
+    auto parameters = std::make_shared<Parameters>();
+    parameters->weights.assign(weights_size_, 0);
+    parameters->scales.resize(rows_size_);
+    parameters->biases.resize(rows_size_);
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const size_t rows = sizes_[l + 1];
+        const size_t cols = sizes_[l];
+        for (size_t i = 0; i < rows; ++i) {
+            const float* row = memento.weights[l].data() + i * cols;
+            float max_abs = 0.0f;
+            for (size_t j = 0; j < cols; ++j) {
+                max_abs = std::max(max_abs, std::abs(row[j]));
+            }
+            const float row_scale = max_abs > 0.0f ? max_abs / weight_levels : 1.0f;
+            int8_t* q = parameters->weights.data() + weight_offsets_[l] + i * strides_[l];
+            for (size_t j = 0; j < cols; ++j) {
+                q[j] = static_cast<int8_t>(std::lround(row[j] / row_scale));
+            }
+            parameters->scales[row_offsets_[l] + i] = row_scale / input_levels;
+            parameters->biases[row_offsets_[l] + i] = memento.biases[l][i];
+        }
+    }
+    weights_ = parameters->weights.data();
+    scales_ = parameters->scales.data();
+    biases_ = parameters->biases.data();
+    storage_ = std::move(parameters);
+}
+
+QuantizedSnn::QuantizedSnn(size_t i_n, size_t h_l, size_t h_n, size_t o_n, const int8_t* weights,
+                           const float* scales, const float* biases,
+                           std::shared_ptr<const void> storage)
+: h_l_(h_l)
+, storage_(std::move(storage))
+, weights_(weights)
+, scales_(scales)
+, biases_(biases) {
+    Place(i_n, h_l, h_n, o_n);
+}
+
+void QuantizedSnn::Place(size_t i_n, size_t h_l, size_t h_n, size_t o_n) {
+    const SnnLayout layout(i_n, h_l, h_n, o_n);
+    for (size_t l = 0; l < h_l + 2; ++l) {
+        sizes_.push_back(layout.LayerSize(l));
+        strides_.push_back(AlignedSize<int8_t>(sizes_[l]));
+    }
+    for (size_t l = 0; l < h_l + 1; ++l) {
+        weight_offsets_.push_back(weights_size_);
+        row_offsets_.push_back(rows_size_);
+        weights_size_ += sizes_[l + 1] * strides_[l];
+        rows_size_ += sizes_[l + 1];
+    }
+}
+
+QuantizedWorkspace QuantizedSnn::CreateWorkspace() const {
+    QuantizedWorkspace workspace;
+    workspace.inputs.assign(*std::max_element(strides_.begin(), strides_.end()), 0);
+    workspace.outputs.assign(*std::max_element(sizes_.begin(), sizes_.end()), 0.0f);
+    return workspace;
+}
+
+void QuantizedSnn::Infer(std::span<const float> input, QuantizedWorkspace& workspace,
+                         std::span<float> output) const noexcept {
+    assert(input.size() == sizes_[0]);
+    assert(output.size() == sizes_[h_l_ + 1]);
+    const kernels::Int8KernelSet& k = kernels::ActiveInt8();
+
+    uint8_t* inputs = workspace.inputs.data();
+    float* outputs = workspace.outputs.data();
+    QuantizeInputs(input.data(), input.size(), inputs);
+    std::fill(inputs + sizes_[0], inputs + strides_[0], 0);
+
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const size_t rows = sizes_[l + 1];
+        const size_t stride = strides_[l];
+        const int8_t* weights = weights_ + weight_offsets_[l];
+        const float* scales = scales_ + row_offsets_[l];
+        const float* biases = biases_ + row_offsets_[l];
+
+        int32_t sums[4];
+        size_t i = 0;
+        for (; i + 4 <= rows; i += 4) {
+            k.dot4(inputs, weights + i * stride, stride, sums, stride);
+            for (size_t r = 0; r < 4; ++r) {
+                outputs[i + r] = sums[r] * scales[i + r] + biases[i + r];
+            }
+        }
+        for (; i < rows; ++i) {
+            outputs[i] = k.dot(inputs, weights + i * stride, stride) * scales[i] + biases[i];
+        }
+        for (i = 0; i < rows; ++i) {
+            outputs[i] = 1.0f / (1.0f + std::exp(-outputs[i])); // sigmoid activation
+        }
+
+        if (l < h_l_) {
+            // The inputs of the next layer, its padding must be zero
+            QuantizeInputs(outputs, rows, inputs);
+            std::fill(inputs + rows, inputs + strides_[l + 1], 0);
+        }
+    }
+    std::copy(outputs, outputs + output.size(), output.begin());
+}
+
+size_t QuantizedSnn::GetParameterBytes() const {
+    return weights_size_ * sizeof(int8_t) + rows_size_ * 2 * sizeof(float);
+}
+
+size_t QuantizedSnn::LayerSize(size_t l) const {
+    assert(l < sizes_.size());
+    return sizes_[l];
+}
+
+size_t QuantizedSnn::GetHiddenLayers() const {
+    return h_l_;
+}
+
+std::span<const int8_t> QuantizedSnn::GetWeights() const {
+    return {weights_, weights_size_};
+}
+
+std::span<const float> QuantizedSnn::GetScales() const {
+    return {scales_, rows_size_};
+}
+
+std::span<const float> QuantizedSnn::GetBiases() const {
+    return {biases_, rows_size_};
+}
+
+namespace tests {
+
+void QuantizedInferenceIsClose() {
+    Snn snn(1024, 2, 128, 10);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    const QuantizedSnn quantized(snn.CreateMemento());
+
+    std::default_random_engine e2(42);
+    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
+    std::vector<float> input(1024);
+    std::vector<float> expected(10);
+    std::vector<float> output(10);
+    SnnWorkspace workspace = snn.CreateWorkspace();
+    QuantizedWorkspace quantized_workspace = quantized.CreateWorkspace();
+    for (size_t t = 0; t < 10; ++t) {
+        for (float& value : input) {
+            value = dist(e2);
+        }
+        snn.Infer(input, workspace, expected);
+        quantized.Infer(input, quantized_workspace, output);
+        for (size_t i = 0; i < 10; ++i) {
+            assert(std::abs(output[i] - expected[i]) < 0.05f);
+        }
+    }
+}
+
+}
@@ -0,0 +1,83 @@
+#pragma once
+
+#include "aligned_allocator.h"
+#include "snn.h"
+
+#include <cstdint>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Buffers of one caller of QuantizedSnn::Infer
+class QuantizedWorkspace {
+public:
+    AlignedVector<uint8_t> inputs; // quantized inputs of the current layer
+    std::vector<float> outputs; // outputs of the current layer
+};
+
+// Network with int8 weights for inference, made from a trained Snn
+// (post-training quantization). Every weight row has its own scale:
+// w = q * scale, where q is in [-127, 127]. The inputs of every layer
+// (pixels and sigmoid outputs, all in [0, 1]) are quantized to 0..127,
+// so the pmaddubsw products can't saturate, and the layers are integer
+// dot products. Biases and the sigmoid stay float
+class QuantizedSnn {
+public:
+    explicit QuantizedSnn(const SnnMemento& memento);
+
+    // Network that uses the parameters in place, without copying.
+    // They must be placed as in GetWeights, GetScales and GetBiases,
+    // the storage keeps them alive
+    QuantizedSnn(size_t i_n, size_t h_l, size_t h_n, size_t o_n, const int8_t* weights,
+                 const float* scales, const float* biases, std::shared_ptr<const void> storage);
+
+    QuantizedWorkspace CreateWorkspace() const;
+
+    // Thread-safe like Snn::Infer, if every caller has its own workspace
+    void Infer(std::span<const float> input, QuantizedWorkspace& workspace,
+               std::span<float> output) const noexcept;
+
+    // Size of the weights, scales and biases in bytes
+    size_t GetParameterBytes() const;
+
+    // Size of layer l (l == 0 is the input layer, l == h_l + 1 is the output layer)
+    size_t LayerSize(size_t l) const;
+    size_t GetHiddenLayers() const;
+
+    // Rows of the weights of all layers, each row is padded with zeros
+    // to the aligned size of the previous layer
+    std::span<const int8_t> GetWeights() const;
+    // Values of the rows of all layers, in the order of the weight rows
+    std::span<const float> GetScales() const;
+    std::span<const float> GetBiases() const;
+
+private:
+    struct Parameters {
+        AlignedVector<int8_t> weights;
+        std::vector<float> scales;
+        std::vector<float> biases;
+    };
+
+    // Calculates the placement of the parameters
+    void Place(size_t i_n, size_t h_l, size_t h_n, size_t o_n);
+
+    size_t h_l_;
+    std::vector<size_t> sizes_; // sizes of layers
+    std::vector<size_t> strides_; // aligned sizes of layers (rows of weights)
+    std::vector<size_t> weight_offsets_;
+    std::vector<size_t> row_offsets_; // offsets of the layers in scales and biases
+    size_t weights_size_ = 0;
+    size_t rows_size_ = 0;
+
+    std::shared_ptr<const void> storage_;
+    const int8_t* weights_ = nullptr;
+    // Scale of the integer dot product of a row: row scale / 127
+    const float* scales_ = nullptr;
+    const float* biases_ = nullptr;
+};
+
+namespace tests {
+
+void QuantizedInferenceIsClose();
+
+}
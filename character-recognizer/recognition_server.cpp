@@ -0,0 +1,534 @@
+#include "recognition_server.h"
+#include "thread_pool.h"
+#include "training_database.h"
+
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <climits>
+#include <cstring>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <unordered_map>
+
+#if defined(__unix__) || defined(__APPLE__)
+    #define RECOGNITION_SERVER_POSIX
+    #include <fcntl.h>
+    #include <poll.h>
+    #include <sys/socket.h>
+    #include <sys/stat.h>
+    #include <sys/un.h>
+    #include <unistd.h>
+    #include <cerrno>
+#endif
+
+using namespace std::literals;
+
+#ifdef RECOGNITION_SERVER_POSIX
+
+namespace {
+
+using Clock = std::chrono::steady_clock;
+
+// The rest of a request must arrive and a response must be taken so soon,
+// else the connection is closed
+constexpr std::chrono::seconds request_timeout{10};
+
+#ifdef MSG_NOSIGNAL
+constexpr int send_flags = MSG_NOSIGNAL; // a closed peer is an error, not SIGPIPE
+#else
+constexpr int send_flags = 0; // SO_NOSIGPIPE is set on the connections
+#endif
+
+// Frame size field and the type or status byte
+constexpr size_t frame_header_size = 4;
+// Status, class, recognized flag and the scores
+constexpr size_t ok_response_size = 3 + RecognitionServer::score_count * 4;
+
+uint32_t ReadLe32(const uint8_t* data) {
+    return static_cast<uint32_t>(data[0]) | static_cast<uint32_t>(data[1]) << 8
+        | static_cast<uint32_t>(data[2]) << 16 | static_cast<uint32_t>(data[3]) << 24;
+}
+
+void WriteLe32(uint8_t* data, uint32_t value) {
+    for (size_t i = 0; i < 4; ++i) {
+        data[i] = static_cast<uint8_t>(value >> (8 * i));
+    }
+}
+
+// Of the blocking sockets of the test clients.
+// Returns false if the connection is closed or broken
+bool ReceiveAll(int fd, uint8_t* data, size_t size) {
+    while (size > 0) {
+        ssize_t received = recv(fd, data, size, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received <= 0) {
+            return false;
+        }
+        data += received;
+        size -= static_cast<size_t>(received);
+    }
+    return true;
+}
+
+// Returns false if the connection is closed, broken or the data
+// isn't taken by the deadline (a past one allows no waiting)
+bool SendAll(int fd, const uint8_t* data, size_t size, Clock::time_point deadline) {
+    while (size > 0) {
+        ssize_t sent = send(fd, data, size, send_flags);
+        if (sent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(deadline - Clock::now());
+            if (left.count() <= 0) {
+                return false;
+            }
+            pollfd writable{fd, POLLOUT, 0};
+            poll(&writable, 1, static_cast<int>(std::min<int64_t>(left.count(), INT_MAX)));
+            continue;
+        }
+        if (sent <= 0) {
+            return false;
+        }
+        data += sent;
+        size -= static_cast<size_t>(sent);
+    }
+    return true;
+}
+
+bool SendFailure(int fd, std::string_view message, Clock::time_point deadline) {
+    std::vector<uint8_t> frame(frame_header_size + 1 + message.size());
+    WriteLe32(frame.data(), static_cast<uint32_t>(1 + message.size()));
+    frame[frame_header_size] = RecognitionServer::FAILURE;
+    std::memcpy(frame.data() + frame_header_size + 1, message.data(), message.size());
+    return SendAll(fd, frame.data(), frame.size(), deadline);
+}
+
+void SetNonBlocking(int fd, bool non_blocking) {
+    int flags = fcntl(fd, F_GETFL);
+    flags = non_blocking ? flags | O_NONBLOCK : flags & ~O_NONBLOCK;
+    fcntl(fd, F_SETFL, flags);
+}
+
+}
+
+RecognitionServer::RecognitionServer(const std::filesystem::path& socket_path, size_t workers,
+                                     const Snn* snn, const QuantizedSnn* quantized)
+: socket_path_(socket_path)
+, workers_(workers)
+, snn_(snn)
+, quantized_(quantized) {
+    assert(workers > 0);
+    assert(snn || quantized);
+
+    auto fail = [this](const std::string& message) {
+        for (int fd : {listen_fd_, wake_read_fd_, wake_write_fd_}) {
+            if (fd >= 0) {
+                close(fd);
+            }
+        }
+        throw std::runtime_error(message);
+    };
+
+    sockaddr_un address{};
+    address.sun_family = AF_UNIX;
+    const std::string path = socket_path_.string();
+    if (path.empty() || path.size() >= sizeof(address.sun_path)) {
+        fail("Socket path "s + path + " is empty or too long"s);
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size() + 1);
+
+    // A socket of a stopped server is replaced, other files are kept
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    listen_fd_ = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listen_fd_ < 0) {
+        fail("Unable to create a socket"s);
+    }
+    if (bind(listen_fd_, reinterpret_cast<const sockaddr*>(&address), sizeof(address)) != 0) {
+        fail("Unable to bind socket "s + path);
+    }
+    if (listen(listen_fd_, SOMAXCONN) != 0) {
+        unlink(path.c_str());
+        fail("Unable to listen on socket "s + path);
+    }
+    // Pending connections are accepted until it would block
+    SetNonBlocking(listen_fd_, true);
+
+    int wake_fds[2];
+    if (pipe(wake_fds) != 0) {
+        unlink(path.c_str());
+        fail("Unable to create a pipe"s);
+    }
+    wake_read_fd_ = wake_fds[0];
+    wake_write_fd_ = wake_fds[1];
+    SetNonBlocking(wake_read_fd_, true);
+    SetNonBlocking(wake_write_fd_, true);
+}
+
+RecognitionServer::~RecognitionServer() {
+    for (int fd : {listen_fd_, wake_read_fd_, wake_write_fd_}) {
+        close(fd);
+    }
+}
+
+void RecognitionServer::Run() {
+    WorkStealingPool pool(workers_);
+    std::vector<WorkerBuffers> buffers(workers_);
+    for (auto& worker : buffers) {
+        worker.input.resize(pixel_count);
+        worker.scores.resize(score_count);
+        if (quantized_) {
+            worker.quantized_workspace = quantized_->CreateWorkspace();
+        } else {
+            worker.workspace = snn_->CreateWorkspace();
+        }
+    }
+
+    // The pipe, the listening socket, then the connections that wait for
+    // the rest of a request. A connection is not watched while a worker
+    // serves its request, the connections keep their addresses meanwhile
+    std::unordered_map<int, Connection> connections;
+    std::vector<pollfd> fds = {{wake_read_fd_, POLLIN, 0}, {listen_fd_, POLLIN, 0}};
+    auto close_connection = [&connections](int fd) {
+        close(fd);
+        connections.erase(fd);
+    };
+    while (!stop_) {
+        // Wake up by the nearest deadline of a partial request
+        Clock::time_point nearest = Clock::time_point::max();
+        for (size_t i = 2; i < fds.size(); ++i) {
+            const Connection& connection = connections.at(fds[i].fd);
+            if (connection.received > 0) {
+                nearest = std::min(nearest, connection.deadline);
+            }
+        }
+        int timeout = -1;
+        if (nearest != Clock::time_point::max()) {
+            const auto left = std::chrono::ceil<std::chrono::milliseconds>(nearest - Clock::now());
+            timeout = static_cast<int>(std::clamp<int64_t>(left.count(), 0, INT_MAX));
+        }
+        if (poll(fds.data(), fds.size(), timeout) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            throw std::runtime_error("Unable to wait for the clients of "s + socket_path_.string());
+        }
+
+        // Complete requests go to the workers
+        const Clock::time_point now = Clock::now();
+        size_t kept = 2;
+        for (size_t i = 2; i < fds.size(); ++i) {
+            const int fd = fds[i].fd;
+            Connection& connection = connections.at(fd);
+            const FrameState state = fds[i].revents == 0 ? FrameState::PARTIAL : ReceiveFrame(connection);
+            if (state == FrameState::COMPLETE) {
+                pool.Submit([this, &connection, &buffers](size_t worker) {
+                    const bool keep = ServeRequest(connection, buffers[worker]);
+                    // The next request starts from the size field
+                    connection.received = 0;
+                    connection.frame.resize(frame_header_size);
+                    ReturnConnection(connection.fd, keep);
+                });
+            } else if (state == FrameState::CLOSED
+                       || (connection.received > 0 && connection.deadline <= now)) {
+                close_connection(fd);
+            } else {
+                fds[kept++] = fds[i];
+            }
+        }
+        fds.resize(kept);
+
+        if (fds[0].revents & POLLIN) {
+            uint8_t bytes[64];
+            while (read(wake_read_fd_, bytes, sizeof(bytes)) > 0) {
+            }
+            std::lock_guard lock(mutex_);
+            for (auto [fd, keep] : returned_) {
+                if (keep) {
+                    fds.push_back({fd, POLLIN, 0});
+                } else {
+                    close_connection(fd);
+                }
+            }
+            returned_.clear();
+        }
+
+        if (fds[1].revents & POLLIN) {
+            int fd;
+            while ((fd = accept(listen_fd_, nullptr, nullptr)) >= 0) {
+                // Only the dispatcher waits for the clients
+                SetNonBlocking(fd, true);
+#ifdef SO_NOSIGPIPE
+                int on = 1;
+                setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+                Connection& connection = connections[fd];
+                connection.fd = fd;
+                connection.frame.resize(frame_header_size);
+                fds.push_back({fd, POLLIN, 0});
+            }
+        }
+    }
+
+    pool.Wait();
+    for (const auto& [fd, connection] : connections) {
+        close(fd);
+    }
+    {
+        std::lock_guard lock(mutex_);
+        returned_.clear();
+    }
+    unlink(socket_path_.c_str());
+}
+
+void RecognitionServer::Stop() noexcept {
+    stop_ = true;
+    Wake();
+}
+
+RecognitionServer::FrameState RecognitionServer::ReceiveFrame(Connection& connection) {
+    std::vector<uint8_t>& frame = connection.frame;
+    while (true) {
+        // The size field first, then the rest of the frame
+        if (connection.received == frame.size()) {
+            if (connection.received > frame_header_size) {
+                return FrameState::COMPLETE;
+            }
+            const uint32_t size = ReadLe32(frame.data());
+            if (size == 0 || size > max_frame_size) {
+                // The dispatcher doesn't wait for a client that doesn't read
+                SendFailure(connection.fd, "Frame size "s + std::to_string(size) + " is not supported"s,
+                            Clock::time_point());
+                return FrameState::CLOSED;
+            }
+            frame.resize(frame_header_size + size);
+        }
+        ssize_t received = recv(connection.fd, frame.data() + connection.received,
+                                frame.size() - connection.received, 0);
+        if (received < 0 && errno == EINTR) {
+            continue;
+        }
+        if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            return FrameState::PARTIAL;
+        }
+        if (received <= 0) {
+            return FrameState::CLOSED;
+        }
+        if (connection.received == 0) {
+            connection.deadline = Clock::now() + request_timeout;
+        }
+        connection.received += static_cast<size_t>(received);
+    }
+}
+
+bool RecognitionServer::ServeRequest(Connection& connection, WorkerBuffers& buffers) const {
+    const int fd = connection.fd;
+    const Clock::time_point deadline = Clock::now() + request_timeout;
+    const std::span<const uint8_t> frame(connection.frame.data() + frame_header_size,
+                                         connection.received - frame_header_size);
+
+    const std::span<const uint8_t> payload = frame.subspan(1);
+    try {
+        switch (frame[0]) {
+            case PATH: {
+                const std::string path(reinterpret_cast<const char*>(payload.data()), payload.size());
+                buffers.loader.Load(path, buffers.input);
+                break;
+            }
+            case PIXELS:
+                if (payload.size() != pixel_count) {
+                    SendFailure(fd, "Pixels request must have "s + std::to_string(pixel_count)
+                                + " bytes"s, deadline);
+                    return false;
+                }
+                for (size_t i = 0; i < pixel_count; ++i) {
+                    buffers.input[i] = payload[i] * sample_scale;
+                }
+                break;
+            default:
+                SendFailure(fd, "Request type "s + std::to_string(frame[0])
+                            + " is not supported"s, deadline);
+                return false;
+        }
+    } catch (const std::exception& e) {
+        // The request is answered, the connection is kept
+        return SendFailure(fd, e.what(), deadline);
+    }
+
+    if (quantized_) {
+        quantized_->Infer(buffers.input, buffers.quantized_workspace, buffers.scores);
+    } else {
+        snn_->Infer(buffers.input, buffers.workspace, buffers.scores);
+    }
+
+    uint8_t response[frame_header_size + ok_response_size];
+    WriteLe32(response, ok_response_size);
+    auto it = std::max_element(buffers.scores.begin(), buffers.scores.end());
+    response[frame_header_size] = OK;
+    response[frame_header_size + 1] = static_cast<uint8_t>(it - buffers.scores.begin());
+    response[frame_header_size + 2] = *it > 0.50f ? 1 : 0;
+    for (size_t i = 0; i < score_count; ++i) {
+        WriteLe32(response + frame_header_size + 3 + i * 4, std::bit_cast<uint32_t>(buffers.scores[i]));
+    }
+    return SendAll(fd, response, sizeof(response), deadline);
+}
+
+void RecognitionServer::ReturnConnection(int fd, bool keep) {
+    {
+        std::lock_guard lock(mutex_);
+        returned_.emplace_back(fd, keep);
+    }
+    Wake();
+}
+
+void RecognitionServer::Wake() noexcept {
+    // If the pipe is full, the dispatcher is going to wake up anyway
+    const uint8_t byte = 0;
+    [[maybe_unused]] ssize_t written = write(wake_write_fd_, &byte, 1);
+}
+
+#else
+
+RecognitionServer::RecognitionServer(const std::filesystem::path& socket_path, size_t workers,
+                                     const Snn* snn, const QuantizedSnn* quantized)
+: socket_path_(socket_path)
+, workers_(workers)
+, snn_(snn)
+, quantized_(quantized) {
+    throw std::runtime_error("Unix domain sockets are not supported on this platform"s);
+}
+
+RecognitionServer::~RecognitionServer() = default;
+
+void RecognitionServer::Run() {
+}
+
+void RecognitionServer::Stop() noexcept {
+}
+
+#endif
+
+namespace tests {
+
+void ServerAnswersClients() {
+#ifdef RECOGNITION_SERVER_POSIX
+    Snn snn(1024, 2, 32, 10);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+
+    const std::filesystem::path socket_path =
+        std::filesystem::temp_directory_path() / "recognition_server_test.sock";
+    RecognitionServer server(socket_path, 2, &snn);
+    std::thread runner([&server]() {
+        server.Run();
+    });
+
+    auto connect_client = [&socket_path]() {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        assert(fd >= 0);
+        sockaddr_un address{};
+        address.sun_family = AF_UNIX;
+        std::strcpy(address.sun_path, socket_path.c_str());
+        [[maybe_unused]] int result = connect(fd, reinterpret_cast<const sockaddr*>(&address), sizeof(address));
+        assert(result == 0);
+        return fd;
+    };
+    auto request = [](int fd, uint8_t type, std::span<const uint8_t> payload) {
+        std::vector<uint8_t> frame(frame_header_size + 1);
+        WriteLe32(frame.data(), static_cast<uint32_t>(1 + payload.size()));
+        frame[frame_header_size] = type;
+        frame.insert(frame.end(), payload.begin(), payload.end());
+        [[maybe_unused]] bool sent = SendAll(fd, frame.data(), frame.size(), Clock::now() + request_timeout);
+        assert(sent);
+        uint8_t header[frame_header_size];
+        [[maybe_unused]] bool received = ReceiveAll(fd, header, frame_header_size);
+        assert(received);
+        std::vector<uint8_t> response(ReadLe32(header));
+        received = ReceiveAll(fd, response.data(), response.size());
+        assert(received);
+        return response;
+    };
+
+    // Concurrent clients, more of them than workers, each with many requests
+    std::vector<std::thread> clients;
+    for (int c = 0; c < 6; ++c) {
+        clients.emplace_back([&, c]() {
+            const int fd = connect_client();
+            SnnWorkspace workspace = snn.CreateWorkspace();
+            std::vector<uint8_t> pixels(RecognitionServer::pixel_count);
+            std::vector<float> input(RecognitionServer::pixel_count);
+            std::vector<float> expected(RecognitionServer::score_count);
+            for (int r = 0; r < 20; ++r) {
+                for (size_t i = 0; i < pixels.size(); ++i) {
+                    pixels[i] = static_cast<uint8_t>(i * 7 + r * 31 + c * 101);
+                    input[i] = pixels[i] * sample_scale;
+                }
+                snn.Infer(input, workspace, expected);
+                const std::vector<uint8_t> response = request(fd, RecognitionServer::PIXELS, pixels);
+                assert(response.size() == ok_response_size);
+                assert(response[0] == RecognitionServer::OK);
+                [[maybe_unused]] auto it = std::max_element(expected.begin(), expected.end());
+                assert(response[1] == it - expected.begin());
+                assert(response[2] == (*it > 0.50f ? 1 : 0));
+                for (size_t i = 0; i < expected.size(); ++i) {
+                    assert(std::bit_cast<float>(ReadLe32(response.data() + 3 + i * 4)) == expected[i]);
+                }
+            }
+            close(fd);
+        });
+    }
+    for (auto& client : clients) {
+        client.join();
+    }
+
+    // A file that cannot be read is an error, the connection stays open
+    const int fd = connect_client();
+    const std::string missing = (std::filesystem::temp_directory_path()
+                                 / "recognition_server_missing.bmp").string();
+    std::vector<uint8_t> response = request(fd, RecognitionServer::PATH,
+        {reinterpret_cast<const uint8_t*>(missing.data()), missing.size()});
+    assert(response[0] == RecognitionServer::FAILURE);
+    const std::vector<uint8_t> pixels(RecognitionServer::pixel_count, 128);
+    response = request(fd, RecognitionServer::PIXELS, pixels);
+    assert(response[0] == RecognitionServer::OK);
+
+    // A malformed request closes the connection after the error
+    response = request(fd, RecognitionServer::PIXELS, {pixels.data(), 10});
+    assert(response[0] == RecognitionServer::FAILURE);
+    [[maybe_unused]] uint8_t byte;
+    assert(recv(fd, &byte, 1, 0) == 0);
+    close(fd);
+
+    // Clients that send parts of requests, one per worker, don't hold the workers
+    std::vector<int> stalled;
+    for (int c = 0; c < 2; ++c) {
+        stalled.push_back(connect_client());
+        const uint8_t part[3] = {};
+        [[maybe_unused]] bool sent = SendAll(stalled.back(), part, sizeof(part), Clock::now());
+        assert(sent);
+    }
+    const int served = connect_client();
+    [[maybe_unused]] const Clock::time_point start = Clock::now();
+    response = request(served, RecognitionServer::PIXELS, pixels);
+    assert(response[0] == RecognitionServer::OK && Clock::now() - start < request_timeout / 2);
+    close(served);
+    for (int stalled_fd : stalled) {
+        close(stalled_fd);
+    }
+
+    server.Stop();
+    runner.join();
+    assert(!std::filesystem::exists(socket_path));
+#endif
+}
+
+}
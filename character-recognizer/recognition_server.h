@@ -0,0 +1,120 @@
+#pragma once
+
+#include "glyph_loader.h"
+#include "quantized_snn.h"
+#include "snn.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+// Server that keeps a loaded network and recognizes glyphs sent over
+// a Unix domain socket. Clients keep their connections and send
+// requests one after another, every request gets one response.
+//
+// All integers and floats are little-endian. A frame is a uint32
+// size of the rest of the frame, followed by a type or status byte:
+//   request  1 (path)   - UTF-8 path of an image file readable by the server
+//            2 (pixels) - 1024 bytes of a 32x32 glyph, rows from the top,
+//                         input values are byte * sample_scale (gray levels)
+//   response 0 (ok)     - uint8 class (index of the greatest score),
+//                         uint8 1 if the class is recognized (score > 0.5),
+//                         10 float32 scores
+//            1 (error)  - UTF-8 message
+// A request that cannot be processed (e.g. the file cannot be read) gets
+// an error response. After a malformed frame the connection is closed.
+//
+// One thread waits for new connections and reads the requests without
+// blocking, a complete request is recognized and answered by a fixed pool
+// of workers, so many clients are served by a few threads. A request must
+// arrive and its response must be taken within a timeout, slow clients
+// are disconnected
+
+class RecognitionServer {
+public:
+    enum RequestType : uint8_t {
+        PATH = 1,
+        PIXELS = 2
+    };
+
+    enum Status : uint8_t {
+        OK = 0,
+        FAILURE = 1
+    };
+
+    static constexpr size_t pixel_count = 1024;
+    static constexpr size_t score_count = 10;
+    static constexpr size_t max_frame_size = 64 * 1024;
+
+    // The networks must live longer than the server, the int8
+    // one is used if it is given, else the float one. Creates the socket
+    // file (an old socket left there is replaced) and starts listening
+    RecognitionServer(const std::filesystem::path& socket_path, size_t workers,
+                      const Snn* snn, const QuantizedSnn* quantized = nullptr);
+    ~RecognitionServer();
+
+    RecognitionServer(const RecognitionServer&) = delete;
+    RecognitionServer& operator=(const RecognitionServer&) = delete;
+
+    // Serves the clients until Stop is called, then
+    // closes the connections and removes the socket file
+    void Run();
+
+    // Can be called from any thread and from a signal handler
+    void Stop() noexcept;
+
+private:
+    std::filesystem::path socket_path_;
+    size_t workers_;
+    const Snn* snn_;
+    const QuantizedSnn* quantized_;
+
+    int listen_fd_ = -1;
+    int wake_read_fd_ = -1; // the dispatcher is woken up by writes to the pipe
+    int wake_write_fd_ = -1;
+    std::atomic<bool> stop_ = false;
+
+    // Connections whose requests are answered and whether to keep them
+    std::mutex mutex_;
+    std::vector<std::pair<int, bool>> returned_;
+
+    // A connection and the frame of its current request
+    struct Connection {
+        int fd = -1;
+        std::vector<uint8_t> frame; // the size field, then the rest of the frame
+        size_t received = 0;
+        std::chrono::steady_clock::time_point deadline; // of the rest of the request
+    };
+
+    enum class FrameState {
+        PARTIAL,
+        COMPLETE,
+        CLOSED // closed, broken or malformed
+    };
+
+    // Buffers of one worker
+    struct WorkerBuffers {
+        GlyphLoader loader;
+        std::vector<float> input;
+        std::vector<float> scores;
+        SnnWorkspace workspace;
+        QuantizedWorkspace quantized_workspace;
+    };
+
+    // Reads what has arrived of the request without blocking
+    static FrameState ReceiveFrame(Connection& connection);
+    // Answers the complete request. Returns false if the connection must be closed
+    bool ServeRequest(Connection& connection, WorkerBuffers& buffers) const;
+    void ReturnConnection(int fd, bool keep);
+    void Wake() noexcept;
+};
+
+namespace tests {
+
+void ServerAnswersClients();
+
+}
@@ -1,16 +1,49 @@
 #include "request_handler.h"
+#include "allocation_counter.h"
+#include "bmp_image.h"
+#include "checkpoint_writer.h"
+#include "glyph_bundle.h"
+#include "image_prefetcher.h"
 #include "snn.h"
+#include "kernels.h"
+#include "profiler.h"
 #include "state_saver.h"
 #include "training_database.h"
+#include "zip_archive.h"
 
 #include <algorithm>
+#include <array>
+#include <barrier>
+#include <chrono>
+#include <cmath>
 #include <cassert>
+#include <csignal>
+#include <fstream>
+#include <future>
 #include <iomanip>
 #include <iostream>
+#include <sstream>
+#include <streambuf>
+#include <thread>
+#include <type_traits>
 #include <vector>
 
 using namespace std::literals;
 
+// Consecutive images of a folder are recognized together
+constexpr size_t recognition_batch_size = 64;
+
+namespace {
+
+// Server stopped by SIGINT and SIGTERM
+RecognitionServer* signalled_server = nullptr;
+
+void StopServer(int) {
+    signalled_server->Stop();
+}
+
+}
+
 void RequestHandler::CreateNewSnn(int hidden_neurons) {
     snn_ = std::make_unique<Snn>(1024, 2, hidden_neurons, 10);
     snn_->InitializeBiasesWithRandom();
@@ -23,16 +56,47 @@ void RequestHandler::LoadSnn(const std::filesystem::path& snn_data_path) {
     snn_ = std::make_unique<Snn>(snn_state);
 }
 
+void RequestHandler::MapSnn(const std::filesystem::path& snn_data_path) {
+    if (IsQuantizedSnnState(snn_data_path)) {
+        snn_.reset();
+        quantized_snn_ = MapQuantizedSnnState(snn_data_path);
+    } else {
+        snn_ = MapSnnState(snn_data_path);
+        quantized_snn_.reset();
+    }
+}
+
 void RequestHandler::SaveSnn(const std::filesystem::path& path_to_save) const {
     assert(snn_);
-    SnnMemento snn_state = snn_->CreateMemento();
-    SaveSnnState(path_to_save, snn_state);
+    SaveSnnState(path_to_save, *snn_);
+}
+
+void RequestHandler::QuantizeSnn() {
+    if (snn_) {
+        quantized_snn_ = std::make_unique<QuantizedSnn>(snn_->CreateMemento());
+    }
+    assert(quantized_snn_);
 }
 
-void RequestHandler::LoadDb(const std::filesystem::path& db_path) {
+void RequestHandler::SaveQuantizedSnn(const std::filesystem::path& path_to_save) const {
+    assert(quantized_snn_);
+    SaveQuantizedSnnState(path_to_save, *quantized_snn_);
+}
+
+void RequestHandler::LoadDb(const std::filesystem::path& db_path,
+                            const std::filesystem::path& cache_path) {
     normalizer_ = std::make_unique<ImageFileNormalizer>(1024);
     db_ = std::make_unique<TrainingDatabase>(normalizer_.get());
-    db_->BuildFromFolder(db_path);
+    if (GlyphBundle::IsBundle(db_path)) {
+        db_->BuildFromBundle(db_path);
+    } else if (ZipArchive::IsZip(db_path)) {
+        db_->SetThreads(threads_);
+        db_->BuildFromZip(db_path);
+    } else {
+        db_->SetCacheFile(cache_path);
+        db_->SetThreads(threads_);
+        db_->BuildFromFolder(db_path);
+    }
 
     const TrainingDatabase::CharsDict& dict = db_->GetCharsDictionary();
     for (auto& it : dict) {
@@ -47,86 +111,955 @@ void RequestHandler::SetAlgorithm(Algorithm algorithm) {
     algorithm_ = algorithm;
 }
 
+void RequestHandler::SetBatchSize(int batch_size) {
+    assert(batch_size > 0);
+    batch_size_ = batch_size;
+}
+
+void RequestHandler::SetThreads(int threads) {
+    assert(threads > 0);
+    threads_ = threads;
+}
+
+void RequestHandler::SetParallelStrategy(ParallelStrategy strategy) {
+    strategy_ = strategy;
+}
+
+void RequestHandler::SetSigmoid(kernels::Sigmoid sigmoid) {
+    assert(snn_ || quantized_snn_);
+    // The int8 network has its own activation
+    if (snn_) {
+        snn_->SetSigmoid(sigmoid);
+    }
+}
+
+void RequestHandler::SetPrefetch(size_t depth, int readers) {
+    assert(readers > 0);
+    prefetch_depth_ = depth;
+    prefetch_readers_ = readers;
+}
+
+void RequestHandler::SetMetricsFormat(MetricsFormat format) {
+    metrics_format_ = format;
+}
+
+void RequestHandler::SetValidationFraction(double fraction) {
+    assert(fraction >= 0.0 && fraction < 1.0);
+    validation_fraction_ = fraction;
+}
+
+void RequestHandler::SetStoppingCriteria(const StoppingCriteria& criteria) {
+    stopping_ = criteria;
+}
+
+void RequestHandler::SetCheckpoint(const std::filesystem::path& path, int interval) {
+    if (interval < 1) {
+        throw std::invalid_argument("Checkpoint interval must be positive"s);
+    }
+    checkpoint_path_ = path;
+    checkpoint_interval_ = interval;
+}
+
+void RequestHandler::ResumeFromCheckpoint(const std::filesystem::path& path) {
+    Checkpoint checkpoint = LoadCheckpoint(path);
+    std::istringstream engine_state(checkpoint.state.engine);
+    engine_state >> engine_;
+    if (!engine_state) {
+        throw std::runtime_error("Checkpoint "s + path.string() + " has a wrong engine state"s);
+    }
+    snn_ = std::move(checkpoint.snn);
+    resumed_state_ = checkpoint.state;
+    resumed_best_ = std::move(checkpoint.best);
+}
+
 void RequestHandler::Train(int cycles, std::ostream& progress_output) {
+    PROFILE_SCOPE("train");
     assert(db_);
     assert(snn_);
 
-    auto set_unit = [](std::vector<float>& vec, size_t pos) {
-        std::fill(vec.begin(), vec.end(), 0.0f);
-        vec[pos] = 1;
-    };
-
-    auto clear = [](std::vector<float>& vec) {
-        std::fill(vec.begin(), vec.end(), 0.0f);
-    };
+    // Expected outputs: unit vectors for chars, zeros for non-chars
+    std::vector<std::vector<float>> unit_targets(10, std::vector<float>(10, 0.0f));
+    for (size_t number = 0; number < 10; ++number) {
+        unit_targets[number][number] = 1.0f;
+    }
+    const std::vector<float> zero_target(10, 0.0f);
 
-    std::vector<float> resources(10, 0.0f);
+    // Buffers of the training threads
+    std::vector<SnnBatch> batches(threads_);
+    std::vector<Metrics> thread_metrics(threads_);
 
     TrainingDatabase::CharPtrArray char_ptr_array = db_->CreateCharPtrArray();
     const TrainingDatabase::Chars& not_chars = db_->GetNonChars();
-    progress_output << 0;
-    for (int i = 0; i < cycles; ++i) {
+    std::vector<const uint8_t*> non_chars;
+    for (size_t i = 0; i < not_chars.GetCount(); ++i) {
+        non_chars.push_back(not_chars.GetSample(i));
+    }
+    Samples validation;
+    if (validation_fraction_ > 0.0) {
+        SplitValidation(char_ptr_array, non_chars, validation, unit_targets, zero_target);
+    }
+    // Evaluation of the previous epoch and its network,
+    // it runs during the current epoch
+    std::future<Metrics> validation_metrics;
+    std::shared_ptr<const Snn> validation_snn;
+    auto start_validation = [&]() {
+        validation_snn = std::make_shared<const Snn>(snn_->CreateSnapshot());
+        validation_metrics = std::async(std::launch::async, [snapshot = validation_snn, &validation]() {
+            return Evaluate(*snapshot, validation);
+        });
+    };
+    BestSnn best;
+    if (resumed_best_) {
+        best = {resumed_state_.best_value, resumed_state_.best_epoch, resumed_best_};
+    }
+    bool stop = false;
+    auto finish_validation = [&](int epoch) {
+        if (validation_metrics.valid()) {
+            Metrics metrics = validation_metrics.get();
+            if (metrics_format_ != COUNTER) {
+                PrintValidation(epoch, metrics, progress_output);
+            }
+            auto snapshot = [&validation_snn]() {
+                return std::move(validation_snn);
+            };
+            stop = ObserveEpoch(epoch, metrics, snapshot, best) || stop;
+        }
+    };
+
+    // Checkpoints are written by another thread, the network is copied
+    std::unique_ptr<CheckpointWriter> checkpoint_writer;
+    if (!checkpoint_path_.empty()) {
+        checkpoint_writer = std::make_unique<CheckpointWriter>(checkpoint_path_);
+    }
+
+    int epoch = resumed_state_.epoch;
+    if (epoch > 0 && !validation.inputs.empty()) {
+        // The resumed network hasn't been evaluated, if the checkpoint
+        // was written before its validation was finished
+        start_validation();
+    }
+
+    // Every epoch shuffles the initial order, so the order
+    // of an epoch depends only on the state of the engine
+    TrainingDatabase::CharPtrArray epoch_chars;
+    Samples samples;
+    if (metrics_format_ == COUNTER) {
+        progress_output << epoch;
+    }
+    while (epoch < cycles && !stop) {
+        PROFILE_SCOPE("cycle");
+        const auto start_time = std::chrono::steady_clock::now();
+        epoch_chars.assign(char_ptr_array.begin(), char_ptr_array.end());
         if (algorithm_ == SHUFFLED || algorithm_ == SHUFFLED_WITH_NOT_SYM) {
-            TrainingDatabase::ShuffleCharPtrArray(char_ptr_array);
+            PROFILE_SCOPE("shuffle");
+            TrainingDatabase::ShuffleCharPtrArray(epoch_chars, engine_);
         }
-        for (auto [c, vec_ptr] : char_ptr_array) {
+        samples.inputs.clear();
+        samples.targets.clear();
+        for (auto [c, sample] : epoch_chars) {
             size_t number = c - '0';
-            snn_->CalculateOutput(*vec_ptr);
-            set_unit(resources, number);
-            snn_->PropagateErrorBack(resources);
-            
-            if (!not_chars.empty() && algorithm_ == SHUFFLED_WITH_NOT_SYM) {
-                auto& ns_vec = not_chars[rand() % not_chars.size()];
-                snn_->CalculateOutput(ns_vec);
-                clear(resources);
-                snn_->PropagateErrorBack(resources);
+            samples.inputs.push_back(sample);
+            samples.targets.push_back(unit_targets[number].data());
+
+            if (!non_chars.empty() && algorithm_ == SHUFFLED_WITH_NOT_SYM) {
+                std::uniform_int_distribution<size_t> non_char_index(0, non_chars.size() - 1);
+                samples.inputs.push_back(non_chars[non_char_index(engine_)]);
+                samples.targets.push_back(zero_target.data());
+            }
+        }
+
+        for (Metrics& metrics : thread_metrics) {
+            metrics = Metrics();
+        }
+        if (threads_ == 1) {
+            TrainSerially(samples, thread_metrics[0]);
+        } else if (strategy_ == HOGWILD) {
+            TrainHogwild(samples, batches, thread_metrics);
+        } else {
+            TrainSynchronously(samples, batches, thread_metrics);
+        }
+        const std::chrono::duration<double> seconds = std::chrono::steady_clock::now() - start_time;
+        ++epoch;
+        Metrics metrics;
+        for (const Metrics& part : thread_metrics) {
+            metrics.Merge(part);
+        }
+
+        finish_validation(epoch - 1);
+        if (!validation.inputs.empty()) {
+            start_validation();
+        }
+        if (metrics_format_ == COUNTER) {
+            progress_output << '\r' << epoch << std::flush;
+        } else {
+            PrintEpoch(epoch, metrics, seconds.count(), progress_output);
+        }
+        if (validation.inputs.empty() && IsStoppingEnabled()) {
+            auto snapshot = [this]() {
+                return std::make_shared<const Snn>(snn_->CreateSnapshot());
+            };
+            stop = ObserveEpoch(epoch, metrics, snapshot, best);
+        }
+        if (checkpoint_writer && (epoch % checkpoint_interval_ == 0 || epoch == cycles || stop)) {
+            std::ostringstream engine_state;
+            engine_state << engine_;
+            checkpoint_writer->Submit(*snn_, {epoch, engine_state.str(), best.epoch, best.value},
+                                      best.snn);
+        }
+    }
+    finish_validation(epoch);
+    if (metrics_format_ == COUNTER) {
+        progress_output << std::endl;
+    }
+    if (checkpoint_writer) {
+        checkpoint_writer->Flush();
+    }
+
+    if (best.snn) {
+        snn_->CopyParameters(*best.snn);
+        if (metrics_format_ == JSON_LINES) {
+            progress_output << "{\"epochs\": "s << epoch << ", \"best_epoch\": "s << best.epoch
+                            << "}"s << std::endl;
+        } else {
+            progress_output << (stop ? "Converged after "s : "Trained "s) << epoch
+                            << " epochs, the network of epoch "s << best.epoch << " is kept"s
+                            << std::endl;
+        }
+    }
+}
+
+bool RequestHandler::IsStoppingEnabled() const {
+    return stopping_.patience > 0 || stopping_.target_accuracy > 0.0;
+}
+
+bool RequestHandler::ObserveEpoch(int epoch, const Metrics& metrics,
+                                  const std::function<std::shared_ptr<const Snn>()>& snapshot,
+                                  BestSnn& best) const {
+    if (!IsStoppingEnabled()) {
+        return false;
+    }
+    const double value = stopping_.monitor == ACCURACY ? metrics.GetAccuracy() : -metrics.GetRmse();
+    const bool reached = stopping_.target_accuracy > 0.0
+        && metrics.GetAccuracy() >= stopping_.target_accuracy;
+    if (!best.snn || value > best.value + stopping_.min_delta || reached) {
+        best = {value, epoch, snapshot()};
+    }
+    return reached || (stopping_.patience > 0 && epoch - best.epoch >= stopping_.patience);
+}
+
+void RequestHandler::SplitValidation(TrainingDatabase::CharPtrArray& chars,
+                                     std::vector<const uint8_t*>& non_chars, Samples& validation,
+                                     const std::vector<std::vector<float>>& unit_targets,
+                                     const std::vector<float>& zero_target) const {
+    // Sample i of n is held out if floor((i + 1) * fraction) > floor(i * fraction),
+    // it gives floor(n * fraction) samples spread over the files
+    auto held_out = [this](size_t i) {
+        return std::floor((i + 1) * validation_fraction_) > std::floor(i * validation_fraction_);
+    };
+
+    // The samples of a char are consecutive in the array
+    TrainingDatabase::CharPtrArray training;
+    size_t index = 0;
+    for (size_t i = 0; i < chars.size(); ++i) {
+        index = (i > 0 && chars[i].first == chars[i - 1].first) ? index + 1 : 0;
+        if (held_out(index)) {
+            validation.inputs.push_back(chars[i].second);
+            validation.targets.push_back(unit_targets[chars[i].first - '0'].data());
+        } else {
+            training.push_back(chars[i]);
+        }
+    }
+    chars = std::move(training);
+
+    std::vector<const uint8_t*> training_non_chars;
+    for (size_t i = 0; i < non_chars.size(); ++i) {
+        if (held_out(i)) {
+            validation.inputs.push_back(non_chars[i]);
+            validation.targets.push_back(zero_target.data());
+        } else {
+            training_non_chars.push_back(non_chars[i]);
+        }
+    }
+    non_chars = std::move(training_non_chars);
+}
+
+RequestHandler::Metrics RequestHandler::Evaluate(const Snn& snn, const Samples& samples) {
+    SnnWorkspace workspace = snn.CreateWorkspace();
+    std::vector<float> input(1024);
+    Scores output;
+    Metrics metrics;
+    for (size_t i = 0; i < samples.inputs.size(); ++i) {
+        std::transform(samples.inputs[i], samples.inputs[i] + 1024, input.begin(),
+                       [](uint8_t value) {
+                           return value * sample_scale;
+                       });
+        snn.Infer(input, workspace, output);
+        metrics.Add(output, {samples.targets[i], 10});
+    }
+    return metrics;
+}
+
+void RequestHandler::Metrics::Add(std::span<const float> output, std::span<const float> target) {
+    float squares = 0.0f;
+    for (size_t i = 0; i < output.size(); ++i) {
+        float delta = target[i] - output[i];
+        squares += delta * delta;
+    }
+    rmse_sum += std::sqrt(squares / output.size());
+
+    auto it = std::max_element(output.begin(), output.end());
+    auto label = std::max_element(target.begin(), target.end());
+    if (*label > 0.0f) {
+        correct += *it > 0.50f && it - output.begin() == label - target.begin();
+    } else {
+        correct += *it <= 0.50f;
+    }
+    ++samples;
+}
+
+void RequestHandler::Metrics::Merge(const Metrics& other) {
+    samples += other.samples;
+    rmse_sum += other.rmse_sum;
+    correct += other.correct;
+}
+
+double RequestHandler::Metrics::GetRmse() const {
+    return samples == 0 ? 0.0 : rmse_sum / samples;
+}
+
+double RequestHandler::Metrics::GetAccuracy() const {
+    return samples == 0 ? 0.0 : static_cast<double>(correct) / samples;
+}
+
+void RequestHandler::PrintEpoch(int epoch, const Metrics& metrics, double seconds,
+                                std::ostream& output) const {
+    const double rate = seconds > 0.0 ? metrics.samples / seconds : 0.0;
+    if (metrics_format_ == JSON_LINES) {
+        output << std::defaultfloat << std::setprecision(6)
+               << "{\"epoch\": "s << epoch << ", \"rmse\": "s << metrics.GetRmse()
+               << ", \"accuracy\": "s << metrics.GetAccuracy()
+               << ", \"samples_per_second\": "s << rate << ", \"seconds\": "s << seconds
+               << "}"s << std::endl;
+    } else {
+        output << std::fixed << "Epoch "s << epoch << ": rmse "s << std::setprecision(4)
+               << metrics.GetRmse() << ", accuracy "s << std::setprecision(2)
+               << metrics.GetAccuracy() * 100 << "%, "s << std::setprecision(0) << rate
+               << " samples/s, "s << std::setprecision(3) << seconds << " s"s << std::endl;
+    }
+}
+
+void RequestHandler::PrintValidation(int epoch, const Metrics& metrics,
+                                     std::ostream& output) const {
+    if (metrics_format_ == JSON_LINES) {
+        output << std::defaultfloat << std::setprecision(6)
+               << "{\"epoch\": "s << epoch << ", \"validation_rmse\": "s << metrics.GetRmse()
+               << ", \"validation_accuracy\": "s << metrics.GetAccuracy()
+               << ", \"validation_samples\": "s << metrics.samples << "}"s << std::endl;
+    } else {
+        output << std::fixed << "Epoch "s << epoch << " validation: rmse "s << std::setprecision(4)
+               << metrics.GetRmse() << ", accuracy "s << std::setprecision(2)
+               << metrics.GetAccuracy() * 100 << "%, "s << metrics.samples << " samples"s
+               << std::endl;
+    }
+}
+
+void RequestHandler::TrainSerially(const Samples& samples, Metrics& metrics) {
+    const std::span<const uint8_t* const> inputs(samples.inputs);
+    const std::span<const float* const> targets(samples.targets);
+    for (size_t begin = 0; begin < inputs.size(); begin += batch_size_) {
+        size_t count = std::min<size_t>(batch_size_, inputs.size() - begin);
+        if (count == 1) {
+            // Stochastic gradient descent
+            {
+                PROFILE_SCOPE("forward");
+                snn_->CalculateOutput({inputs[begin], 1024}, sample_scale);
+            }
+            metrics.Add(snn_->ReadOutput(), {targets[begin], 10});
+            PROFILE_SCOPE("backward");
+            snn_->PropagateErrorBack({targets[begin], 10});
+        } else {
+            {
+                PROFILE_SCOPE("forward");
+                snn_->CalculateOutputBatch(inputs.subspan(begin, count), sample_scale);
             }
+            for (size_t n = 0; n < count; ++n) {
+                metrics.Add(snn_->ReadOutputBatch(n), {targets[begin + n], 10});
+            }
+            PROFILE_SCOPE("backward");
+            snn_->PropagateErrorBackBatch(targets.subspan(begin, count));
         }
-        progress_output << '\r' << i + 1 << std::flush;
     }
-    progress_output << std::endl;
+}
+
+void RequestHandler::TrainHogwild(const Samples& samples, std::vector<SnnBatch>& batches,
+                                  std::vector<Metrics>& metrics) {
+    // Each thread trains on its own part of the samples and writes
+    // into the shared weights without synchronization. Lost updates
+    // are rare and don't prevent the convergence (Hogwild!)
+    const std::span<const uint8_t* const> inputs(samples.inputs);
+    const std::span<const float* const> targets(samples.targets);
+    const size_t part = (inputs.size() + threads_ - 1) / threads_;
+    const profiler::Context context = profiler::Context::Current();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_; ++t) {
+        threads.emplace_back([&, t]() {
+            const profiler::ContextScope context_scope(context);
+            const size_t end = std::min(inputs.size(), (t + 1) * part);
+            for (size_t begin = t * part; begin < end; begin += batch_size_) {
+                size_t count = std::min<size_t>(batch_size_, end - begin);
+                {
+                    PROFILE_SCOPE("forward");
+                    snn_->CalculateOutputBatch(inputs.subspan(begin, count), sample_scale,
+                                               batches[t]);
+                }
+                for (size_t n = 0; n < count; ++n) {
+                    metrics[t].Add(snn_->ReadOutputBatch(batches[t], n), {targets[begin + n], 10});
+                }
+                PROFILE_SCOPE("backward");
+                snn_->PropagateErrorBackBatch(targets.subspan(begin, count), batches[t]);
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+}
+
+void RequestHandler::TrainSynchronously(const Samples& samples, std::vector<SnnBatch>& batches,
+                                        std::vector<Metrics>& metrics) {
+    // At each step every thread accumulates the gradient of its batch,
+    // then the average of them is applied while the threads wait
+    const std::span<const uint8_t* const> inputs(samples.inputs);
+    const std::span<const float* const> targets(samples.targets);
+    const size_t step_size = static_cast<size_t>(threads_) * batch_size_;
+    const size_t steps = (inputs.size() + step_size - 1) / step_size;
+
+    std::vector<SnnBatch*> batch_ptrs;
+    for (auto& batch : batches) {
+        batch_ptrs.push_back(&batch);
+    }
+    auto apply = [&]() noexcept {
+        PROFILE_SCOPE("apply gradients");
+        snn_->ApplyGradients(batch_ptrs);
+    };
+    std::barrier step_end(threads_, apply);
+
+    const profiler::Context context = profiler::Context::Current();
+    std::vector<std::thread> threads;
+    for (int t = 0; t < threads_; ++t) {
+        threads.emplace_back([&, t]() {
+            const profiler::ContextScope context_scope(context);
+            for (size_t step = 0; step < steps; ++step) {
+                size_t begin = step * step_size + t * batch_size_;
+                if (begin < inputs.size()) {
+                    size_t count = std::min<size_t>(batch_size_, inputs.size() - begin);
+                    {
+                        PROFILE_SCOPE("forward");
+                        snn_->CalculateOutputBatch(inputs.subspan(begin, count), sample_scale,
+                                                   batches[t]);
+                    }
+                    for (size_t n = 0; n < count; ++n) {
+                        metrics[t].Add(snn_->ReadOutputBatch(batches[t], n),
+                                       {targets[begin + n], 10});
+                    }
+                    PROFILE_SCOPE("backward");
+                    snn_->AccumulateGradientBatch(targets.subspan(begin, count), batches[t]);
+                }
+                step_end.arrive_and_wait();
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
 }
 
 void RequestHandler::Recognize(const std::filesystem::path& target_path, std::ostream& output) {
-    assert(snn_);
+    PROFILE_SCOPE("recognize");
+    assert(snn_ || quantized_snn_);
 
     if (!exists(target_path)) {
         throw std::runtime_error(target_path.string() + " does not exist"s);
     }
     normalizer_ = std::make_unique<ImageFileNormalizer>(1024);
+    if (quantized_snn_) {
+        quantized_workspaces_.clear();
+        for (int i = 0; i < threads_; ++i) {
+            quantized_workspaces_.push_back(quantized_snn_->CreateWorkspace());
+        }
+    } else {
+        workspace_ = snn_->CreateWorkspace();
+    }
     if (is_directory(target_path)) {
         if (is_empty(target_path)) {
             throw std::runtime_error(target_path.string() + " is empty"s);
         }
         file_counter_ = 1;
-        RecognizeFolder(target_path, output);
+        if (threads_ == 1 && prefetch_depth_ > 0) {
+            RecognizePrefetched(target_path, output);
+        } else if (threads_ == 1) {
+            if (!file_reader_) {
+                file_reader_ = std::make_unique<BatchFileReader>(recognition_batch_size);
+            }
+            batch_count_ = 0;
+            RecognizeFolder(target_path, 0, output);
+        } else {
+            RecognizeFolderInParallel(target_path, output);
+        }
+    } else if (GlyphBundle::IsBundle(target_path)) {
+        file_counter_ = 1;
+        RecognizeBundle(target_path, output);
     } else if (is_regular_file(target_path)) {
         file_counter_ = -1;
         RecognizeImage(target_path, output);
     }
 }
 
-void RequestHandler::RecognizeFolder(const std::filesystem::path& target_path, std::ostream& output) {
+std::vector<float> RequestHandler::ScoreBatch(std::span<const float> inputs) {
+    std::vector<float> outputs(inputs.size() / 1024 * 10);
+    ScoreBatch(inputs, outputs);
+    return outputs;
+}
+
+void RequestHandler::ScoreBatch(std::span<const float> inputs, std::span<float> outputs) {
+    assert(snn_ || quantized_snn_);
+    assert(outputs.size() == inputs.size() / 1024 * 10);
+    if (quantized_snn_) {
+        if (quantized_workspaces_.empty()) {
+            quantized_workspaces_.push_back(quantized_snn_->CreateWorkspace());
+        }
+        for (size_t i = 0; i < outputs.size() / 10; ++i) {
+            quantized_snn_->Infer(inputs.subspan(i * 1024, 1024), quantized_workspaces_[0],
+                                  outputs.subspan(i * 10, 10));
+        }
+    } else if (!outputs.empty()) {
+        snn_->InferBatch(inputs, score_batch_, outputs);
+    }
+}
+
+void RequestHandler::CompareQuantized(const std::filesystem::path& db_path, std::ostream& output) {
+    if (!snn_) {
+        throw std::runtime_error("The int8 network can be compared only with the float one"s);
+    }
+    using namespace std::filesystem;
+    if (!is_directory(db_path)) {
+        throw std::runtime_error(db_path.string() + " is not a directory"s);
+    }
+    normalizer_ = std::make_unique<ImageFileNormalizer>(1024);
+    const SnnMemento memento = snn_->CreateMemento();
+    const QuantizedSnn quantized(memento);
+    SnnWorkspace workspace = snn_->CreateWorkspace();
+    QuantizedWorkspace quantized_workspace = quantized.CreateWorkspace();
+
+    // A char is recognized if its output is the greatest one and greater
+    // than 0.5, a non-char (folder name longer than one char) if no output is
+    size_t images = 0;
+    size_t float_correct = 0;
+    size_t int8_correct = 0;
+    size_t agreed = 0;
+    float max_difference = 0.0f;
+    auto is_correct = [](std::span<const float> scores, int label) {
+        auto it = std::max_element(scores.begin(), scores.end());
+        if (label < 0) {
+            return *it <= 0.50f;
+        }
+        return *it > 0.50f && it - scores.begin() == label;
+    };
+    auto answer = [](std::span<const float> scores) {
+        auto it = std::max_element(scores.begin(), scores.end());
+        return *it > 0.50f ? static_cast<int>(it - scores.begin()) : -1;
+    };
+
+    std::vector<float> input(1024);
+    Scores float_scores;
+    Scores int8_scores;
+    for (const auto& sub : directory_iterator(db_path)) {
+        if (!sub.is_directory()) {
+            continue;
+        }
+        std::string name = sub.path().filename().string();
+        int label = -1;
+        if (name.size() == 1) {
+            if (name[0] < '0' || name[0] > '9') {
+                throw std::runtime_error("Char "s + name[0] + " is not supported"s);
+            }
+            label = name[0] - '0';
+        }
+        for (const auto& file : directory_iterator(sub)) {
+            normalizer_->Load(file.path(), input);
+            snn_->Infer(input, workspace, float_scores);
+            quantized.Infer(input, quantized_workspace, int8_scores);
+            ++images;
+            float_correct += is_correct(float_scores, label);
+            int8_correct += is_correct(int8_scores, label);
+            agreed += answer(float_scores) == answer(int8_scores);
+            for (size_t i = 0; i < 10; ++i) {
+                max_difference = std::max(max_difference, std::abs(float_scores[i] - int8_scores[i]));
+            }
+        }
+    }
+    if (images == 0) {
+        throw std::runtime_error(db_path.string() + " has no images"s);
+    }
+
+    auto percent = [images](size_t count) {
+        return 100.0 * count / images;
+    };
+    output << "Images: "s << images << std::endl;
+    output << std::fixed << std::showpoint << std::setprecision(2);
+    output << "Float accuracy: "s << percent(float_correct) << "%"s << std::endl;
+    output << "Int8 accuracy ("s << kernels::ActiveInt8().name << "): "s
+           << percent(int8_correct) << "%"s << std::endl;
+    output << "Same answers: "s << percent(agreed) << "%"s << std::endl;
+    output << std::setprecision(4);
+    output << "Max output difference: "s << max_difference << std::endl;
+    size_t float_bytes = 0;
+    for (size_t l = 0; l < memento.weights.size(); ++l) {
+        float_bytes += (memento.weights[l].size() + memento.biases[l].size()) * sizeof(float);
+    }
+    output << "Parameters: "s << float_bytes << " bytes float, "s
+           << quantized.GetParameterBytes() << " bytes int8"s << std::endl;
+}
+
+void RequestHandler::Serve(const std::filesystem::path& socket_path, std::ostream& output) {
+    assert(snn_ || quantized_snn_);
+    RecognitionServer server(socket_path, threads_, snn_.get(), quantized_snn_.get());
+    output << "Serving on "s << socket_path.string() << " with "s << threads_
+           << " workers"s << std::endl;
+
+    signalled_server = &server;
+    auto old_interrupt = std::signal(SIGINT, StopServer);
+    auto old_terminate = std::signal(SIGTERM, StopServer);
+    try {
+        server.Run();
+    } catch (...) {
+        std::signal(SIGINT, old_interrupt);
+        std::signal(SIGTERM, old_terminate);
+        signalled_server = nullptr;
+        throw;
+    }
+    std::signal(SIGINT, old_interrupt);
+    std::signal(SIGTERM, old_terminate);
+    signalled_server = nullptr;
+    output << "Stopped"s << std::endl;
+}
+
+void RequestHandler::Pack(const std::filesystem::path& db_path,
+                          const std::filesystem::path& bundle_path, std::ostream& output) {
+    normalizer_ = std::make_unique<ImageFileNormalizer>(1024);
+    PackFolder(db_path, bundle_path, *normalizer_);
+    const GlyphBundle bundle(bundle_path);
+    output << "Packed "s << bundle.GetCount() << " images of "s << bundle.GetLabels().size()
+           << " labels into "s << bundle_path.string() << std::endl;
+}
+
+void RequestHandler::Unpack(const std::filesystem::path& bundle_path,
+                            const std::filesystem::path& db_path, std::ostream& output) {
+    const size_t count = UnpackBundle(bundle_path, db_path);
+    output << "Unpacked "s << count << " images into "s << db_path.string() << std::endl;
+}
+
+void RequestHandler::RecognizeFolder(const std::filesystem::path& target_path, size_t depth,
+                                     std::ostream& output) {
     output << std::endl << "Folder: "s << target_path << std::endl;
-    for (const auto& sub : std::filesystem::directory_iterator(target_path)) {  
-        if (sub.is_directory()) {
-            RecognizeFolder(sub.path(), output); // Call recursively
-        } else if (sub.is_regular_file()) {
-            RecognizeImage(sub.path(), output);
-            ++file_counter_;
+    if (folder_readers_.size() <= depth) {
+        folder_readers_.push_back(std::make_unique<DirectoryReader>());
+    }
+    DirectoryReader& reader = *folder_readers_[depth];
+    try {
+        reader.Open(target_path);
+        while (reader.Next()) {
+            if (reader.GetType() == DirectoryReader::DIRECTORY) {
+                RecognizeImages(output);
+                RecognizeFolder(reader.GetPath(), depth + 1, output); // Call recursively
+            } else if (reader.GetType() == DirectoryReader::REGULAR_FILE) {
+                // The paths of the batch keep their storage
+                if (batch_paths_.size() == batch_count_) {
+                    batch_paths_.emplace_back();
+                }
+                batch_paths_[batch_count_++] = reader.GetPath();
+                if (batch_count_ == recognition_batch_size) {
+                    RecognizeImages(output);
+                }
+            }
+        }
+    } catch (...) {
+        // Report the images found before the error. An image of them that
+        // cannot be read stops the report, but the error of the traversal
+        // is the one that tells why it stopped
+        const std::exception_ptr error = std::current_exception();
+        try {
+            RecognizeImages(output);
+        } catch (...) {
+        }
+        std::rethrow_exception(error);
+    }
+    RecognizeImages(output);
+}
+
+void RequestHandler::RecognizeImages(std::ostream& output) {
+    // Images are loaded up to the first one that cannot be read,
+    // which stops the report after the preceding ones
+    const std::span<const std::filesystem::path> images(batch_paths_.data(), batch_count_);
+    batch_count_ = 0;
+    batch_inputs_.resize(std::max(batch_inputs_.size(), images.size() * 1024));
+    batch_scores_.resize(std::max(batch_scores_.size(), images.size() * 10));
+    for (const auto& image : images) {
+        file_reader_->Add(image);
+    }
+    size_t loaded = 0;
+    std::exception_ptr error;
+    for (; loaded < images.size(); ++loaded) {
+        try {
+            PROFILE_SCOPE("decode");
+            normalizer_->Decode(file_reader_->Take(), images[loaded],
+                                {batch_inputs_.data() + loaded * 1024, 1024});
+        } catch (...) {
+            error = std::current_exception();
+            break;
+        }
+    }
+
+    ReportImages(images.first(loaded), output);
+    if (error) {
+        // The images after the error are not reported
+        while (file_reader_->GetQueued() > 0) {
+            try {
+                file_reader_->Take();
+            } catch (...) {
+            }
+        }
+        PrintImagePath(images[loaded], output);
+        std::rethrow_exception(error);
+    }
+}
+
+void RequestHandler::ReportImages(std::span<const std::filesystem::path> images,
+                                  std::ostream& output) {
+    const std::span<float> scores(batch_scores_.data(), images.size() * 10);
+    {
+        PROFILE_SCOPE("infer");
+        ScoreBatch({batch_inputs_.data(), images.size() * 1024}, scores);
+    }
+    PROFILE_SCOPE("report");
+    for (size_t i = 0; i < images.size(); ++i) {
+        PrintImagePath(images[i], output);
+        PrintScores(scores.subspan(i * 10, 10), output);
+        ++file_counter_;
+    }
+}
+
+void RequestHandler::RecognizePrefetched(const std::filesystem::path& target_path,
+                                         std::ostream& output) {
+    // The report is the same as the one of RecognizeFolder. A batch
+    // is recognized when it is full or when the next image is not
+    // decoded yet, so the network doesn't wait for the readers
+    batch_inputs_.resize(std::max(batch_inputs_.size(), recognition_batch_size * 1024));
+    batch_scores_.resize(std::max(batch_scores_.size(), recognition_batch_size * 10));
+    batch_paths_.resize(std::max(batch_paths_.size(), recognition_batch_size));
+    batch_count_ = 0;
+    auto report = [&]() {
+        ReportImages({batch_paths_.data(), batch_count_}, output);
+        batch_count_ = 0;
+    };
+
+    ImagePrefetcher prefetcher(*normalizer_, target_path, prefetch_depth_, prefetch_readers_);
+    ImagePrefetcher::Entry entry;
+    while (true) {
+        if (batch_count_ == recognition_batch_size
+            || (batch_count_ > 0 && !prefetcher.IsNextReady())) {
+            report();
+        }
+        {
+            PROFILE_SCOPE("wait for image");
+            prefetcher.Pop(entry, {batch_inputs_.data() + batch_count_ * 1024, 1024});
+        }
+        if (entry.kind == ImagePrefetcher::IMAGE && !entry.error) {
+            batch_paths_[batch_count_++] = entry.path;
+            continue;
+        }
+        // Report the images found before the folder or the error
+        report();
+        if (entry.kind == ImagePrefetcher::FOLDER) {
+            output << std::endl << "Folder: "s << entry.path << std::endl;
+        } else if (entry.kind == ImagePrefetcher::IMAGE) {
+            PrintImagePath(entry.path, output);
+            std::rethrow_exception(entry.error);
+        } else if (entry.kind == ImagePrefetcher::ERROR) {
+            std::rethrow_exception(entry.error);
+        } else {
+            break;
+        }
+    }
+}
+
+void RequestHandler::RecognizeBundle(const std::filesystem::path& bundle_path,
+                                     std::ostream& output) {
+    const GlyphBundle bundle(bundle_path);
+    if (bundle.GetWidth() != 1024) {
+        throw std::runtime_error("Pixel count of "s + bundle_path.string()
+                                 + " does not match the input width of the network"s);
+    }
+    batch_inputs_.resize(std::max(batch_inputs_.size(), recognition_batch_size * 1024));
+    batch_scores_.resize(std::max(batch_scores_.size(), recognition_batch_size * 10));
+    batch_paths_.resize(std::max(batch_paths_.size(), recognition_batch_size));
+
+    output << std::endl << "Folder: "s << bundle_path << std::endl;
+    for (const GlyphBundle::Label& label : bundle.GetLabels()) {
+        const std::filesystem::path folder = bundle_path / std::string(label.name);
+        output << std::endl << "Folder: "s << folder << std::endl;
+        // The records are named as the files of UnpackBundle
+        const size_t digits = std::to_string(label.count).size();
+        for (size_t begin = 0; begin < label.count; begin += recognition_batch_size) {
+            const size_t count = std::min(recognition_batch_size, label.count - begin);
+            for (size_t i = 0; i < count; ++i) {
+                const uint8_t* record = bundle.GetRecord(label.first + begin + i);
+                float* input = batch_inputs_.data() + i * 1024;
+                for (size_t j = 0; j < 1024; ++j) {
+                    input[j] = record[j] * sample_scale;
+                }
+                std::string name = std::to_string(begin + i + 1);
+                name.insert(0, digits - name.size(), '0');
+                batch_paths_[i] = folder / (name + ".bmp"s);
+            }
+            ReportImages({batch_paths_.data(), count}, output);
         }
     }
 }
 
 void RequestHandler::RecognizeImage(const std::filesystem::path& target_path, std::ostream& output) {
+    PrintImagePath(target_path, output);
+
+    batch_inputs_.resize(std::max<size_t>(batch_inputs_.size(), 1024));
+    const std::span<const float> input(batch_inputs_.data(), 1024);
+    {
+        PROFILE_SCOPE("decode");
+        normalizer_->Load(target_path, {batch_inputs_.data(), 1024});
+    }
+    Scores snn_out;
+    {
+        PROFILE_SCOPE("infer");
+        if (quantized_snn_) {
+            quantized_snn_->Infer(input, quantized_workspaces_[0], snn_out);
+        } else {
+            snn_->Infer(input, workspace_, snn_out);
+        }
+    }
+    PROFILE_SCOPE("report");
+    PrintScores(snn_out, output);
+}
+
+void RequestHandler::RecognizeFolderInParallel(const std::filesystem::path& target_path,
+                                               std::ostream& output) {
+    // Traversal, decoding and inference run in the pool,
+    // the report is printed afterwards in the order of the serial one
+    WorkStealingPool pool(threads_);
+    std::vector<SnnWorkspace> workspaces;
+    std::vector<std::vector<float>> inputs;
+    for (int i = 0; i < threads_; ++i) {
+        if (!quantized_snn_) {
+            workspaces.push_back(snn_->CreateWorkspace());
+        }
+        inputs.emplace_back(1024);
+    }
+
+    FolderResult root;
+    root.path = target_path;
+    pool.Submit([&, context = profiler::Context::Current()](size_t) {
+        const profiler::ContextScope context_scope(context);
+        ScanFolder(root, pool, workspaces, inputs);
+    });
+    pool.Wait();
+
+    PROFILE_SCOPE("report");
+    PrintFolder(root, output);
+}
+
+void RequestHandler::ScanFolder(FolderResult& folder, WorkStealingPool& pool,
+                                std::vector<SnnWorkspace>& workspaces,
+                                std::vector<std::vector<float>>& inputs) {
+    // The tasks of the folder nest under the zone of the recognition, as in the serial one
+    const profiler::Context context = profiler::Context::Current();
+    PROFILE_SCOPE("scan folder");
+    try {
+        for (const auto& sub : std::filesystem::directory_iterator(folder.path)) {
+            if (sub.is_directory()) {
+                auto sub_folder = std::make_unique<FolderResult>();
+                sub_folder->path = sub.path();
+                folder.entries.push_back({std::move(sub_folder), {}});
+            } else if (sub.is_regular_file()) {
+                folder.entries.push_back({nullptr, {sub.path(), {}, nullptr}});
+            }
+        }
+    } catch (...) {
+        folder.error = std::current_exception();
+    }
+
+    // Tasks are submitted when the entries don't move anymore
+    for (auto& entry : folder.entries) {
+        if (entry.folder) {
+            FolderResult* sub_folder = entry.folder.get();
+            pool.Submit([this, sub_folder, &pool, &workspaces, &inputs, context](size_t) {
+                const profiler::ContextScope context_scope(context);
+                ScanFolder(*sub_folder, pool, workspaces, inputs);
+            });
+        } else {
+            ImageResult* image = &entry.image;
+            pool.Submit([this, image, &workspaces, &inputs, context](size_t worker) {
+                const profiler::ContextScope context_scope(context);
+                try {
+                    std::vector<float>& vec = inputs[worker];
+                    {
+                        PROFILE_SCOPE("decode");
+                        normalizer_->Load(image->path, vec);
+                    }
+                    PROFILE_SCOPE("infer");
+                    if (quantized_snn_) {
+                        quantized_snn_->Infer(vec, quantized_workspaces_[worker], image->scores);
+                    } else {
+                        snn_->Infer(vec, workspaces[worker], image->scores);
+                    }
+                } catch (...) {
+                    image->error = std::current_exception();
+                }
+            });
+        }
+    }
+}
+
+void RequestHandler::PrintFolder(const FolderResult& folder, std::ostream& output) {
+    output << std::endl << "Folder: "s << folder.path << std::endl;
+    for (const auto& entry : folder.entries) {
+        if (entry.folder) {
+            PrintFolder(*entry.folder, output);
+        } else {
+            PrintImagePath(entry.image.path, output);
+            if (entry.image.error) {
+                std::rethrow_exception(entry.image.error);
+            }
+            PrintScores(entry.image.scores, output);
+            ++file_counter_;
+        }
+    }
+    if (folder.error) {
+        std::rethrow_exception(folder.error);
+    }
+}
+
+void RequestHandler::PrintImagePath(const std::filesystem::path& target_path,
+                                    std::ostream& output) const {
     if (file_counter_ != -1) {
         output << std::endl << file_counter_ << ". "s;
     }
-    output << target_path.string() << std::endl;
+    // The native string is printed without a copy where it is narrow
+    if constexpr (std::is_same_v<std::filesystem::path::value_type, char>) {
+        output << target_path.native() << std::endl;
+    } else {
+        output << target_path.string() << std::endl;
+    }
+}
 
-    auto vec = normalizer_->Load(target_path);
-    snn_->CalculateOutput(vec);
-    const std::vector<float>& snn_out = snn_->ReadOutput();
+void RequestHandler::PrintScores(std::span<const float> snn_out, std::ostream& output) const {
     auto it = std::max_element(snn_out.begin(), snn_out.end());
     size_t max = it - snn_out.begin();
     // Only if the input value is greater than 0.5, the character is considered recognized
@@ -145,3 +1078,261 @@ void RequestHandler::RecognizeImage(const std::filesystem::path& target_path, st
     }
     output << std::endl;
 }
+
+namespace tests {
+
+void RecognitionDoesNotAllocate() {
+    // Only the serial recognition (one thread, no prefetch) is checked. The
+    // parallel one keeps the path and the scores of every image until the
+    // report, and the prefetch passes paths between threads, so both allocate
+    // per image. Allocations are counted only in the builds with
+    // RECOGNIZER_COUNT_ALLOCATIONS
+    if constexpr (!allocation_counter::enabled) {
+        return;
+    }
+    using namespace img_lib;
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "recognition_allocation_test";
+    fs::remove_all(dir);
+    Image image(32, 32, Color::Black());
+    for (int y = 0; y < 32; ++y) {
+        for (int x = 0; x < 32; ++x) {
+            const std::byte value = static_cast<std::byte>(x * 8 + y);
+            image.GetPixel(x, y) = Color{value, value, value, std::byte{255}};
+        }
+    }
+
+    // Folders of few and of many images, each with a subfolder
+    const size_t few = 20;
+    const size_t many = 400;
+    for (size_t count : {few, many}) {
+        const fs::path folder = dir / std::to_string(count);
+        fs::create_directories(folder / "sub");
+        for (size_t i = 0; i < count; ++i) {
+            const fs::path file = (i % 2 ? folder : folder / "sub") / ("glyph_"s + std::to_string(i) + ".bmp"s);
+            [[maybe_unused]] bool saved = SaveBMP(file, image);
+            assert(saved);
+        }
+    }
+
+    // The report goes nowhere, a stream buffer may allocate
+    class NullBuffer : public std::streambuf {
+    protected:
+        int overflow(int c) override {
+            return c;
+        }
+    } null_buffer;
+    std::ostream output(&null_buffer);
+
+    RequestHandler handler;
+    handler.CreateNewSnn(32);
+    auto recognition_allocations = [&](size_t count) {
+        const size_t before = allocation_counter::GetThreadAllocations();
+        handler.Recognize(dir / std::to_string(count), output);
+        return allocation_counter::GetThreadAllocations() - before;
+    };
+    // The first run allocates the buffers, for the longest paths
+    recognition_allocations(many);
+    [[maybe_unused]] const size_t few_allocations = recognition_allocations(few);
+    [[maybe_unused]] const size_t many_allocations = recognition_allocations(many);
+    assert(many_allocations <= few_allocations);
+    fs::remove_all(dir);
+}
+
+void PrefetchedRecognitionMatches() {
+    using namespace img_lib;
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "prefetched_recognition_test";
+    fs::remove_all(dir);
+    Image image(32, 32, Color::Black());
+    for (int i = 0; i < 150; ++i) {
+        const fs::path folder = dir / std::to_string(i % 3) / std::to_string(i % 2);
+        fs::create_directories(folder);
+        image.GetPixel(i % 32, i / 32) = Color{std::byte{255}, std::byte{255}, std::byte{255}, std::byte{255}};
+        [[maybe_unused]] bool saved = SaveBMP(folder / ("glyph_"s + std::to_string(i) + ".bmp"s), image);
+        assert(saved);
+    }
+
+    RequestHandler handler;
+    handler.CreateNewSnn(32);
+    auto recognize = [&](size_t depth, std::string& report) {
+        handler.SetPrefetch(depth, 2);
+        std::ostringstream output;
+        bool failed = false;
+        try {
+            handler.Recognize(dir, output);
+        } catch (const std::exception&) {
+            failed = true;
+        }
+        report = output.str();
+        return failed;
+    };
+
+    // Small queues make the traversal wait for the recognition
+    std::string serial;
+    std::string prefetched;
+    [[maybe_unused]] bool failed = recognize(0, serial);
+    assert(!failed);
+    for (size_t depth : {1, 3, 100}) {
+        failed = recognize(depth, prefetched);
+        assert(!failed && prefetched == serial);
+    }
+
+    // A file that cannot be decoded stops both reports at the same image
+    {
+        std::ofstream broken(dir / "1" / "0" / "broken.bmp");
+        broken << "not an image"s;
+    }
+    failed = recognize(0, serial);
+    assert(failed);
+    failed = recognize(3, prefetched);
+    assert(failed && prefetched == serial);
+    fs::remove_all(dir);
+}
+
+void ObserveEpochKeepsTheBest() {
+    using Criteria = RequestHandler::StoppingCriteria;
+    struct Run {
+        int stop_epoch = 0; // 0 if the training doesn't stop
+        int kept_epoch = 0;
+        size_t snapshots = 0;
+    };
+    // Every epoch has its own network, the observed values are
+    // the accuracies and the RMSEs of 100 samples
+    std::vector<std::shared_ptr<const Snn>> networks;
+    for (size_t i = 0; i < 5; ++i) {
+        Snn snn(4, 1, 3, 2);
+        snn.InitializeWeightsWithRandom();
+        snn.InitializeBiasesWithRandom();
+        networks.push_back(std::make_shared<const Snn>(snn.CreateSnapshot()));
+    }
+    auto run = [&networks](const Criteria& criteria, const std::vector<double>& accuracies,
+                           const std::vector<double>& rmses,
+                           RequestHandler::BestSnn& best) {
+        RequestHandler handler;
+        handler.SetStoppingCriteria(criteria);
+        best = {};
+        Run result;
+        for (size_t i = 0; i < accuracies.size() && result.stop_epoch == 0; ++i) {
+            RequestHandler::Metrics metrics;
+            metrics.samples = 100;
+            metrics.correct = static_cast<size_t>(std::lround(accuracies[i] * 100));
+            metrics.rmse_sum = (rmses.empty() ? 0.5 : rmses[i]) * 100;
+            const int epoch = static_cast<int>(i + 1);
+            auto snapshot = [&networks, &result, i]() {
+                ++result.snapshots;
+                return networks[i];
+            };
+            if (handler.ObserveEpoch(epoch, metrics, snapshot, best)) {
+                result.stop_epoch = epoch;
+            }
+        }
+        result.kept_epoch = best.epoch;
+        return result;
+    };
+    RequestHandler::BestSnn best;
+
+    // The patience counts the epochs after the best one, an equal value isn't better
+    Criteria criteria;
+    criteria.patience = 2;
+    Run result = run(criteria, {0.5, 0.6, 0.6, 0.55, 0.7}, {}, best);
+    assert(result.stop_epoch == 4 && result.kept_epoch == 2 && result.snapshots == 2);
+
+    // Smaller improvements than min_delta don't count
+    criteria.patience = 3;
+    result = run(criteria, {0.5, 0.53, 0.54, 0.52}, {}, best);
+    assert(result.stop_epoch == 0 && result.kept_epoch == 3);
+    criteria.min_delta = 0.05;
+    result = run(criteria, {0.5, 0.53, 0.54, 0.52}, {}, best);
+    assert(result.stop_epoch == 4 && result.kept_epoch == 1 && result.snapshots == 1);
+
+    // The target accuracy stops the training and keeps its epoch
+    criteria = {};
+    criteria.target_accuracy = 0.9;
+    result = run(criteria, {0.5, 0.95, 0.97}, {}, best);
+    assert(result.stop_epoch == 2 && result.kept_epoch == 2);
+
+    // A smaller RMSE is better, the accuracy doesn't matter then
+    criteria = {};
+    criteria.monitor = RequestHandler::RMSE;
+    criteria.patience = 2;
+    result = run(criteria, {0.9, 0.5, 0.9, 0.9, 0.9}, {0.3, 0.2, 0.25, 0.21, 0.1}, best);
+    assert(result.stop_epoch == 4 && result.kept_epoch == 2 && result.snapshots == 2);
+    assert(best.value == -0.2 && best.snn == networks[1]);
+
+    // Without criteria nothing is kept
+    result = run({}, {0.5, 0.9}, {}, best);
+    assert(result.stop_epoch == 0 && result.kept_epoch == 0 && result.snapshots == 0);
+
+    // The kept network replaces the trained one as at the end of Train
+    result = run(criteria, {0.9, 0.5, 0.9, 0.9, 0.9}, {0.3, 0.2, 0.25, 0.21, 0.1}, best);
+    Snn trained(4, 1, 3, 2);
+    trained.InitializeWeightsWithRandom();
+    trained.CopyParameters(*best.snn);
+    assert(std::ranges::equal(trained.GetWeights(), networks[1]->GetWeights()));
+    assert(std::ranges::equal(trained.GetBiases(), networks[1]->GetBiases()));
+}
+
+void ResumedTrainingMatches() {
+    using namespace img_lib;
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "resumed_training_test";
+    fs::remove_all(dir);
+
+    // A folder per digit and a folder of non-chars, the images differ
+    for (const std::string label : {"0"s, "1"s, "2"s, "3"s, "4"s, "5"s, "6"s, "7"s, "8"s, "9"s,
+                                     "none"s}) {
+        fs::create_directories(dir / "db" / label);
+        for (int i = 0; i < 3; ++i) {
+            Image image(32, 32, Color::Black());
+            for (int y = 0; y < 32; ++y) {
+                for (int x = 0; x < 32; ++x) {
+                    const std::byte value = static_cast<std::byte>((x * label[0] + y * (i + 1)) % 256);
+                    image.GetPixel(x, y) = Color{value, value, value, std::byte{255}};
+                }
+            }
+            const fs::path file = dir / "db" / label / (std::to_string(i) + ".bmp"s);
+            [[maybe_unused]] bool saved = SaveBMP(file, image);
+            assert(saved);
+        }
+    }
+    {
+        RequestHandler handler;
+        handler.CreateNewSnn(16);
+        handler.SaveSnn(dir / "initial");
+    }
+
+    std::ostringstream progress;
+    auto start = [&dir]() {
+        auto handler = std::make_unique<RequestHandler>();
+        handler->LoadSnn(dir / "initial");
+        handler->LoadDb(dir / "db");
+        handler->SetAlgorithm(RequestHandler::SHUFFLED_WITH_NOT_SYM);
+        handler->SetCheckpoint(dir / "checkpoint", 2);
+        return handler;
+    };
+    const int epochs = 6;
+
+    // All the epochs in one run
+    std::unique_ptr<RequestHandler> handler = start();
+    handler->Train(epochs, progress);
+    handler->SaveSnn(dir / "whole");
+
+    // Half of them, then the rest from the checkpoint in another handler
+    fs::remove(dir / "checkpoint");
+    handler = start();
+    handler->Train(epochs / 2, progress);
+    handler = start();
+    handler->ResumeFromCheckpoint(dir / "checkpoint");
+    handler->Train(epochs, progress);
+    handler->SaveSnn(dir / "resumed");
+
+    [[maybe_unused]] const SnnMemento whole = LoadSnnState(dir / "whole");
+    [[maybe_unused]] const SnnMemento resumed = LoadSnnState(dir / "resumed");
+    [[maybe_unused]] const SnnMemento initial = LoadSnnState(dir / "initial");
+    assert(whole.weights == resumed.weights && whole.biases == resumed.biases);
+    assert(whole.weights != initial.weights);
+    fs::remove_all(dir);
+}
+
+}
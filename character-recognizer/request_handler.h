@@ -1,11 +1,30 @@
 #pragma once
 
+#include "batch_file_reader.h"
+#include "directory_reader.h"
+#include "kernels.h"
+#include "quantized_snn.h"
+#include "recognition_server.h"
 #include "snn.h"
+#include "state_saver.h"
+#include "thread_pool.h"
 #include "training_database.h"
 
+#include <array>
+#include <exception>
 #include <filesystem>
+#include <functional>
 #include <iostream>
 #include <memory>
+#include <random>
+#include <vector>
+
+namespace tests {
+
+// Checks the private logic of early stopping
+void ObserveEpochKeepsTheBest();
+
+}
 
 class RequestHandler {
 public:
@@ -15,24 +34,239 @@ public:
         SHUFFLED_WITH_NOT_SYM
     };
 
+    // How threads share the network during training
+    enum ParallelStrategy {
+        HOGWILD, // lock-free updates of the shared weights
+        SYNCHRONOUS // per-thread gradients averaged after each step
+    };
+
+    // How Train reports the epochs
+    enum MetricsFormat {
+        COUNTER, // number of the finished cycles
+        TEXT, // a line of metrics per epoch
+        JSON_LINES // a JSON object of metrics per line
+    };
+
+    // Metric that decides which network of the epochs is the best
+    enum Monitor {
+        ACCURACY, // greater is better
+        RMSE // smaller is better
+    };
+
+    // Convergence criteria of Train, they are disabled by default.
+    // The metrics are the validation ones if there is a validation
+    // set, otherwise the training ones of the epoch
+    struct StoppingCriteria {
+        Monitor monitor = ACCURACY;
+        // Epochs without an improvement of the monitored metric
+        // that stop the training, 0 disables it
+        int patience = 0;
+        // Smaller changes of the monitored metric are not improvements
+        double min_delta = 0.0;
+        // Accuracy that stops the training, 0 disables it
+        double target_accuracy = 0.0;
+    };
+
     void CreateNewSnn(int hidden_neurons);
     void LoadSnn(const std::filesystem::path& snn_data_path);
+    // Uses the weights of the mapped file in place (only for recognition).
+    // An int8 model file gives only the int8 network
+    void MapSnn(const std::filesystem::path& snn_data_path);
     void SaveSnn(const std::filesystem::path& path_to_save) const;
-    void LoadDb(const std::filesystem::path& db_path);
+    // Recognition uses the int8 copy of the loaded network from now on
+    void QuantizeSnn();
+    // Saves the int8 network as an int8 model file
+    void SaveQuantizedSnn(const std::filesystem::path& path_to_save) const;
+    // An empty cache path disables the cache of decoded images.
+    // Images are decoded by the threads set with SetThreads.
+    // The path may be a glyph bundle, which needs no cache
+    void LoadDb(const std::filesystem::path& db_path, const std::filesystem::path& cache_path = {});
 
     void SetAlgorithm(Algorithm algorithm);
+    void SetBatchSize(int batch_size);
+    void SetThreads(int threads);
+    void SetParallelStrategy(ParallelStrategy strategy);
+    void SetMetricsFormat(MetricsFormat format);
+    // Part of the samples of every char (and of the non-chars) that is held
+    // out of the training. It is evaluated after every epoch in the background,
+    // while the next epoch is trained
+    void SetValidationFraction(double fraction);
+    // If any criterion is enabled, Train leaves the best network
+    // of the epochs by the monitored metric in the handler
+    void SetStoppingCriteria(const StoppingCriteria& criteria);
+    // Train writes a checkpoint to the path every interval epochs and
+    // after the last one, in the background (see CheckpointWriter)
+    void SetCheckpoint(const std::filesystem::path& path, int interval);
+    // Takes the network, the order of samples and the best network
+    // from the checkpoint, Train continues from the epoch after it.
+    // The other training settings must be the same as before
+    void ResumeFromCheckpoint(const std::filesystem::path& path);
+    // Activation of the loaded network for training and recognition
+    void SetSigmoid(kernels::Sigmoid sigmoid);
+    // Recognize with one thread reads up to depth images ahead with
+    // the reader threads (see ImagePrefetcher), 0 disables it
+    void SetPrefetch(size_t depth, int readers);
     void Train(int cycles, std::ostream& progress_output);
     
+    // The target is an image, a folder or a glyph bundle
     void Recognize(const std::filesystem::path& target_path, std::ostream& output);
 
+    // Scores K normalized images, a row-major matrix [K x 1024],
+    // in one call and returns the network outputs [K x 10]
+    std::vector<float> ScoreBatch(std::span<const float> inputs);
+    // The same into the span of K * 10 outputs, it doesn't allocate
+    // when the batch is not larger than the previous ones
+    void ScoreBatch(std::span<const float> inputs, std::span<float> outputs);
+
+    // Recognizes the labelled images of a folder (as in the training
+    // database) with the float and the int8 network and reports both
+    void CompareQuantized(const std::filesystem::path& db_path, std::ostream& output);
+
+    // Recognizes the requests of clients of the socket with the loaded
+    // network (see RecognitionServer) until SIGINT or SIGTERM.
+    // The threads set with SetThreads serve the requests
+    void Serve(const std::filesystem::path& socket_path, std::ostream& output);
+
+    // Convert a folder with the layout of the training folder
+    // to a glyph bundle and back (see GlyphBundle)
+    void Pack(const std::filesystem::path& db_path, const std::filesystem::path& bundle_path,
+              std::ostream& output);
+    void Unpack(const std::filesystem::path& bundle_path, const std::filesystem::path& db_path,
+                std::ostream& output);
+
 private:
+    friend void tests::ObserveEpochKeepsTheBest();
+
     std::unique_ptr<ImageFileNormalizer> normalizer_;
     std::unique_ptr<TrainingDatabase> db_;
     std::unique_ptr<Snn> snn_;
+    SnnWorkspace workspace_;
+    SnnBatch score_batch_;
+    // Buffers of the serial recognition, they are reused for every batch
+    // of images, so recognizing a folder with one thread doesn't allocate
+    // per image. The parallel recognition keeps a result per image
+    std::vector<float> batch_inputs_;
+    std::vector<float> batch_scores_;
+    std::vector<std::filesystem::path> batch_paths_;
+    size_t batch_count_ = 0;
+    std::unique_ptr<BatchFileReader> file_reader_; // reads the images of a batch at once
+    std::vector<std::unique_ptr<DirectoryReader>> folder_readers_; // one per depth of folders
+    std::unique_ptr<QuantizedSnn> quantized_snn_;
+    std::vector<QuantizedWorkspace> quantized_workspaces_; // one per thread
 
     Algorithm algorithm_ = SEQUENTIALLY;
+    int batch_size_ = 1;
+    int threads_ = 1;
+    ParallelStrategy strategy_ = HOGWILD;
+    MetricsFormat metrics_format_ = COUNTER;
+    double validation_fraction_ = 0.0;
+    StoppingCriteria stopping_;
+    std::filesystem::path checkpoint_path_; // empty if there are no checkpoints
+    int checkpoint_interval_ = 1;
+    TrainingState resumed_state_; // of the checkpoint, the initial one otherwise
+    std::shared_ptr<const Snn> resumed_best_;
+    // Decides the order of samples, it is saved in checkpoints
+    std::default_random_engine engine_;
     int file_counter_ = 0;
+    size_t prefetch_depth_ = 0;
+    int prefetch_readers_ = 1;
+
+    // Training samples of one cycle: inputs and expected outputs
+    struct Samples {
+        std::vector<const uint8_t*> inputs; // samples of the database
+        std::vector<const float*> targets;
+    };
+
+    // Metrics of samples, accumulated from the outputs of the forward passes
+    // before the weights are updated. A char is recognized correctly if its
+    // output is the greatest one and greater than 0.5, a non-char if no output is
+    struct Metrics {
+        size_t samples = 0;
+        double rmse_sum = 0.0; // of Snn::EvaluateError
+        size_t correct = 0;
 
-    void RecognizeFolder(const std::filesystem::path& target_path, std::ostream& output);
+        void Add(std::span<const float> output, std::span<const float> target);
+        void Merge(const Metrics& other);
+        double GetRmse() const;
+        double GetAccuracy() const;
+    };
+
+    // Every thread accumulates the metrics of its samples
+    void TrainSerially(const Samples& samples, Metrics& metrics);
+    void TrainHogwild(const Samples& samples, std::vector<SnnBatch>& batches,
+                      std::vector<Metrics>& metrics);
+    void TrainSynchronously(const Samples& samples, std::vector<SnnBatch>& batches,
+                            std::vector<Metrics>& metrics);
+    // Moves evenly spaced samples of every char and of the non-chars to the validation set
+    void SplitValidation(TrainingDatabase::CharPtrArray& chars,
+                         std::vector<const uint8_t*>& non_chars, Samples& validation,
+                         const std::vector<std::vector<float>>& unit_targets,
+                         const std::vector<float>& zero_target) const;
+    static Metrics Evaluate(const Snn& snn, const Samples& samples);
+
+    // The best network of the epochs observed by Train
+    struct BestSnn {
+        double value = 0.0; // monitored metric, greater is better
+        int epoch = 0;
+        std::shared_ptr<const Snn> snn;
+    };
+
+    bool IsStoppingEnabled() const;
+    // Returns true if the training must stop after the epoch. The snapshot
+    // of the network of the epoch is taken only if it becomes the best one
+    bool ObserveEpoch(int epoch, const Metrics& metrics,
+                      const std::function<std::shared_ptr<const Snn>()>& snapshot,
+                      BestSnn& best) const;
+    void PrintEpoch(int epoch, const Metrics& metrics, double seconds, std::ostream& output) const;
+    void PrintValidation(int epoch, const Metrics& metrics, std::ostream& output) const;
+    using Scores = std::array<float, 10>;
+
+    // Results of the parallel recognition of a folder.
+    // Entries are in the order of the directory iterator
+    struct ImageResult {
+        std::filesystem::path path;
+        Scores scores;
+        std::exception_ptr error;
+    };
+
+    struct FolderResult;
+
+    struct FolderEntry {
+        std::unique_ptr<FolderResult> folder; // nullptr for an image
+        ImageResult image;
+    };
+
+    struct FolderResult {
+        std::filesystem::path path;
+        std::vector<FolderEntry> entries;
+        std::exception_ptr error; // the folder cannot be read to the end
+    };
+
+    void RecognizeFolder(const std::filesystem::path& target_path, size_t depth,
+                         std::ostream& output);
     void RecognizeImage(const std::filesystem::path& target_path, std::ostream& output);
+    // Recognizes and reports the images of batch_paths_
+    void RecognizeImages(std::ostream& output);
+    // Recognizes and reports the images decoded into batch_inputs_
+    void ReportImages(std::span<const std::filesystem::path> images, std::ostream& output);
+    void RecognizePrefetched(const std::filesystem::path& target_path, std::ostream& output);
+    // Reports the records of a label as the images of a folder named after it
+    void RecognizeBundle(const std::filesystem::path& bundle_path, std::ostream& output);
+
+    void RecognizeFolderInParallel(const std::filesystem::path& target_path, std::ostream& output);
+    // Workspaces and input buffers are indexed by the worker
+    void ScanFolder(FolderResult& folder, WorkStealingPool& pool,
+                    std::vector<SnnWorkspace>& workspaces, std::vector<std::vector<float>>& inputs);
+    void PrintFolder(const FolderResult& folder, std::ostream& output);
+
+    void PrintImagePath(const std::filesystem::path& target_path, std::ostream& output) const;
+    void PrintScores(std::span<const float> snn_out, std::ostream& output) const;
 };
+
+namespace tests {
+
+void RecognitionDoesNotAllocate();
+void PrefetchedRecognitionMatches();
+void ResumedTrainingMatches();
+
+}
@@ -0,0 +1,214 @@
+#include "sample_cache.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std::literals;
+
+namespace {
+
+// Layout of the file:
+//   header: u32 version, u32 sample width, u64 number of files,
+//           u64 size of the path table, u64 offset of the samples
+//   records: u64 file size, i64 modification time,
+//            u32 path offset in the path table, u32 path length
+//   path table
+//   samples: bytes [count x width], the offset is a multiple of 64
+constexpr uint32_t cache_version = 0x26101603;
+
+struct CacheHeader {
+    uint32_t version;
+    uint32_t width;
+    uint64_t count;
+    uint64_t paths_size;
+    uint64_t samples_offset;
+};
+
+struct CacheRecord {
+    uint64_t size;
+    int64_t mtime;
+    uint32_t path_offset;
+    uint32_t path_length;
+};
+
+constexpr size_t samples_alignment = 64;
+
+size_t AlignUp(size_t value) {
+    return (value + samples_alignment - 1) / samples_alignment * samples_alignment;
+}
+
+}
+
+SampleFileInfo SampleFileInfo::FromEntry(const std::filesystem::directory_entry& entry,
+                                         const std::filesystem::path& folder) {
+    SampleFileInfo info;
+    info.path = entry.path().lexically_relative(folder).generic_string();
+    info.size = entry.file_size();
+    info.mtime = entry.last_write_time().time_since_epoch().count();
+    return info;
+}
+
+SampleCache::SampleCache(std::unique_ptr<MappedFile> mapping)
+: mapping_(std::move(mapping)) {
+}
+
+std::unique_ptr<SampleCache> SampleCache::Open(const std::filesystem::path& file, size_t width) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(file, error)) {
+        return nullptr;
+    }
+    auto mapping = std::make_unique<MappedFile>(file);
+    const std::byte* data = mapping->GetData();
+    const size_t file_size = mapping->GetSize();
+
+    CacheHeader header;
+    if (file_size < sizeof(header)) {
+        return nullptr;
+    }
+    std::memcpy(&header, data, sizeof(header));
+    if (header.version != cache_version || header.width != width) {
+        return nullptr;
+    }
+
+    // Every part must lie inside the file, the sizes are checked
+    // before they are added so that the sums can't wrap around
+    if (header.count > file_size / sizeof(CacheRecord)) {
+        return nullptr;
+    }
+    const uint64_t records_end = sizeof(header) + header.count * sizeof(CacheRecord);
+    if (records_end > file_size || header.paths_size > file_size - records_end) {
+        return nullptr;
+    }
+    const uint64_t paths_end = records_end + header.paths_size;
+    if (header.samples_offset != AlignUp(paths_end) || header.samples_offset > file_size
+        || (file_size - header.samples_offset) / width < header.count) {
+        return nullptr;
+    }
+
+    std::unique_ptr<SampleCache> cache(new SampleCache(std::move(mapping)));
+    cache->width_ = width;
+    const char* paths = reinterpret_cast<const char*>(data + records_end);
+    const uint8_t* samples = reinterpret_cast<const uint8_t*>(data + header.samples_offset);
+    for (uint64_t i = 0; i < header.count; ++i) {
+        CacheRecord record;
+        std::memcpy(&record, data + sizeof(header) + i * sizeof(record), sizeof(record));
+        if (static_cast<uint64_t>(record.path_offset) + record.path_length > header.paths_size) {
+            return nullptr;
+        }
+        cache->records_[{paths + record.path_offset, record.path_length}] =
+            {record.size, record.mtime, samples + i * width};
+    }
+    return cache;
+}
+
+void SampleCache::Write(const std::filesystem::path& file, size_t width,
+                        std::span<const Entry> entries) {
+    CacheHeader header{cache_version, static_cast<uint32_t>(width), entries.size(), 0, 0};
+    std::vector<CacheRecord> records;
+    records.reserve(entries.size());
+    for (const Entry& entry : entries) {
+        records.push_back({entry.info->size, entry.info->mtime,
+                           static_cast<uint32_t>(header.paths_size),
+                           static_cast<uint32_t>(entry.info->path.size())});
+        header.paths_size += entry.info->path.size();
+    }
+    const size_t paths_end = sizeof(header) + records.size() * sizeof(CacheRecord)
+                             + header.paths_size;
+    header.samples_offset = AlignUp(paths_end);
+
+    std::filesystem::path temp_file = file;
+    temp_file += ".tmp"s;
+    {
+        std::ofstream out(temp_file, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Unable to open file "s + temp_file.string()
+                                     + " for saving the sample cache"s);
+        }
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(reinterpret_cast<const char*>(records.data()),
+                  records.size() * sizeof(CacheRecord));
+        for (const Entry& entry : entries) {
+            out.write(entry.info->path.data(), entry.info->path.size());
+        }
+        const std::vector<char> padding(header.samples_offset - paths_end, 0);
+        out.write(padding.data(), padding.size());
+        for (const Entry& entry : entries) {
+            if (entry.sample.size() != width) {
+                throw std::runtime_error("Unexpected size of the sample of "s + entry.info->path);
+            }
+            out.write(reinterpret_cast<const char*>(entry.sample.data()), width);
+        }
+        if (!out) {
+            throw std::runtime_error("Unable to write file "s + temp_file.string());
+        }
+    }
+    std::filesystem::rename(temp_file, file);
+}
+
+std::span<const uint8_t> SampleCache::Find(const SampleFileInfo& info) const {
+    auto it = records_.find(info.path);
+    if (it == records_.end() || it->second.size != info.size || it->second.mtime != info.mtime) {
+        return {};
+    }
+    return {it->second.sample, width_};
+}
+
+size_t SampleCache::GetSize() const {
+    return records_.size();
+}
+
+namespace tests {
+
+void SampleCacheRejectsDamagedFiles() {
+    namespace fs = std::filesystem;
+    const fs::path file = fs::temp_directory_path() / "sample_cache_test.samples_cache";
+    // Path lengths that don't end the path table on the alignment of the samples
+    std::vector<SampleFileInfo> infos;
+    std::vector<std::vector<uint8_t>> samples;
+    std::vector<SampleCache::Entry> entries;
+    for (int i = 0; i < 5; ++i) {
+        infos.push_back({"label/glyph_"s + std::to_string(i * 37) + ".bmp"s, 100u + i, 1000 + i});
+        samples.emplace_back(16, static_cast<uint8_t>(i + 1));
+    }
+    for (size_t i = 0; i < infos.size(); ++i) {
+        entries.push_back({&infos[i], samples[i]});
+    }
+    SampleCache::Write(file, 16, entries);
+    {
+        const std::unique_ptr<SampleCache> cache = SampleCache::Open(file, 16);
+        assert(cache && cache->GetSize() == infos.size());
+        [[maybe_unused]] std::span<const uint8_t> sample = cache->Find(infos[3]);
+        assert(std::ranges::equal(sample, samples[3]));
+        assert(!SampleCache::Open(file, 32));
+    }
+
+    // Truncated at the end of the path table, before the padding of the samples
+    size_t paths_end = sizeof(CacheHeader) + infos.size() * sizeof(CacheRecord);
+    for (const SampleFileInfo& info : infos) {
+        paths_end += info.path.size();
+    }
+    assert(paths_end % samples_alignment != 0);
+    for (size_t size : {paths_end, AlignUp(paths_end), fs::file_size(file) - 1}) {
+        SampleCache::Write(file, 16, entries);
+        fs::resize_file(file, size);
+        assert(!SampleCache::Open(file, 16));
+    }
+
+    // A path table size that wraps the end of the table around
+    SampleCache::Write(file, 16, entries);
+    {
+        CacheHeader header;
+        std::fstream stream(file, std::ios::binary | std::ios::in | std::ios::out);
+        stream.read(reinterpret_cast<char*>(&header), sizeof(header));
+        header.paths_size = ~uint64_t{0} - 100;
+        stream.seekp(0);
+        stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    assert(!SampleCache::Open(file, 16));
+    fs::remove(file);
+}
+
+}
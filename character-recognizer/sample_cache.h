@@ -0,0 +1,69 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+// Packed cache of training samples in the byte form of TrainingDatabase. Together with each sample it
+// keeps the path of the file relative to the training folder, its size and
+// modification time, so that a later build decodes only new and changed
+// files. The cache is mapped to memory when it is read. It is written in
+// the native byte order: a cache made on another platform is just rebuilt
+
+struct SampleFileInfo {
+    std::string path; // relative to the training folder, generic format
+    uint64_t size = 0;
+    int64_t mtime = 0; // ticks of the file clock
+
+    static SampleFileInfo FromEntry(const std::filesystem::directory_entry& entry,
+                                    const std::filesystem::path& folder);
+};
+
+class SampleCache {
+public:
+    struct Entry {
+        const SampleFileInfo* info;
+        std::span<const uint8_t> sample;
+    };
+
+    // Reads the cache of samples of the given width. Returns nullptr
+    // if the file doesn't exist, is damaged or has another format
+    static std::unique_ptr<SampleCache> Open(const std::filesystem::path& file, size_t width);
+
+    // Writes the entries through a temporary file, which replaces
+    // the cache only when it is complete
+    static void Write(const std::filesystem::path& file, size_t width,
+                      std::span<const Entry> entries);
+
+    // Returns the cached sample of the file or an empty span
+    // if there is no such file or it has changed
+    std::span<const uint8_t> Find(const SampleFileInfo& info) const;
+
+    size_t GetSize() const;
+
+private:
+    struct Record {
+        uint64_t size;
+        int64_t mtime;
+        const uint8_t* sample;
+    };
+
+    explicit SampleCache(std::unique_ptr<MappedFile> mapping);
+
+    std::unique_ptr<MappedFile> mapping_;
+    size_t width_ = 0;
+    std::unordered_map<std::string_view, Record> records_;
+};
+
+namespace tests {
+
+void SampleCacheRejectsDamagedFiles();
+
+}
@@ -1,4 +1,5 @@
 #include "snn.h"
+#include "kernels.h"
 
 #include <algorithm>
 #include <cassert>
@@ -6,39 +7,55 @@
 #include <random>
 #include <stdexcept>
 
+SnnLayout::SnnLayout(size_t i_n, size_t h_l, size_t h_n, size_t o_n)
+: i_n(i_n)
+, h_l(h_l)
+, h_n(h_n)
+, o_n(o_n) {
+    strides.resize(h_l + 2);
+    for (size_t l = 0; l < h_l + 2; ++l) {
+        strides[l] = AlignedSize<float>(LayerSize(l));
+    }
+
+    // All weight matrices in one buffer
+    weight_offsets.resize(h_l + 1);
+    for (size_t l = 0; l < h_l + 1; ++l) {
+        weight_offsets[l] = weights_size;
+        weights_size += LayerSize(l + 1) * strides[l];
+    }
+
+    bias_offsets.resize(h_l + 1);
+    for (size_t l = 0; l < h_l + 1; ++l) {
+        bias_offsets[l] = biases_size;
+        biases_size += strides[l + 1];
+    }
+}
+
+size_t SnnLayout::LayerSize(size_t l) const {
+    if (l == 0) {
+        return i_n;
+    } else if (l == h_l + 1) {
+        return o_n;
+    } else {
+        return h_n;
+    }
+}
+
 bool SnnMemento::IsValid() const {
     if (i_n == 0) return false;
     if (h_l == 0) return false;
     if (h_n == 0) return false;
     if (o_n == 0) return false;
+    const SnnLayout layout(i_n, h_l, h_n, o_n);
     if (layers.size() != h_l + 2) return false;
     for (size_t l = 0; l < h_l + 2; ++l) {
-        if (l == 0) {
-            if (layers[l].size() != i_n) return false;
-        } else if (l == h_l + 1) {
-            if (layers[l].size() != o_n) return false;
-        } else {
-            if (layers[l].size() != h_n) return false;
-        }
+        if (layers[l].size() != layout.LayerSize(l)) return false;
     }
     if (weights.size() != h_l + 1) return false;
     for (size_t l = 0; l < h_l + 1; ++l) {
-        if (l == 0) {
-            if (weights[l].size() != h_n) return false;
-            for (const auto& edges : weights[l]) {
-                if (edges.size() != i_n) return false;
-            }
-        } else if (l == h_l) {
-            if (weights[l].size() != o_n) return false;
-            for (const auto& edges : weights[l]) {
-                if (edges.size() != h_n) return false;
-            }
-        } else {
-            if (weights[l].size() != h_n) return false;
-            for (const auto& edges : weights[l]) {
-                if (edges.size() != h_n) return false;
-            }
-        }
+        size_t rows = layout.LayerSize(l + 1);
+        size_t cols = layout.LayerSize(l);
+        if (weights[l].size() != rows * cols) return false;
     }
     if (biases.size() != h_l + 1) return false;
     if (errors.size() != h_l + 1) return false;
@@ -60,59 +77,50 @@ Snn::Snn(size_t i_n, size_t h_l, size_t h_n, size_t o_n)
     assert(h_n > 0);
     assert(o_n > 0);
 
-    // Initialize the output layers
-    layers_.resize(h_l + 2);
-    for (size_t l = 0; l < h_l + 2; ++l) {
-        if (l == 0) {
-            layers_[l].resize(i_n);
-        } else if (l == h_l + 1) {
-            layers_[l].resize(o_n);
-        } else {
-            layers_[l].resize(h_n);
-        }
-    }
-
-    // Initialize the weights
-    weights_.resize(h_l + 1);
-    for (size_t l = 0; l < h_l + 1; ++l) {
-        if (l == 0) {
-            weights_[l].resize(h_n);
-            for (auto& edges : weights_[l]) {
-                edges.resize(i_n);
-            }
-        } else if (l == h_l) {
-            weights_[l].resize(o_n);
-            for (auto& edges : weights_[l]) {
-                edges.resize(h_n);
-            }
-        } else {
-            weights_[l].resize(h_n);
-            for (auto& edges : weights_[l]) {
-                edges.resize(h_n);
-            }
-        }
-    }
-
-    // Initialize biases and errors
-    biases_.resize(h_l + 1);
-    errors_.resize(h_l + 1);
-    for (size_t l = 0; l <= h_l; ++l) {
-        size_t layer_size = (l == h_l) ? o_n : h_n;
-        biases_[l].resize(layer_size);
-        errors_[l].resize(layer_size);
-    }
+    AllocateStorage();
 }
 
 Snn::Snn(const SnnMemento& memento) {
     RestoreFromMemento(memento);
 }
 
+Snn::Snn(const SnnLayout& layout, float eta, const float* weights, const float* biases,
+         std::shared_ptr<const void> storage)
+: i_n_(layout.i_n)
+, h_l_(layout.h_l)
+, h_n_(layout.h_n)
+, o_n_(layout.o_n)
+, eta_(eta) {
+    AllocateStorage();
+    // The own parameter buffers are not needed
+    weights_ = AlignedVector<float>();
+    biases_ = AlignedVector<float>();
+    storage_ = std::move(storage);
+    weights_view_ = weights;
+    biases_view_ = biases;
+}
+
 SnnMemento Snn::CreateMemento() const {
     SnnMemento memento;
-    memento.layers = layers_;
-    memento.weights = weights_;
-    memento.biases = biases_;
-    memento.errors = errors_;
+    memento.layers.resize(h_l_ + 2);
+    for (size_t l = 0; l < h_l_ + 2; ++l) {
+        memento.layers[l].assign(Layer(l), Layer(l) + layout_.LayerSize(l));
+    }
+    memento.weights.resize(h_l_ + 1);
+    memento.biases.resize(h_l_ + 1);
+    memento.errors.resize(h_l_ + 1);
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const size_t rows = layout_.LayerSize(l + 1);
+        const size_t cols = layout_.LayerSize(l);
+        auto& matrix = memento.weights[l];
+        matrix.resize(rows * cols);
+        for (size_t i = 0; i < rows; ++i) {
+            const float* row = Weights(l) + i * layout_.strides[l];
+            std::copy(row, row + cols, matrix.begin() + i * cols);
+        }
+        memento.biases[l].assign(Biases(l), Biases(l) + rows);
+        memento.errors[l].assign(Errors(l), Errors(l) + rows);
+    }
     memento.i_n = i_n_;
     memento.h_l = h_l_;
     memento.h_n = h_n_;
@@ -121,6 +129,25 @@ SnnMemento Snn::CreateMemento() const {
     return memento;
 }
 
+Snn Snn::CreateSnapshot() const {
+    // Weights and biases in one buffer, both parts keep the alignment
+    auto parameters = std::make_shared<AlignedVector<float>>(layout_.weights_size + layout_.biases_size);
+    std::copy_n(Weights(0), layout_.weights_size, parameters->begin());
+    std::copy_n(Biases(0), layout_.biases_size, parameters->begin() + layout_.weights_size);
+    const float* weights = parameters->data();
+    Snn snapshot(layout_, eta_, weights, weights + layout_.weights_size, std::move(parameters));
+    snapshot.sigmoid_ = sigmoid_;
+    return snapshot;
+}
+
+void Snn::CopyParameters(const Snn& source) {
+    assert(!storage_);
+    assert(source.layout_.weights_size == layout_.weights_size);
+    assert(source.layout_.biases_size == layout_.biases_size);
+    std::copy_n(source.Weights(0), layout_.weights_size, weights_.begin());
+    std::copy_n(source.Biases(0), layout_.biases_size, biases_.begin());
+}
+
 void Snn::RestoreFromMemento(const SnnMemento& memento) {
     using namespace std::literals;
     if (!memento.IsValid()) {
@@ -128,25 +155,39 @@ void Snn::RestoreFromMemento(const SnnMemento& memento) {
                                  "The data format is not correct"s);
     }
 
-    layers_ = memento.layers;
-    weights_ = memento.weights;
-    biases_ = memento.biases;
-    errors_ = memento.errors;
     i_n_ = memento.i_n;
     h_l_ = memento.h_l;
     h_n_ = memento.h_n;
     o_n_ = memento.o_n;
     eta_ = memento.eta;
+    AllocateStorage();
+
+    for (size_t l = 0; l < h_l_ + 2; ++l) {
+        std::copy(memento.layers[l].begin(), memento.layers[l].end(), Layer(l));
+    }
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const size_t rows = layout_.LayerSize(l + 1);
+        const size_t cols = layout_.LayerSize(l);
+        const auto& matrix = memento.weights[l];
+        for (size_t i = 0; i < rows; ++i) {
+            auto row = matrix.begin() + i * cols;
+            std::copy(row, row + cols, Weights(l) + i * layout_.strides[l]);
+        }
+        std::copy(memento.biases[l].begin(), memento.biases[l].end(), Biases(l));
+        std::copy(memento.errors[l].begin(), memento.errors[l].end(), Errors(l));
+    }
 }
 
 void Snn::InitializeWeightsWithRandom() {
     std::random_device rd;
     std::default_random_engine e2(rd());
     std::normal_distribution<float> dist(0, std::sqrt(2.0f / h_n_));
-    for (auto& layer : weights_) {
-        for (auto& row : layer) {
-            for (auto& weight : row) {
-                weight = dist(e2);
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        // The padding must stay zero
+        for (size_t i = 0; i < layout_.LayerSize(l + 1); ++i) {
+            float* row = Weights(l) + i * layout_.strides[l];
+            for (size_t j = 0; j < layout_.LayerSize(l); ++j) {
+                row[j] = dist(e2);
             }
         }
     }
@@ -156,89 +197,442 @@ void Snn::InitializeBiasesWithRandom(float min, float max) {
     std::random_device rd;
     std::default_random_engine e2(rd());
     std::uniform_real_distribution<float> dist(min, max);
-    for (auto& layer : biases_) {
-        for (auto& bias : layer) {
-            bias = dist(e2);
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        float* biases = Biases(l);
+        for (size_t i = 0; i < layout_.LayerSize(l + 1); ++i) {
+            biases[i] = dist(e2);
         }
     }
 }
 
-void Snn::CalculateOutput(const std::vector<float>& input) noexcept {
+namespace {
+
+void ExpandBytes(const uint8_t* bytes, float scale, float* values, size_t count) noexcept {
+    for (size_t i = 0; i < count; ++i) {
+        values[i] = bytes[i] * scale;
+    }
+}
+
+}
+
+void Snn::CalculateOutput(std::span<const float> input) noexcept {
     assert(input.size() == i_n_);
-    layers_.front() = input;
+    std::copy(input.begin(), input.end(), Layer(0));
+    Forward(workspace_);
+}
 
-    // Calculate layers outputs
+void Snn::CalculateOutput(std::span<const uint8_t> input, float scale) noexcept {
+    assert(input.size() == i_n_);
+    ExpandBytes(input.data(), scale, Layer(0), i_n_);
+    Forward(workspace_);
+}
+
+SnnWorkspace Snn::CreateWorkspace() const {
+    SnnWorkspace workspace;
+    size_t size = 0;
+    workspace.layer_offsets.resize(h_l_ + 2);
+    for (size_t l = 0; l < h_l_ + 2; ++l) {
+        workspace.layer_offsets[l] = size;
+        size += layout_.strides[l];
+    }
+    workspace.error_offsets.resize(h_l_ + 1);
     for (size_t l = 0; l < h_l_ + 1; ++l) {
-        for (size_t i = 0; i < layers_[l + 1].size(); ++i) {
-            float net_i = 0;
-            for (size_t j = 0; j < layers_[l].size(); ++j) {
-                net_i += weights_[l][i][j] * layers_[l][j];
-            }
-            net_i += biases_[l][i];
-            layers_[l + 1][i] = 1.0f / (1.0f + std::exp(-net_i)); // sigmoid activation
+        workspace.error_offsets[l] = size;
+        size += layout_.strides[l + 1];
+    }
+    workspace.arena.assign(size, 0.0f);
+    return workspace;
+}
+
+void Snn::Infer(std::span<const float> input, SnnWorkspace& workspace,
+                std::span<float> output) const noexcept {
+    assert(input.size() == i_n_);
+    assert(output.size() == o_n_);
+    assert(workspace.layer_offsets.size() == h_l_ + 2);
+    std::copy(input.begin(), input.end(), Layer(workspace, 0));
+    Forward(workspace);
+    const float* out = Layer(workspace, h_l_ + 1);
+    std::copy(out, out + o_n_, output.begin());
+}
+
+void Snn::Forward(SnnWorkspace& workspace) const noexcept {
+    // Calculate layers outputs from the filled input layer.
+    // The padding of rows and layers is zero,
+    // so the kernels can process whole aligned rows
+    const kernels::KernelSet& k = kernels::Active();
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const float* weights = Weights(l);
+        const float* biases = Biases(l);
+        const float* in = Layer(workspace, l);
+        float* out = Layer(workspace, l + 1);
+        const size_t out_size = layout_.LayerSize(l + 1);
+        for (size_t i = 0; i < out_size; ++i) {
+            const float* row = weights + i * layout_.strides[l];
+            out[i] = k.dot(row, in, layout_.strides[l]);
         }
+        kernels::ApplySigmoid(sigmoid_, biases, out, out_size); // sigmoid activation
     }
 }
 
-float Snn::EvaluateError(const std::vector<float>& target) const {
+float Snn::EvaluateError(std::span<const float> target) const {
     assert(target.size() == o_n_);
 
+    const float* out = Layer(h_l_ + 1);
     float result = 0.0f;
     // Use RMSE (root mean squared error) to calculate
     for (size_t i = 0; i < o_n_; ++i) {
-        float delta = target[i] - layers_.back()[i];
+        float delta = target[i] - out[i];
         result += delta * delta;
     }
     return std::sqrt(result / o_n_);
 }
 
-void Snn::PropagateErrorBack(const std::vector<float>& target) noexcept {
+void Snn::PropagateErrorBack(std::span<const float> target) noexcept {
     assert(target.size() == o_n_);
 
     // Calculate the error on the output layer
-    for (size_t i = 0; i < o_n_; ++i) {
-        float out = layers_.back()[i];
-        float delta = target[i] - out;
-        errors_.back()[i] = out * (1 - out) * delta;
+    {
+        const float* outs = Layer(h_l_ + 1);
+        float* errors = Errors(h_l_);
+        for (size_t i = 0; i < o_n_; ++i) {
+            float out = outs[i];
+            float delta = target[i] - out;
+            errors[i] = out * (1 - out) * delta;
+        }
     }
 
     // Calculate errors for hidden layers
+    const kernels::KernelSet& k = kernels::Active();
     for (int l = h_l_ - 1; l >= 0; --l) {
-        std::fill(errors_[l].begin(), errors_[l].end(), 0.0f);
+        float* errors = Errors(l);
+        const float* errors_next = Errors(l + 1);
+        const float* weights_next = Weights(l + 1);
+        const float* outs = Layer(l + 1);
+        const size_t stride = layout_.strides[l + 1];
+        std::fill(errors, errors + stride, 0.0f);
 
-        for (size_t j = 0; j < errors_[l + 1].size(); ++j) {
-            float error_next = errors_[l + 1][j];
-            for (size_t i = 0; i < h_n_; ++i) {
-                errors_[l][i] += weights_[l + 1][j][i] * error_next;
-            }
+        for (size_t j = 0; j < layout_.LayerSize(l + 2); ++j) {
+            k.axpy(errors_next[j], weights_next + j * stride, errors, stride);
         }
 
         for (size_t i = 0; i < h_n_; ++i) {
-            float out = layers_[l + 1][i];
-            errors_[l][i] *= out * (1 - out);
+            float out = outs[i];
+            errors[i] *= out * (1 - out);
         }
     }
 
     // Update weights
     for (size_t l = 0; l < h_l_ + 1; ++l) {
-        for (size_t i = 0; i < errors_[l].size(); ++i) {
-            float error = errors_[l][i];
-            for (size_t j = 0; j < layers_[l].size(); ++j) {
-                weights_[l][i][j] += eta_ * error * layers_[l][j];
-            }
-            biases_[l][i] += eta_ * error;
+        float* weights = Weights(l);
+        float* biases = Biases(l);
+        const float* errors = Errors(l);
+        const float* in = Layer(l);
+        for (size_t i = 0; i < layout_.LayerSize(l + 1); ++i) {
+            float error = errors[i];
+            k.axpy(eta_ * error, in, weights + i * layout_.strides[l], layout_.strides[l]);
+            biases[i] += eta_ * error;
+        }
+    }
+}
+
+void Snn::CalculateOutputBatch(std::span<const float* const> inputs) {
+    CalculateOutputBatch(inputs, batch_);
+}
+
+void Snn::CalculateOutputBatch(std::span<const uint8_t* const> inputs, float scale) {
+    CalculateOutputBatch(inputs, scale, batch_);
+}
+
+void Snn::PropagateErrorBackBatch(std::span<const float* const> targets) noexcept {
+    PropagateErrorBackBatch(targets, batch_);
+}
+
+void Snn::CalculateOutputBatch(std::span<const float* const> inputs, SnnBatch& batch) const {
+    ReserveBatch(inputs.size(), batch);
+    batch.size = inputs.size();
+
+    float* x = BatchLayer(batch, 0);
+    for (size_t n = 0; n < batch.size; ++n) {
+        std::copy(inputs[n], inputs[n] + i_n_, x + n * layout_.strides[0]);
+    }
+    ForwardBatch(batch);
+}
+
+void Snn::CalculateOutputBatch(std::span<const uint8_t* const> inputs, float scale,
+                               SnnBatch& batch) const {
+    ReserveBatch(inputs.size(), batch);
+    batch.size = inputs.size();
+
+    float* x = BatchLayer(batch, 0);
+    for (size_t n = 0; n < batch.size; ++n) {
+        ExpandBytes(inputs[n], scale, x + n * layout_.strides[0], i_n_);
+    }
+    ForwardBatch(batch);
+}
+
+void Snn::InferBatch(std::span<const float> inputs, SnnBatch& batch,
+                     std::span<float> outputs) const {
+    assert(inputs.size() % i_n_ == 0);
+    const size_t count = inputs.size() / i_n_;
+    assert(outputs.size() == count * o_n_);
+    ReserveBatch(count, batch);
+    batch.size = count;
+
+    float* x = BatchLayer(batch, 0);
+    for (size_t n = 0; n < count; ++n) {
+        std::copy_n(inputs.begin() + n * i_n_, i_n_, x + n * layout_.strides[0]);
+    }
+    ForwardBatch(batch);
+
+    const size_t stride = layout_.strides[h_l_ + 1];
+    const float* out = BatchLayer(batch, h_l_ + 1);
+    for (size_t n = 0; n < count; ++n) {
+        std::copy_n(out + n * stride, o_n_, outputs.begin() + n * o_n_);
+    }
+}
+
+void Snn::ForwardBatch(SnnBatch& batch) const noexcept {
+    // Calculate layers outputs for all samples at once
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const size_t out_size = layout_.LayerSize(l + 1);
+        const size_t out_stride = layout_.strides[l + 1];
+        const float* biases = Biases(l);
+        float* out = BatchLayer(batch, l + 1);
+        kernels::GemmNt(BatchLayer(batch, l), layout_.strides[l], Weights(l), layout_.strides[l],
+                        out, out_stride, batch.size, out_size, layout_.strides[l]);
+        for (size_t n = 0; n < batch.size; ++n) {
+            kernels::ApplySigmoid(sigmoid_, biases, out + n * out_stride, out_size); // sigmoid activation
         }
     }
 }
 
-const std::vector<float>& Snn::ReadOutput() const {
-    return layers_.back();
+void Snn::PropagateErrorBackBatch(std::span<const float* const> targets, SnnBatch& batch) noexcept {
+    assert(!storage_);
+    CalculateErrorsBatch(targets, batch);
+    // Update weights with the gradients summed over the batch
+    AddGradientBatch(batch, eta_, weights_.data(), biases_.data());
+}
+
+void Snn::AccumulateGradientBatch(std::span<const float* const> targets, SnnBatch& batch) const {
+    if (batch.weight_gradients.size() != weights_.size()) {
+        batch.weight_gradients.assign(weights_.size(), 0.0f);
+        batch.bias_gradients.assign(biases_.size(), 0.0f);
+    }
+    CalculateErrorsBatch(targets, batch);
+    AddGradientBatch(batch, 1.0f, batch.weight_gradients.data(), batch.bias_gradients.data());
+    batch.accumulated += batch.size;
+}
+
+void Snn::ApplyGradients(std::span<SnnBatch* const> batches) noexcept {
+    assert(!storage_);
+    const kernels::KernelSet& k = kernels::Active();
+    // Threads without samples in the step (the last one is usually partial)
+    // don't take part in the average
+    const size_t contributed = std::count_if(batches.begin(), batches.end(),
+                                             [](const SnnBatch* batch) { return batch->accumulated > 0; });
+    if (contributed == 0) {
+        return;
+    }
+    const float scale = eta_ / contributed;
+    for (SnnBatch* batch : batches) {
+        if (batch->accumulated == 0) {
+            continue;
+        }
+        batch->accumulated = 0;
+        k.axpy(scale, batch->weight_gradients.data(), weights_.data(), weights_.size());
+        k.axpy(scale, batch->bias_gradients.data(), biases_.data(), biases_.size());
+        std::fill(batch->weight_gradients.begin(), batch->weight_gradients.end(), 0.0f);
+        std::fill(batch->bias_gradients.begin(), batch->bias_gradients.end(), 0.0f);
+    }
+}
+
+std::span<const float> Snn::ReadOutput() const {
+    return {Layer(h_l_ + 1), o_n_};
+}
+
+std::span<const float> Snn::ReadOutputBatch(size_t n) const {
+    return ReadOutputBatch(batch_, n);
+}
+
+std::span<const float> Snn::ReadOutputBatch(const SnnBatch& batch, size_t n) const {
+    assert(n < batch.size);
+    return {BatchLayer(batch, h_l_ + 1) + n * layout_.strides[h_l_ + 1], o_n_};
 }
 
 void Snn::SetLearningCoefficient(float eta) {
     eta_ = eta;
 }
 
+float Snn::GetLearningCoefficient() const {
+    return eta_;
+}
+
+const SnnLayout& Snn::GetLayout() const {
+    return layout_;
+}
+
+std::span<const float> Snn::GetWeights() const {
+    return {Weights(0), layout_.weights_size};
+}
+
+std::span<const float> Snn::GetBiases() const {
+    return {Biases(0), layout_.biases_size};
+}
+
+void Snn::SetSigmoid(kernels::Sigmoid sigmoid) {
+    sigmoid_ = sigmoid;
+}
+
+kernels::Sigmoid Snn::GetSigmoid() const {
+    return sigmoid_;
+}
+
+void Snn::AllocateStorage() {
+    layout_ = SnnLayout(i_n_, h_l_, h_n_, o_n_);
+    weights_.assign(layout_.weights_size, 0.0f);
+    biases_.assign(layout_.biases_size, 0.0f);
+    storage_.reset();
+    weights_view_ = nullptr;
+    biases_view_ = nullptr;
+
+    workspace_ = CreateWorkspace();
+
+    // Batch buffers are reallocated for the new sizes on demand
+    batch_ = SnnBatch();
+}
+
+void Snn::ReserveBatch(size_t batch_size, SnnBatch& batch) const {
+    if (batch_size <= batch.capacity && batch.layer_offsets.size() == h_l_ + 2) {
+        return;
+    }
+    batch.capacity = batch_size;
+
+    // Layers, then errors, each of them is [capacity x stride]
+    size_t size = 0;
+    batch.layer_offsets.resize(h_l_ + 2);
+    for (size_t l = 0; l < h_l_ + 2; ++l) {
+        batch.layer_offsets[l] = size;
+        size += batch.capacity * layout_.strides[l];
+    }
+    batch.error_offsets.resize(h_l_ + 1);
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        batch.error_offsets[l] = size;
+        size += batch.capacity * layout_.strides[l + 1];
+    }
+    // Zeros in the padding are required by the kernels
+    batch.arena.assign(size, 0.0f);
+}
+
+void Snn::CalculateErrorsBatch(std::span<const float* const> targets, SnnBatch& batch) const {
+    assert(targets.size() == batch.size);
+
+    // Calculate the errors on the output layer
+    {
+        const size_t stride = layout_.strides[h_l_ + 1];
+        const float* outs = BatchLayer(batch, h_l_ + 1);
+        float* errors = BatchErrors(batch, h_l_);
+        for (size_t n = 0; n < batch.size; ++n) {
+            for (size_t i = 0; i < o_n_; ++i) {
+                float out = outs[n * stride + i];
+                float delta = targets[n][i] - out;
+                errors[n * stride + i] = out * (1 - out) * delta;
+            }
+        }
+    }
+
+    // Calculate errors for hidden layers
+    for (int l = h_l_ - 1; l >= 0; --l) {
+        const size_t stride = layout_.strides[l + 1];
+        float* errors = BatchErrors(batch, l);
+        const float* outs = BatchLayer(batch, l + 1);
+        std::fill(errors, errors + batch.size * stride, 0.0f);
+        kernels::GemmNnAcc(BatchErrors(batch, l + 1), layout_.strides[l + 2], Weights(l + 1), stride,
+                           errors, stride, batch.size, stride, layout_.LayerSize(l + 2));
+        for (size_t n = 0; n < batch.size; ++n) {
+            for (size_t i = 0; i < h_n_; ++i) {
+                float out = outs[n * stride + i];
+                errors[n * stride + i] *= out * (1 - out);
+            }
+        }
+    }
+}
+
+// Adds eta * gradient summed over the batch to the buffers
+// with the layout of the weights and biases
+void Snn::AddGradientBatch(const SnnBatch& batch, float eta,
+                           float* weights, float* biases) const noexcept {
+    for (size_t l = 0; l < h_l_ + 1; ++l) {
+        const size_t out_size = layout_.LayerSize(l + 1);
+        const size_t out_stride = layout_.strides[l + 1];
+        const float* errors = BatchErrors(batch, l);
+        kernels::GemmTnAcc(eta, errors, out_stride, BatchLayer(batch, l), layout_.strides[l],
+                           weights + layout_.weight_offsets[l], layout_.strides[l],
+                           out_size, layout_.strides[l], batch.size);
+        float* layer_biases = biases + layout_.bias_offsets[l];
+        for (size_t i = 0; i < out_size; ++i) {
+            float sum = 0.0f;
+            for (size_t n = 0; n < batch.size; ++n) {
+                sum += errors[n * out_stride + i];
+            }
+            layer_biases[i] += eta * sum;
+        }
+    }
+}
+
+float* Snn::Weights(size_t l) {
+    assert(!storage_); // parameters used in place are read-only
+    return weights_.data() + layout_.weight_offsets[l];
+}
+
+const float* Snn::Weights(size_t l) const {
+    return (storage_ ? weights_view_ : weights_.data()) + layout_.weight_offsets[l];
+}
+
+float* Snn::Layer(size_t l) {
+    return workspace_.arena.data() + workspace_.layer_offsets[l];
+}
+
+const float* Snn::Layer(size_t l) const {
+    return workspace_.arena.data() + workspace_.layer_offsets[l];
+}
+
+float* Snn::Layer(SnnWorkspace& workspace, size_t l) const {
+    return workspace.arena.data() + workspace.layer_offsets[l];
+}
+
+float* Snn::Biases(size_t l) {
+    assert(!storage_); // parameters used in place are read-only
+    return biases_.data() + layout_.bias_offsets[l];
+}
+
+const float* Snn::Biases(size_t l) const {
+    return (storage_ ? biases_view_ : biases_.data()) + layout_.bias_offsets[l];
+}
+
+float* Snn::Errors(size_t l) {
+    return workspace_.arena.data() + workspace_.error_offsets[l];
+}
+
+const float* Snn::Errors(size_t l) const {
+    return workspace_.arena.data() + workspace_.error_offsets[l];
+}
+
+float* Snn::BatchLayer(SnnBatch& batch, size_t l) const {
+    return batch.arena.data() + batch.layer_offsets[l];
+}
+
+const float* Snn::BatchLayer(const SnnBatch& batch, size_t l) const {
+    return batch.arena.data() + batch.layer_offsets[l];
+}
+
+float* Snn::BatchErrors(SnnBatch& batch, size_t l) const {
+    return batch.arena.data() + batch.error_offsets[l];
+}
+
+const float* Snn::BatchErrors(const SnnBatch& batch, size_t l) const {
+    return batch.arena.data() + batch.error_offsets[l];
+}
+
 namespace tests {
 
 void Propagate() {
@@ -265,10 +659,65 @@ void Propagate() {
     for (size_t i = 0; i < 10; ++i) {
         set_unit(resources, i);
         snn.CalculateOutput(resources);
-        const std::vector<float>& output = snn.ReadOutput();
+        std::span<const float> output = snn.ReadOutput();
         auto it = std::max_element(output.begin(), output.end());
         size_t index = it - output.begin(); // NOLINT
         assert(index == 9 - i);
     }
 }
+
+void PropagateBatch() {
+    // All ten samples of the flip task are one batch
+    std::vector<std::vector<float>> inputs(10, std::vector<float>(10, 0.0f));
+    std::vector<std::vector<float>> targets(10, std::vector<float>(10, 0.0f));
+    std::vector<const float*> input_ptrs;
+    std::vector<const float*> target_ptrs;
+    for (size_t i = 0; i < 10; ++i) {
+        inputs[i][i] = 1;
+        targets[i][9 - i] = 1;
+        input_ptrs.push_back(inputs[i].data());
+        target_ptrs.push_back(targets[i].data());
+    }
+
+    Snn snn(10, 1, 10, 10);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    snn.SetLearningCoefficient(0.5f);
+
+    for (size_t t = 0; t < 1000; ++t) {
+        snn.CalculateOutputBatch(input_ptrs);
+        snn.PropagateErrorBackBatch(target_ptrs);
+    }
+
+    for (size_t i = 0; i < 10; ++i) {
+        snn.CalculateOutput(inputs[i]);
+        std::span<const float> output = snn.ReadOutput();
+        auto it = std::max_element(output.begin(), output.end());
+        [[maybe_unused]] size_t index = it - output.begin(); // NOLINT
+        assert(index == 9 - i);
+    }
+
+    // A step where the second thread has no samples is the step of the first one alone
+    Snn both(snn.CreateMemento());
+    Snn alone(snn.CreateMemento());
+    SnnBatch first;
+    SnnBatch second;
+    SnnBatch* first_ptr = &first;
+    std::span<const float* const> half_inputs(input_ptrs.data(), 5);
+    std::span<const float* const> half_targets(target_ptrs.data(), 5);
+    both.CalculateOutputBatch(half_inputs, second);
+    both.AccumulateGradientBatch(half_targets, second);
+    std::fill(second.weight_gradients.begin(), second.weight_gradients.end(), 0.0f);
+    std::fill(second.bias_gradients.begin(), second.bias_gradients.end(), 0.0f);
+    second.accumulated = 0; // as after an earlier step
+    both.CalculateOutputBatch(half_inputs, first);
+    both.AccumulateGradientBatch(half_targets, first);
+    const std::vector<SnnBatch*> both_batches = {&first, &second};
+    both.ApplyGradients(both_batches);
+    alone.CalculateOutputBatch(half_inputs, first);
+    alone.AccumulateGradientBatch(half_targets, first);
+    alone.ApplyGradients({&first_ptr, 1});
+    assert(both.CreateMemento().weights == alone.CreateMemento().weights);
+    assert(both.CreateMemento().biases == alone.CreateMemento().biases);
 }
+}
\ No newline at end of file
@@ -1,12 +1,46 @@
 #pragma once
 
+#include "aligned_allocator.h"
+#include "kernels.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <span>
 #include <vector>
 
+// Placement of the network parameters in memory and in model files.
+// Weight matrices are row-major [next layer x previous layer],
+// their rows and the bias vectors are padded with zeros to the alignment
+class SnnLayout {
+public:
+    SnnLayout() = default;
+    SnnLayout(size_t i_n, size_t h_l, size_t h_n, size_t o_n);
+
+    // Size of layer l (l == 0 is the input layer, l == h_l + 1 is the output layer)
+    size_t LayerSize(size_t l) const;
+
+    size_t i_n = 0;
+    size_t h_l = 0;
+    size_t h_n = 0;
+    size_t o_n = 0;
+
+    // Aligned sizes of layers (row strides of weight matrices)
+    std::vector<size_t> strides;
+
+    // Offsets of the layers in the weight and bias buffers, in floats
+    std::vector<size_t> weight_offsets;
+    std::vector<size_t> bias_offsets;
+    size_t weights_size = 0;
+    size_t biases_size = 0;
+};
+
 class SnnMemento {
 public:
     bool IsValid() const;
     std::vector<std::vector<float>> layers;
-    std::vector<std::vector<std::vector<float>>> weights;
+    // One dense row-major matrix [next layer x previous layer] per layer
+    std::vector<std::vector<float>> weights;
     std::vector<std::vector<float>> biases;
     std::vector<std::vector<float>> errors;
     size_t i_n;
@@ -16,6 +50,36 @@ public:
     float eta;
 };
 
+// Buffers of one caller of the network: outputs of all layers
+// and errors of hidden and output layers. Every block is aligned
+// and padded with zeros the same way as the weight rows.
+// It is created by Snn::CreateWorkspace
+class SnnWorkspace {
+public:
+    AlignedVector<float> arena;
+    std::vector<size_t> layer_offsets;
+    std::vector<size_t> error_offsets;
+};
+
+// Buffers for the mini-batch passes of Snn. Every training
+// thread has its own, the layout is managed by Snn
+class SnnBatch {
+public:
+    // Outputs of all layers, then errors of hidden and output layers
+    // for each sample, [capacity x stride] each
+    AlignedVector<float> arena;
+    std::vector<size_t> layer_offsets;
+    std::vector<size_t> error_offsets;
+    size_t capacity = 0;
+    size_t size = 0;
+
+    // Gradients accumulated since the last ApplyGradients and the number
+    // of their samples. They have the layout of the weights and biases of Snn
+    AlignedVector<float> weight_gradients;
+    AlignedVector<float> bias_gradients;
+    size_t accumulated = 0;
+};
+
 // Simple neural network
 class Snn {
 public:
@@ -24,31 +88,107 @@ public:
 
     Snn(size_t i_n, size_t h_l, size_t h_n, size_t o_n);
     Snn(const SnnMemento& memento);
+
+    // Network that uses the parameters in place, without copying.
+    // They must be placed according to the layout, the storage
+    // keeps them alive. Such a network can be used only for inference
+    Snn(const SnnLayout& layout, float eta, const float* weights, const float* biases,
+        std::shared_ptr<const void> storage);
     SnnMemento CreateMemento() const;
+    // Inference-only network with a copy of the parameters and
+    // without the training buffers, e.g. to evaluate the network
+    // in another thread while the training goes on
+    Snn CreateSnapshot() const;
+    // Takes the weights and biases of a network of the same shape
+    void CopyParameters(const Snn& source);
     void RestoreFromMemento(const SnnMemento& memento);
 
     void InitializeWeightsWithRandom();
     void InitializeBiasesWithRandom(float min = 0.0f, float max = 0.1f);
 
-    void CalculateOutput(const std::vector<float>& input) noexcept;
-    float EvaluateError(const std::vector<float>& target) const;
-    void PropagateErrorBack(const std::vector<float>& target) noexcept;
-    const std::vector<float>& ReadOutput() const;
+    void CalculateOutput(std::span<const float> input) noexcept;
+    // Input stored as bytes, the input values are byte * scale.
+    // The bytes are converted while filling the input layer
+    void CalculateOutput(std::span<const uint8_t> input, float scale) noexcept;
+    float EvaluateError(std::span<const float> target) const;
+    void PropagateErrorBack(std::span<const float> target) noexcept;
+    std::span<const float> ReadOutput() const;
+
+    // Thread-safe inference: the network parameters are only read,
+    // all intermediate values are kept in the workspace of the caller.
+    // Many threads may call it for one network, each with its own workspace
+    SnnWorkspace CreateWorkspace() const;
+    void Infer(std::span<const float> input, SnnWorkspace& workspace,
+               std::span<float> output) const noexcept;
+
+    // Mini-batch training. The forward and backward passes are
+    // matrix products over all samples of the batch, the gradients
+    // are summed and applied once. Each input has i_n values,
+    // each target has o_n values
+    void CalculateOutputBatch(std::span<const float* const> inputs);
+    void CalculateOutputBatch(std::span<const uint8_t* const> inputs, float scale);
+    void PropagateErrorBackBatch(std::span<const float* const> targets) noexcept;
+    // Outputs of sample n of the last forward pass of the batch
+    std::span<const float> ReadOutputBatch(size_t n) const;
+
+    // Data-parallel training, every thread passes its own buffers.
+    // PropagateErrorBackBatch updates the shared weights without
+    // locking (Hogwild). AccumulateGradientBatch doesn't change
+    // the weights; ApplyGradients then applies the average of
+    // the gradients of the threads that had samples and clears them
+    void CalculateOutputBatch(std::span<const float* const> inputs, SnnBatch& batch) const;
+    void CalculateOutputBatch(std::span<const uint8_t* const> inputs, float scale,
+                              SnnBatch& batch) const;
+    void PropagateErrorBackBatch(std::span<const float* const> targets, SnnBatch& batch) noexcept;
+    void AccumulateGradientBatch(std::span<const float* const> targets, SnnBatch& batch) const;
+    void ApplyGradients(std::span<SnnBatch* const> batches) noexcept;
+    std::span<const float> ReadOutputBatch(const SnnBatch& batch, size_t n) const;
+
+    // Batched inference: scores K inputs, a row-major matrix [K x i_n],
+    // with matrix products over the whole batch and writes the
+    // outputs [K x o_n]. Thread-safe like Infer, if every caller
+    // has its own batch buffers
+    void InferBatch(std::span<const float> inputs, SnnBatch& batch,
+                    std::span<float> outputs) const;
 
     void SetLearningCoefficient(float eta);
+    float GetLearningCoefficient() const;
+
+    // Parameters placed as in the layout, e.g. to save
+    // them without the copying of a memento
+    const SnnLayout& GetLayout() const;
+    std::span<const float> GetWeights() const;
+    std::span<const float> GetBiases() const;
+
+    // Implementation of the activation of all passes, the exact one by
+    // default. It isn't a part of the saved state
+    void SetSigmoid(kernels::Sigmoid sigmoid);
+    kernels::Sigmoid GetSigmoid() const;
 
 private:
-    // Layers
-    std::vector<std::vector<float>> layers_;
-    
-    // Weights between layers
-    std::vector<std::vector<std::vector<float>>> weights_;
+    // Placement of weights and biases
+    SnnLayout layout_;
+
+    // Weights between layers. Each layer is a row-major matrix
+    // [next layer x previous layer], all of them are in one buffer.
+    // Rows are padded with zeros to the alignment boundary
+    AlignedVector<float> weights_;
+
+    // Biases for each hidden and output layer in one buffer,
+    // aligned and padded the same way as the weight rows
+    AlignedVector<float> biases_;
 
-    // Biases for each hidden and output layer
-    std::vector<std::vector<float>> biases_;
+    // Parameters used in place instead of the own buffers
+    // (the storage is nullptr for own parameters)
+    std::shared_ptr<const void> storage_;
+    const float* weights_view_ = nullptr;
+    const float* biases_view_ = nullptr;
 
-    // Errors for each hidden and output layer
-    std::vector<std::vector<float>> errors_;
+    // Buffers of the per-sample training and of CalculateOutput
+    SnnWorkspace workspace_;
+
+    // Buffers of the single-threaded mini-batch training
+    SnnBatch batch_;
 
     // Network parameters
     size_t i_n_; // number of input neurons
@@ -56,10 +196,34 @@ private:
     size_t h_n_; // number of neurons in hidden layer
     size_t o_n_; // number of output neurons
     float eta_ = 0.5f; // learning coefficient [0..1]
+    kernels::Sigmoid sigmoid_ = kernels::Sigmoid::EXACT;
+
+    void AllocateStorage();
+    void Forward(SnnWorkspace& workspace) const noexcept;
+    void ReserveBatch(size_t batch_size, SnnBatch& batch) const;
+    void ForwardBatch(SnnBatch& batch) const noexcept;
+    void CalculateErrorsBatch(std::span<const float* const> targets, SnnBatch& batch) const;
+    void AddGradientBatch(const SnnBatch& batch, float eta,
+                          float* weights, float* biases) const noexcept;
+
+    float* Weights(size_t l);
+    const float* Weights(size_t l) const;
+    float* Layer(size_t l);
+    const float* Layer(size_t l) const;
+    float* Layer(SnnWorkspace& workspace, size_t l) const;
+    float* Biases(size_t l);
+    const float* Biases(size_t l) const;
+    float* Errors(size_t l);
+    const float* Errors(size_t l) const;
+    float* BatchLayer(SnnBatch& batch, size_t l) const;
+    const float* BatchLayer(const SnnBatch& batch, size_t l) const;
+    float* BatchErrors(SnnBatch& batch, size_t l) const;
+    const float* BatchErrors(const SnnBatch& batch, size_t l) const;
 };
 
 namespace tests {
 
 void Propagate();
+void PropagateBatch();
 
 }
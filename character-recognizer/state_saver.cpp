@@ -1,17 +1,24 @@
 #include "state_saver.h"
+#include "mapped_file.h"
 
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
 #include <fstream>
 #include <stdexcept>
 #include <vector>
 
+#if defined(__unix__) || defined(__APPLE__)
+    #define STATE_SAVER_POSIX
+    #include <fcntl.h>
+    #include <unistd.h>
+#endif
+
 using namespace std::literals;
 
-template <typename T>
-void SaveVector(std::ofstream& out, const std::vector<T>& vec) {
-    size_t size = vec.size();
-    out.write(reinterpret_cast<const char*>(&size), sizeof(size));
-    out.write(reinterpret_cast<const char*>(vec.data()), size * sizeof(T));
-}
+namespace {
 
 template <typename T>
 void LoadVector(std::ifstream& in, std::vector<T>& vec) {
@@ -21,54 +28,161 @@ void LoadVector(std::ifstream& in, std::vector<T>& vec) {
     in.read(reinterpret_cast<char*>(vec.data()), size * sizeof(T));
 }
 
-constexpr uint32_t current_version = 0x24052823;
-
-void SaveSnnState(const std::filesystem::path& file, const SnnMemento& state) {
-    std::ofstream out(file, std::ios::binary);
-    if (!out) {
-        throw std::runtime_error("Unable to open file "s + file.string() + " for saving state"s);
+// Rows of a weight matrix are stored as separate vectors
+void LoadRows(std::ifstream& in, std::vector<float>& matrix, size_t rows, size_t cols) {
+    matrix.resize(rows * cols);
+    for (size_t i = 0; i < rows; ++i) {
+        size_t size;
+        in.read(reinterpret_cast<char*>(&size), sizeof(size));
+        if (!in || size != cols) {
+            throw std::runtime_error("Unexpected size of the weight matrix row"s);
+        }
+        in.read(reinterpret_cast<char*>(matrix.data() + i * cols), cols * sizeof(float));
     }
+}
 
-    out.write(reinterpret_cast<const char*>(&current_version), sizeof(current_version));
+// Version with size_t-prefixed vectors in the native byte order
+constexpr uint32_t first_version = 0x24052823;
 
-    // Write snn memento
-    out.write(reinterpret_cast<const char*>(&state.i_n), sizeof(state.i_n));
-    out.write(reinterpret_cast<const char*>(&state.h_l), sizeof(state.h_l));
-    out.write(reinterpret_cast<const char*>(&state.h_n), sizeof(state.h_n));
-    out.write(reinterpret_cast<const char*>(&state.o_n), sizeof(state.o_n));
-    out.write(reinterpret_cast<const char*>(&state.eta), sizeof(state.eta));
+// Mappable version. All numbers are little-endian.
+// Header:
+//  offset size
+//     0    4  version
+//     4    4  header size (64)
+//     8    8  i_n
+//    16    8  h_l
+//    24    8  h_n
+//    32    8  o_n
+//    40    4  eta (IEEE 754 binary32)
+//    44    4  alignment of the blocks (64)
+//    48    8  size of the data after the header in bytes
+//    56    8  checksum of the data
+// Data: weight matrices, then biases, placed as in SnnLayout
+constexpr uint32_t current_version = 0x26101600;
+constexpr size_t header_size = 64;
 
-    for (const auto& layer : state.layers) {
-        SaveVector(out, layer);
-    }
+// Limit of each network dimension, protects from corrupted headers
+constexpr uint64_t max_dimension = 1 << 20;
 
-    for (const auto& layer : state.weights) {
-        for (const auto& edges : layer) {
-            SaveVector(out, edges);
-        }
+// Int8 model of QuantizedSnn. All numbers are little-endian.
+// Header: as in the mappable version, without eta (the 4 bytes
+// at offset 40 are zero)
+// Data: int8 weights placed as in QuantizedSnn (the size is a multiple
+// of the alignment), then the scales and the biases (IEEE 754 binary32)
+constexpr uint32_t quantized_version = 0x26101630;
+
+// Checkpoint of the training. All numbers are little-endian.
+// Header:
+//  offset size
+//     0    4  version
+//     4    4  header size (64)
+//     8    8  finished epochs
+//    16    8  epoch of the best network (0 if there is none)
+//    24    8  monitored metric of the best network (IEEE 754 binary64)
+//    32    8  size of the engine state
+//    40    8  size of the model of the network
+//    48    8  size of the model of the best network (0 if there is none)
+//    56    8  checksum of the data
+// Data: the engine state padded with zeros to 8 bytes, then the models
+// of the networks, each is a complete model file of the current version
+constexpr uint32_t checkpoint_version = 0x26101620;
+constexpr uint64_t max_engine_state_size = 1 << 16;
+
+template <typename T>
+void StoreLe(std::byte* dst, T value) {
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        dst[i] = static_cast<std::byte>(value >> (8 * i));
     }
+}
 
-    for (const auto& vec : state.biases) {
-        SaveVector(out, vec);
+template <typename T>
+T LoadLe(const std::byte* src) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(src[i]) << (8 * i);
     }
+    return value;
+}
 
-    for (const auto& vec : state.errors) {
-        SaveVector(out, vec);
+// FNV-1a over little-endian 64-bit words (the size is a multiple of 8)
+uint64_t CalculateChecksum(const std::byte* data, size_t size) {
+    uint64_t hash = 0xcbf29ce484222325ull;
+    for (size_t i = 0; i + 8 <= size; i += 8) {
+        hash ^= LoadLe<uint64_t>(data + i);
+        hash *= 0x100000001b3ull;
     }
+    return hash;
 }
 
-SnnMemento LoadSnnState(const std::filesystem::path& file) {
-    std::ifstream in(file, std::ios::binary);
-    if (!in) {
-        throw std::runtime_error("Unable to open file "s + file.string() + " for loading state"s);
+struct ModelHeader {
+    SnnLayout layout;
+    float eta;
+};
+
+size_t ModelDataSize(const SnnLayout& layout) {
+    return (layout.weights_size + layout.biases_size) * sizeof(float);
+}
+
+// Writes the header of the model, the data must follow it
+void StoreModelHeader(std::byte* header, const SnnLayout& layout, float eta) {
+    const std::byte* data = header + header_size;
+    const size_t data_size = ModelDataSize(layout);
+    StoreLe(header, current_version);
+    StoreLe(header + 4, static_cast<uint32_t>(header_size));
+    StoreLe(header + 8, static_cast<uint64_t>(layout.i_n));
+    StoreLe(header + 16, static_cast<uint64_t>(layout.h_l));
+    StoreLe(header + 24, static_cast<uint64_t>(layout.h_n));
+    StoreLe(header + 32, static_cast<uint64_t>(layout.o_n));
+    StoreLe(header + 40, std::bit_cast<uint32_t>(eta));
+    StoreLe(header + 44, static_cast<uint32_t>(buffer_alignment));
+    StoreLe(header + 48, static_cast<uint64_t>(data_size));
+    StoreLe(header + 56, CalculateChecksum(data, data_size));
+}
+
+// Writes the model of the network, header_size + ModelDataSize bytes
+void StoreModel(std::byte* model, const Snn& snn) {
+    std::byte* data = model + header_size;
+    size_t index = 0;
+    for (std::span<const float> parameters : {snn.GetWeights(), snn.GetBiases()}) {
+        for (float value : parameters) {
+            StoreLe(data + index * sizeof(float), std::bit_cast<uint32_t>(value));
+            ++index;
+        }
     }
+    StoreModelHeader(model, snn.GetLayout(), snn.GetLearningCoefficient());
+}
 
-    uint32_t version;
-    in.read(reinterpret_cast<char*>(&version), sizeof(version));
-    if (version != current_version) {
-        throw std::runtime_error("Version of file "s + file.string() + " is not supported"s);
+// The file is replaced only by the complete data: it is written
+// to a temporary file next to it, which is renamed
+void WriteFileAtomically(const std::filesystem::path& file, std::span<const std::byte> data) {
+    std::filesystem::path temp_file = file;
+    temp_file += ".tmp"s;
+    {
+        std::ofstream out(temp_file, std::ios::binary);
+        if (!out) {
+            throw std::runtime_error("Unable to open file "s + temp_file.string() + " for saving state"s);
+        }
+        out.write(reinterpret_cast<const char*>(data.data()), data.size());
+        out.close();
+        if (!out) {
+            throw std::runtime_error("Unable to write file "s + temp_file.string());
+        }
     }
+#ifdef STATE_SAVER_POSIX
+    // The data must reach the disk before the rename does
+    int fd = open(temp_file.c_str(), O_RDONLY);
+    if (fd < 0 || fsync(fd) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        throw std::runtime_error("Unable to write file "s + temp_file.string());
+    }
+    close(fd);
+#endif
+    std::filesystem::rename(temp_file, file);
+}
 
+SnnMemento LoadFirstVersion(std::ifstream& in) {
     // Read snn memento
     SnnMemento state;
 
@@ -85,15 +199,9 @@ SnnMemento LoadSnnState(const std::filesystem::path& file) {
 
     state.weights.resize(state.h_l + 1);
     for (size_t l = 0; l < state.h_l + 1; ++l) {
-        auto& layer = state.weights[l];
-        if (l == state.h_l) {
-            layer.resize(state.o_n);
-        } else {
-            layer.resize(state.h_n);
-        }
-        for (auto& edges : layer) {
-            LoadVector(in, edges);
-        }
+        size_t rows = (l == state.h_l) ? state.o_n : state.h_n;
+        size_t cols = (l == 0) ? state.i_n : state.h_n;
+        LoadRows(in, state.weights[l], rows, cols);
     }
 
     state.biases.resize(state.h_l + 1);
@@ -107,4 +215,490 @@ SnnMemento LoadSnnState(const std::filesystem::path& file) {
     }
 
     return state;
-}
\ No newline at end of file
+}
+
+std::runtime_error FormatError(const std::filesystem::path& file, const std::string& reason) {
+    return std::runtime_error("File "s + file.string() + " is corrupted: "s + reason);
+}
+
+// Checks the header, the sizes and the checksum of a model of the current version
+ModelHeader ParseModel(const std::byte* data, size_t size, const std::filesystem::path& file) {
+    auto format_error = [&file](const std::string& reason) {
+        return FormatError(file, reason);
+    };
+
+    if (size < header_size) {
+        throw format_error("the header is incomplete"s);
+    }
+    if (LoadLe<uint32_t>(data + 4) != header_size
+        || LoadLe<uint32_t>(data + 44) != buffer_alignment) {
+        throw format_error("unexpected header"s);
+    }
+    uint64_t dims[4];
+    for (size_t i = 0; i < 4; ++i) {
+        dims[i] = LoadLe<uint64_t>(data + 8 + 8 * i);
+        if (dims[i] == 0 || dims[i] > max_dimension) {
+            throw format_error("wrong network size"s);
+        }
+    }
+
+    ModelHeader header{SnnLayout(dims[0], dims[1], dims[2], dims[3]),
+                       std::bit_cast<float>(LoadLe<uint32_t>(data + 40))};
+    const uint64_t data_size = LoadLe<uint64_t>(data + 48);
+    const uint64_t expected_size =
+        (header.layout.weights_size + header.layout.biases_size) * sizeof(float);
+    if (data_size != expected_size || size - header_size < data_size) {
+        throw format_error("wrong data size"s);
+    }
+    if (CalculateChecksum(data + header_size, data_size) != LoadLe<uint64_t>(data + 56)) {
+        throw format_error("checksum mismatch"s);
+    }
+    return header;
+}
+
+// Parameters of an int8 model that can't be used in place: the weights
+// stay in the mapping, the scales and the biases are copied
+struct QuantizedStorage {
+    std::shared_ptr<const MappedFile> mapping;
+    std::vector<float> values;
+};
+
+// Reads a parameter of the current version
+float LoadParameter(const std::byte* data, size_t index) {
+    return std::bit_cast<float>(LoadLe<uint32_t>(data + index * sizeof(float)));
+}
+
+// Inference-only network over a copy of the parameters of the model
+std::unique_ptr<Snn> LoadModel(const std::byte* model, size_t size, const std::filesystem::path& file) {
+    const ModelHeader header = ParseModel(model, size, file);
+    const SnnLayout& layout = header.layout;
+    auto parameters = std::make_shared<AlignedVector<float>>(layout.weights_size + layout.biases_size);
+    for (size_t i = 0; i < parameters->size(); ++i) {
+        (*parameters)[i] = LoadParameter(model + header_size, i);
+    }
+    const float* weights = parameters->data();
+    return std::make_unique<Snn>(layout, header.eta, weights, weights + layout.weights_size,
+                                 std::move(parameters));
+}
+
+}
+
+void SaveSnnState(const std::filesystem::path& file, const SnnMemento& state) {
+    if (!state.IsValid()) {
+        throw std::runtime_error("Unable to save an incorrect network state"s);
+    }
+    const SnnLayout layout(state.i_n, state.h_l, state.h_n, state.o_n);
+
+    // Parameters in the aligned placement, the padding is zero
+    const size_t data_size = (layout.weights_size + layout.biases_size) * sizeof(float);
+    std::vector<std::byte> buffer(header_size + data_size);
+    std::byte* data = buffer.data() + header_size;
+    auto store = [data](size_t index, float value) {
+        StoreLe(data + index * sizeof(float), std::bit_cast<uint32_t>(value));
+    };
+    for (size_t l = 0; l < state.h_l + 1; ++l) {
+        const size_t rows = layout.LayerSize(l + 1);
+        const size_t cols = layout.LayerSize(l);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                store(layout.weight_offsets[l] + i * layout.strides[l] + j,
+                      state.weights[l][i * cols + j]);
+            }
+        }
+        for (size_t i = 0; i < rows; ++i) {
+            store(layout.weights_size + layout.bias_offsets[l] + i, state.biases[l][i]);
+        }
+    }
+
+    StoreModelHeader(buffer.data(), layout, state.eta);
+    WriteFileAtomically(file, buffer);
+}
+
+void SaveSnnState(const std::filesystem::path& file, const Snn& snn) {
+    std::vector<std::byte> buffer(header_size + ModelDataSize(snn.GetLayout()));
+    StoreModel(buffer.data(), snn);
+    WriteFileAtomically(file, buffer);
+}
+
+SnnMemento LoadSnnState(const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    if (!in) {
+        throw std::runtime_error("Unable to open file "s + file.string() + " for loading state"s);
+    }
+
+    uint32_t version;
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    if (version == first_version) {
+        return LoadFirstVersion(in);
+    }
+    if (version != current_version) {
+        throw std::runtime_error("Version of file "s + file.string() + " is not supported"s);
+    }
+    in.close();
+
+    const MappedFile mapping(file);
+    const ModelHeader header = ParseModel(mapping.GetData(), mapping.GetSize(), file);
+    const SnnLayout& layout = header.layout;
+    const std::byte* data = mapping.GetData() + header_size;
+
+    SnnMemento state;
+    state.i_n = layout.i_n;
+    state.h_l = layout.h_l;
+    state.h_n = layout.h_n;
+    state.o_n = layout.o_n;
+    state.eta = header.eta;
+    state.layers.resize(layout.h_l + 2);
+    for (size_t l = 0; l < layout.h_l + 2; ++l) {
+        state.layers[l].assign(layout.LayerSize(l), 0.0f);
+    }
+    state.weights.resize(layout.h_l + 1);
+    state.biases.resize(layout.h_l + 1);
+    state.errors.resize(layout.h_l + 1);
+    for (size_t l = 0; l < layout.h_l + 1; ++l) {
+        const size_t rows = layout.LayerSize(l + 1);
+        const size_t cols = layout.LayerSize(l);
+        state.weights[l].resize(rows * cols);
+        for (size_t i = 0; i < rows; ++i) {
+            for (size_t j = 0; j < cols; ++j) {
+                state.weights[l][i * cols + j] =
+                    LoadParameter(data, layout.weight_offsets[l] + i * layout.strides[l] + j);
+            }
+        }
+        state.biases[l].resize(rows);
+        for (size_t i = 0; i < rows; ++i) {
+            state.biases[l][i] =
+                LoadParameter(data, layout.weights_size + layout.bias_offsets[l] + i);
+        }
+        state.errors[l].assign(rows, 0.0f);
+    }
+    return state;
+}
+
+std::unique_ptr<Snn> MapSnnState(const std::filesystem::path& file) {
+    auto mapping = std::make_shared<MappedFile>(file);
+    if (mapping->GetSize() < sizeof(uint32_t)
+        || LoadLe<uint32_t>(mapping->GetData()) != current_version
+        || std::endian::native != std::endian::little) {
+        // The parameters can't be used in place
+        mapping.reset();
+        return std::make_unique<Snn>(LoadSnnState(file));
+    }
+
+    const ModelHeader header = ParseModel(mapping->GetData(), mapping->GetSize(), file);
+    const float* weights = reinterpret_cast<const float*>(mapping->GetData() + header_size);
+    const float* biases = weights + header.layout.weights_size;
+    return std::make_unique<Snn>(header.layout, header.eta, weights, biases, std::move(mapping));
+}
+
+void SaveQuantizedSnnState(const std::filesystem::path& file, const QuantizedSnn& snn) {
+    const std::span<const int8_t> weights = snn.GetWeights();
+    const std::span<const float> scales = snn.GetScales();
+    const std::span<const float> biases = snn.GetBiases();
+    assert(weights.size() % buffer_alignment == 0);
+    const size_t data_size = weights.size() + (scales.size() + biases.size()) * sizeof(float);
+    std::vector<std::byte> buffer(header_size + data_size);
+
+    std::byte* data = buffer.data() + header_size;
+    std::transform(weights.begin(), weights.end(), data, [](int8_t value) {
+        return static_cast<std::byte>(value);
+    });
+    size_t offset = weights.size();
+    for (std::span<const float> values : {scales, biases}) {
+        for (float value : values) {
+            StoreLe(data + offset, std::bit_cast<uint32_t>(value));
+            offset += sizeof(float);
+        }
+    }
+
+    std::byte* header = buffer.data();
+    const size_t h_l = snn.GetHiddenLayers();
+    StoreLe(header, quantized_version);
+    StoreLe(header + 4, static_cast<uint32_t>(header_size));
+    StoreLe(header + 8, static_cast<uint64_t>(snn.LayerSize(0)));
+    StoreLe(header + 16, static_cast<uint64_t>(h_l));
+    StoreLe(header + 24, static_cast<uint64_t>(snn.LayerSize(1)));
+    StoreLe(header + 32, static_cast<uint64_t>(snn.LayerSize(h_l + 1)));
+    StoreLe(header + 40, uint32_t{0});
+    StoreLe(header + 44, static_cast<uint32_t>(buffer_alignment));
+    StoreLe(header + 48, static_cast<uint64_t>(data_size));
+    StoreLe(header + 56, CalculateChecksum(data, data_size));
+    WriteFileAtomically(file, buffer);
+}
+
+std::unique_ptr<QuantizedSnn> MapQuantizedSnnState(const std::filesystem::path& file) {
+    auto mapping = std::make_shared<MappedFile>(file);
+    const std::byte* header = mapping->GetData();
+    if (mapping->GetSize() < header_size) {
+        throw FormatError(file, "the header is incomplete"s);
+    }
+    if (LoadLe<uint32_t>(header) != quantized_version) {
+        throw std::runtime_error("File "s + file.string() + " is not an int8 model"s);
+    }
+    if (LoadLe<uint32_t>(header + 4) != header_size
+        || LoadLe<uint32_t>(header + 44) != buffer_alignment) {
+        throw FormatError(file, "unexpected header"s);
+    }
+    uint64_t dims[4];
+    for (size_t i = 0; i < 4; ++i) {
+        dims[i] = LoadLe<uint64_t>(header + 8 + 8 * i);
+        if (dims[i] == 0 || dims[i] > max_dimension) {
+            throw FormatError(file, "wrong network size"s);
+        }
+    }
+
+    // The network without parameters tells their sizes
+    const QuantizedSnn placement(dims[0], dims[1], dims[2], dims[3], nullptr, nullptr, nullptr,
+                                 nullptr);
+    const size_t weights_size = placement.GetWeights().size();
+    const size_t rows_size = placement.GetScales().size();
+    const uint64_t data_size = LoadLe<uint64_t>(header + 48);
+    if (data_size != weights_size + 2 * rows_size * sizeof(float)
+        || mapping->GetSize() - header_size < data_size) {
+        throw FormatError(file, "wrong data size"s);
+    }
+    const std::byte* data = header + header_size;
+    if (CalculateChecksum(data, data_size) != LoadLe<uint64_t>(header + 56)) {
+        throw FormatError(file, "checksum mismatch"s);
+    }
+
+    const int8_t* weights = reinterpret_cast<const int8_t*>(data);
+    const float* scales = reinterpret_cast<const float*>(data + weights_size);
+    if (std::endian::native != std::endian::little) {
+        // The floats can't be used in place
+        auto storage = std::make_shared<QuantizedStorage>();
+        storage->values.resize(2 * rows_size);
+        for (size_t i = 0; i < storage->values.size(); ++i) {
+            storage->values[i] = LoadParameter(data + weights_size, i);
+        }
+        scales = storage->values.data();
+        storage->mapping = std::move(mapping);
+        return std::make_unique<QuantizedSnn>(dims[0], dims[1], dims[2], dims[3], weights, scales,
+                                              scales + rows_size, std::move(storage));
+    }
+    return std::make_unique<QuantizedSnn>(dims[0], dims[1], dims[2], dims[3], weights, scales,
+                                          scales + rows_size, std::move(mapping));
+}
+
+bool IsQuantizedSnnState(const std::filesystem::path& file) {
+    std::ifstream in(file, std::ios::binary);
+    std::byte version[4];
+    in.read(reinterpret_cast<char*>(version), sizeof(version));
+    return in && LoadLe<uint32_t>(version) == quantized_version;
+}
+
+void SaveCheckpoint(const std::filesystem::path& file, const Snn& snn,
+                    const TrainingState& state, const Snn* best) {
+    const size_t engine_size = state.engine.size();
+    const size_t model_size = header_size + ModelDataSize(snn.GetLayout());
+    const size_t best_size = best ? header_size + ModelDataSize(best->GetLayout()) : 0;
+    const size_t data_size = (engine_size + 7) / 8 * 8 + model_size + best_size;
+    std::vector<std::byte> buffer(header_size + data_size);
+
+    std::byte* data = buffer.data() + header_size;
+    std::transform(state.engine.begin(), state.engine.end(), data, [](char c) {
+        return static_cast<std::byte>(c);
+    });
+    std::byte* model = data + (engine_size + 7) / 8 * 8;
+    StoreModel(model, snn);
+    if (best) {
+        StoreModel(model + model_size, *best);
+    }
+
+    std::byte* header = buffer.data();
+    StoreLe(header, checkpoint_version);
+    StoreLe(header + 4, static_cast<uint32_t>(header_size));
+    StoreLe(header + 8, static_cast<uint64_t>(state.epoch));
+    StoreLe(header + 16, static_cast<uint64_t>(best ? state.best_epoch : 0));
+    StoreLe(header + 24, std::bit_cast<uint64_t>(state.best_value));
+    StoreLe(header + 32, static_cast<uint64_t>(engine_size));
+    StoreLe(header + 40, static_cast<uint64_t>(model_size));
+    StoreLe(header + 48, static_cast<uint64_t>(best_size));
+    StoreLe(header + 56, CalculateChecksum(data, data_size));
+    WriteFileAtomically(file, buffer);
+}
+
+Checkpoint LoadCheckpoint(const std::filesystem::path& file) {
+    const MappedFile mapping(file);
+    const std::byte* header = mapping.GetData();
+    if (mapping.GetSize() < header_size) {
+        throw FormatError(file, "the header is incomplete"s);
+    }
+    if (LoadLe<uint32_t>(header) != checkpoint_version) {
+        throw std::runtime_error("File "s + file.string() + " is not a checkpoint"s);
+    }
+    const uint64_t engine_size = LoadLe<uint64_t>(header + 32);
+    const uint64_t model_size = LoadLe<uint64_t>(header + 40);
+    const uint64_t best_size = LoadLe<uint64_t>(header + 48);
+    const uint64_t available = mapping.GetSize() - header_size;
+    if (LoadLe<uint32_t>(header + 4) != header_size || engine_size > max_engine_state_size
+        || model_size > available || best_size > available) {
+        throw FormatError(file, "unexpected header"s);
+    }
+    const uint64_t data_size = (engine_size + 7) / 8 * 8 + model_size + best_size;
+    if (data_size > available) {
+        throw FormatError(file, "wrong data size"s);
+    }
+    const std::byte* data = header + header_size;
+    if (CalculateChecksum(data, data_size) != LoadLe<uint64_t>(header + 56)) {
+        throw FormatError(file, "checksum mismatch"s);
+    }
+
+    Checkpoint checkpoint;
+    checkpoint.state.epoch = static_cast<int>(LoadLe<uint64_t>(header + 8));
+    checkpoint.state.best_epoch = static_cast<int>(LoadLe<uint64_t>(header + 16));
+    checkpoint.state.best_value = std::bit_cast<double>(LoadLe<uint64_t>(header + 24));
+    checkpoint.state.engine.resize(engine_size);
+    std::transform(data, data + engine_size, checkpoint.state.engine.begin(), [](std::byte b) {
+        return static_cast<char>(b);
+    });
+
+    // The trainable network takes the parameters of the model
+    const std::byte* model = data + (engine_size + 7) / 8 * 8;
+    const std::unique_ptr<Snn> loaded = LoadModel(model, model_size, file);
+    const SnnLayout& layout = loaded->GetLayout();
+    checkpoint.snn = std::make_unique<Snn>(layout.i_n, layout.h_l, layout.h_n, layout.o_n);
+    checkpoint.snn->SetLearningCoefficient(loaded->GetLearningCoefficient());
+    checkpoint.snn->CopyParameters(*loaded);
+    if (best_size > 0) {
+        checkpoint.best = LoadModel(model + model_size, best_size, file);
+    }
+    return checkpoint;
+}
+
+namespace tests {
+
+void SaveAndMapState() {
+    Snn snn(20, 2, 10, 5);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    const SnnMemento state = snn.CreateMemento();
+
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "snn_state_test";
+    SaveSnnState(file, state);
+
+    // Copying load restores the parameters exactly
+    const SnnMemento loaded = LoadSnnState(file);
+    assert(loaded.weights == state.weights);
+    assert(loaded.biases == state.biases);
+    assert(loaded.eta == state.eta);
+
+    // The network over the mapped file gives the same outputs
+    std::unique_ptr<Snn> mapped = MapSnnState(file);
+    SnnWorkspace workspace = snn.CreateWorkspace();
+    SnnWorkspace mapped_workspace = mapped->CreateWorkspace();
+    std::vector<float> input(20);
+    std::vector<float> output(5);
+    std::vector<float> mapped_output(5);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<float>(i % 3) / 2.0f;
+    }
+    snn.Infer(input, workspace, output);
+    mapped->Infer(input, mapped_workspace, mapped_output);
+    assert(output == mapped_output);
+    mapped.reset();
+
+    // A damaged parameter is detected by the checksum
+    {
+        std::fstream stream(file, std::ios::binary | std::ios::in | std::ios::out);
+        stream.seekp(header_size + 1);
+        stream.put('\x7f');
+    }
+    [[maybe_unused]] bool detected = false;
+    try {
+        MapSnnState(file);
+    } catch (const std::runtime_error&) {
+        detected = true;
+    }
+    assert(detected);
+    std::filesystem::remove(file);
+}
+
+
+void SaveAndLoadCheckpoint() {
+    Snn snn(20, 2, 10, 5);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    snn.SetLearningCoefficient(0.25f);
+    const Snn best = snn.CreateSnapshot();
+    snn.InitializeWeightsWithRandom();
+
+    TrainingState state;
+    state.epoch = 7;
+    state.engine = "12345"s; // its size isn't a multiple of 8
+    state.best_epoch = 4;
+    state.best_value = 0.75;
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "snn_checkpoint_test";
+    SaveCheckpoint(file, snn, state, &best);
+
+    const Checkpoint checkpoint = LoadCheckpoint(file);
+    assert(checkpoint.state.epoch == 7);
+    assert(checkpoint.state.engine == state.engine);
+    assert(checkpoint.state.best_epoch == 4);
+    assert(checkpoint.state.best_value == 0.75);
+    assert(checkpoint.snn->GetLearningCoefficient() == 0.25f);
+    assert(std::ranges::equal(checkpoint.snn->GetWeights(), snn.GetWeights()));
+    assert(std::ranges::equal(checkpoint.snn->GetBiases(), snn.GetBiases()));
+    assert(checkpoint.best);
+    assert(std::ranges::equal(checkpoint.best->GetWeights(), best.GetWeights()));
+    assert(std::ranges::equal(checkpoint.best->GetBiases(), best.GetBiases()));
+
+    // The temporary file is renamed, a model file isn't a checkpoint
+    std::filesystem::path temp_file = file;
+    temp_file += ".tmp"s;
+    assert(!std::filesystem::exists(temp_file));
+    SaveSnnState(file, snn);
+    [[maybe_unused]] bool rejected = false;
+    try {
+        LoadCheckpoint(file);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    assert(rejected);
+    assert(LoadSnnState(file).weights == snn.CreateMemento().weights);
+    std::filesystem::remove(file);
+}
+
+void SaveAndMapQuantizedState() {
+    Snn snn(20, 2, 10, 5);
+    snn.InitializeWeightsWithRandom();
+    snn.InitializeBiasesWithRandom();
+    const QuantizedSnn quantized(snn.CreateMemento());
+    const std::filesystem::path file = std::filesystem::temp_directory_path() / "snn_int8_test";
+    SaveQuantizedSnnState(file, quantized);
+    assert(IsQuantizedSnnState(file));
+
+    // The mapped network gives the same outputs
+    const std::unique_ptr<QuantizedSnn> mapped = MapQuantizedSnnState(file);
+    assert(std::ranges::equal(mapped->GetWeights(), quantized.GetWeights()));
+    assert(std::ranges::equal(mapped->GetScales(), quantized.GetScales()));
+    assert(std::ranges::equal(mapped->GetBiases(), quantized.GetBiases()));
+    QuantizedWorkspace workspace = quantized.CreateWorkspace();
+    QuantizedWorkspace mapped_workspace = mapped->CreateWorkspace();
+    std::vector<float> input(20);
+    std::vector<float> output(5);
+    std::vector<float> mapped_output(5);
+    for (size_t i = 0; i < input.size(); ++i) {
+        input[i] = static_cast<float>(i % 3) / 2.0f;
+    }
+    quantized.Infer(input, workspace, output);
+    mapped->Infer(input, mapped_workspace, mapped_output);
+    assert(output == mapped_output);
+
+    // The int8 model is smaller than the float one and isn't taken for it
+    std::filesystem::path float_file = file;
+    float_file += ".float"s;
+    SaveSnnState(float_file, snn);
+    assert(std::filesystem::file_size(file) < std::filesystem::file_size(float_file));
+    assert(!IsQuantizedSnnState(float_file));
+    [[maybe_unused]] bool rejected = false;
+    try {
+        MapSnnState(file);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    assert(rejected);
+    std::filesystem::remove(float_file);
+    std::filesystem::remove(file);
+}
+
+}
@@ -1,9 +1,61 @@
 #pragma once
 
+#include "quantized_snn.h"
 #include "snn.h"
 
 #include <filesystem>
+#include <memory>
+#include <string>
+
+// Model files. The current version has a fixed header, the weights and
+// biases are placed in aligned blocks as in SnnLayout, so the file can be
+// mapped to memory and used in place. Files of the first version
+// (0x24052823) are still read. A saved file is replaced atomically:
+// the data is written to a temporary file next to it, which is renamed
 
 void SaveSnnState(const std::filesystem::path& file, const SnnMemento& state);
+// Saves the parameters of the network without a memento
+void SaveSnnState(const std::filesystem::path& file, const Snn& snn);
+
+SnnMemento LoadSnnState(const std::filesystem::path& file);
+
+// Maps the model file and creates a network that uses the weights
+// in place, without copying. It can be used only for inference.
+// Files of the first version are loaded with copying
+std::unique_ptr<Snn> MapSnnState(const std::filesystem::path& file);
+
+// Int8 model files keep only what QuantizedSnn uses for inference, they
+// are about 4 times smaller than the model of the float network.
+// They are mapped and used in place like model files
+void SaveQuantizedSnnState(const std::filesystem::path& file, const QuantizedSnn& snn);
+std::unique_ptr<QuantizedSnn> MapQuantizedSnnState(const std::filesystem::path& file);
+// True if the file starts as an int8 model file
+bool IsQuantizedSnnState(const std::filesystem::path& file);
+
+// Progress of the training saved in checkpoints with the network
+struct TrainingState {
+    int epoch = 0; // finished epochs
+    std::string engine; // engine of the sample order, as written by operator<<
+    int best_epoch = 0; // 0 if there is no best network
+    double best_value = 0.0; // monitored metric of the best network
+};
+
+struct Checkpoint {
+    TrainingState state;
+    std::unique_ptr<Snn> snn; // trainable
+    std::unique_ptr<Snn> best; // inference-only, nullptr if there is no best network
+};
+
+// Checkpoint files keep the state and the models of the networks,
+// they are replaced atomically like model files
+void SaveCheckpoint(const std::filesystem::path& file, const Snn& snn,
+                    const TrainingState& state, const Snn* best);
+Checkpoint LoadCheckpoint(const std::filesystem::path& file);
+
+namespace tests {
+
+void SaveAndMapState();
+void SaveAndLoadCheckpoint();
+void SaveAndMapQuantizedState();
 
-SnnMemento LoadSnnState(const std::filesystem::path& file);
\ No newline at end of file
+}
@@ -0,0 +1,148 @@
+#include "thread_pool.h"
+
+#include <atomic>
+#include <cassert>
+
+namespace {
+
+// The pool and the worker index of the current thread
+thread_local const WorkStealingPool* current_pool = nullptr;
+thread_local size_t current_worker = 0;
+
+}
+
+WorkStealingPool::WorkStealingPool(size_t threads) {
+    assert(threads > 0);
+    for (size_t i = 0; i < threads; ++i) {
+        workers_.push_back(std::make_unique<Worker>());
+    }
+    for (size_t i = 0; i < threads; ++i) {
+        threads_.emplace_back([this, i]() {
+            Run(i);
+        });
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    {
+        std::lock_guard lock(mutex_);
+        stop_ = true;
+    }
+    task_added_.notify_all();
+    for (auto& thread : threads_) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::Submit(Task task) {
+    // The task is counted before it is published: once in a deque it can be
+    // stolen and completed at once, which must not bring pending_ to zero
+    // while the submitting task is still running
+    size_t index = current_worker;
+    {
+        std::lock_guard lock(mutex_);
+        if (current_pool != this) {
+            index = next_worker_;
+            next_worker_ = (next_worker_ + 1) % workers_.size();
+        }
+        ++queued_;
+        ++pending_;
+    }
+    {
+        std::lock_guard lock(workers_[index]->mutex);
+        workers_[index]->tasks.push_back(std::move(task));
+    }
+    task_added_.notify_one();
+}
+
+void WorkStealingPool::Wait() {
+    std::unique_lock lock(mutex_);
+    all_done_.wait(lock, [this]() {
+        return pending_ == 0;
+    });
+}
+
+size_t WorkStealingPool::GetThreadCount() const {
+    return threads_.size();
+}
+
+void WorkStealingPool::Run(size_t index) {
+    current_pool = this;
+    current_worker = index;
+
+    while (true) {
+        Task task;
+        if (TryTake(index, task)) {
+            task(index);
+            std::lock_guard lock(mutex_);
+            if (--pending_ == 0) {
+                all_done_.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock lock(mutex_);
+        task_added_.wait(lock, [this]() {
+            return stop_ || queued_ > 0;
+        });
+        if (stop_ && queued_ == 0) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::TryTake(size_t index, Task& task) {
+    // Own deque first, from the back
+    {
+        Worker& own = *workers_[index];
+        std::lock_guard lock(own.mutex);
+        if (!own.tasks.empty()) {
+            task = std::move(own.tasks.back());
+            own.tasks.pop_back();
+        }
+    }
+
+    // Then steal from the fronts of other deques
+    for (size_t i = 1; !task && i < workers_.size(); ++i) {
+        Worker& victim = *workers_[(index + i) % workers_.size()];
+        std::lock_guard lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+        }
+    }
+
+    if (!task) {
+        return false;
+    }
+    std::lock_guard lock(mutex_);
+    --queued_;
+    return true;
+}
+
+namespace tests {
+
+void NestedSubmitsAreWaited() {
+    // Every round a task submits children, some of them submit grandchildren.
+    // Wait must not return before the last of them is done
+    WorkStealingPool pool(16);
+    std::atomic<size_t> done = 0;
+    for (size_t round = 1; round <= 300; ++round) {
+        pool.Submit([&pool, &done](size_t) {
+            for (size_t child = 0; child < 200; ++child) {
+                pool.Submit([&pool, &done, child](size_t) {
+                    if (child % 10 == 0) {
+                        pool.Submit([&done](size_t) {
+                            ++done;
+                        });
+                    }
+                    ++done;
+                });
+            }
+        });
+        pool.Wait();
+        assert(done == round * 220);
+    }
+}
+
+}
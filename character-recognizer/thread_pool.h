@@ -0,0 +1,63 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Thread pool with work stealing. Every worker has its own deque of tasks:
+// tasks submitted by a worker go to the back of its deque, and the worker
+// takes them from there (the most recent first, while the data is in cache).
+// An idle worker steals the oldest tasks from the fronts of other deques
+
+class WorkStealingPool {
+public:
+    // The argument is the index of the worker that runs the task,
+    // it allows tasks to use per-worker buffers.
+    // Tasks must not throw exceptions
+    using Task = std::function<void(size_t worker)>;
+
+    explicit WorkStealingPool(size_t threads);
+    ~WorkStealingPool();
+
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+    // Can be called both by tasks and from outside the pool
+    void Submit(Task task);
+
+    // Blocks until all tasks are done, including the ones
+    // submitted by other tasks
+    void Wait();
+
+    size_t GetThreadCount() const;
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<Task> tasks;
+    };
+
+    std::vector<std::unique_ptr<Worker>> workers_;
+    std::vector<std::thread> threads_;
+
+    std::mutex mutex_;
+    std::condition_variable task_added_;
+    std::condition_variable all_done_;
+    size_t queued_ = 0; // tasks in the deques
+    size_t pending_ = 0; // tasks not yet completed
+    size_t next_worker_ = 0; // for tasks submitted from outside
+    bool stop_ = false;
+
+    void Run(size_t index);
+    bool TryTake(size_t index, Task& task);
+};
+
+namespace tests {
+
+void NestedSubmitsAreWaited();
+
+}
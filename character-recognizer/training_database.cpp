@@ -1,8 +1,17 @@
 #include "training_database.h"
-#include "bmp_image.h"
+#include "batch_file_reader.h"
+#include "glyph_bundle.h"
+#include "glyph_loader.h"
+#include "profiler.h"
+#include "sample_cache.h"
+#include "zip_archive.h"
 
 #include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <mutex>
 #include <random>
+#include <thread>
 
 using namespace std::literals;
 
@@ -10,46 +19,89 @@ ImageFileNormalizer::ImageFileNormalizer(size_t input_width)
 : input_width_(input_width) {
 }
 
+namespace {
+
+// Buffer of the file reads is reused by the following loads of the thread
+thread_local GlyphLoader glyph_loader;
+
+}
+
 std::vector<float> ImageFileNormalizer::Load(const std::filesystem::path& file) const {
-    img_lib::Image image = img_lib::LoadBMP(file);
-    const int w = image.GetWidth();
-    const int h = image.GetHeight();
+    std::vector<float> vec(input_width_);
+    Load(file, vec);
+    return vec;
+}
 
-    if (w == 0) {
-        throw std::runtime_error("The file "s + file.string() + " cannot be read"s);
-    }
-    if (w != h) {
-        throw std::runtime_error("The sides of the image must be the same"s);
-    }
-    if (input_width_ != static_cast<size_t>(w * h)) {
-        throw std::runtime_error("Pixel count does not match the input width of the network"s);
-    }
+void ImageFileNormalizer::Load(const std::filesystem::path& file, std::span<float> values) const {
+    assert(values.size() == input_width_);
+    glyph_loader.Load(file, values);
+}
 
-    auto normalize_color = [](const img_lib::Color& color) {
-        uint32_t uval = 0;
-        uval = static_cast<uint32_t>(color.r) << 24
-               | static_cast<uint32_t>(color.g) << 16
-               | static_cast<uint32_t>(color.b) << 8;
+void ImageFileNormalizer::LoadBytes(const std::filesystem::path& file,
+                                    std::span<uint8_t> sample) const {
+    assert(sample.size() == input_width_);
+    glyph_loader.LoadBytes(file, sample);
+}
 
-        return static_cast<float>(uval) / static_cast<float>(UINT32_MAX);
-    };
+void ImageFileNormalizer::Decode(std::span<const uint8_t> data, const std::filesystem::path& file,
+                                 std::span<float> values) const {
+    assert(values.size() == input_width_);
+    glyph_loader.Decode(data, file, values);
+}
 
-    std::vector<float> vec(input_width_);
-    for (int y = 0; y < h; ++y) {
-        const img_lib::Color* line = image.GetLine(y);
-        for (int x = 0; x < w; ++x) {
-            vec[y * w + x] = normalize_color(line[x]);
-        }
-    }
+void ImageFileNormalizer::DecodeBytes(std::span<const uint8_t> data,
+                                      const std::filesystem::path& file,
+                                      std::span<uint8_t> sample) const {
+    assert(sample.size() == input_width_);
+    glyph_loader.DecodeBytes(data, file, sample);
+}
 
-    return vec;
+size_t ImageFileNormalizer::GetWidth() const {
+    return input_width_;
+}
+
+SampleMatrix::SampleMatrix(size_t width)
+: width_(width) {
+}
+
+size_t SampleMatrix::GetWidth() const {
+    return width_;
+}
+
+size_t SampleMatrix::GetCount() const {
+    return width_ == 0 ? 0 : data_.size() / width_;
+}
+
+const uint8_t* SampleMatrix::GetSample(size_t index) const {
+    assert(index < GetCount());
+    return data_.data() + index * width_;
+}
+
+uint8_t* SampleMatrix::GetSample(size_t index) {
+    assert(index < GetCount());
+    return data_.data() + index * width_;
+}
+
+void SampleMatrix::Resize(size_t count) {
+    data_.resize(count * width_);
 }
 
 TrainingDatabase::TrainingDatabase(const FileNormalizerInterface* file_normalizer)
-: file_normalizer_(file_normalizer) {
+: file_normalizer_(file_normalizer)
+, non_chars_(file_normalizer->GetWidth()) {
+}
+
+void TrainingDatabase::SetThreads(size_t threads) {
+    assert(threads > 0);
+    threads_ = threads;
+}
+
+void TrainingDatabase::SetCacheFile(const std::filesystem::path& cache_file) {
+    cache_file_ = cache_file;
 }
 
 void TrainingDatabase::BuildFromFolder(const std::filesystem::path& folder) {
+    PROFILE_SCOPE("build database");
     using namespace std::filesystem;
     if (!exists(folder)) {
         throw std::runtime_error(folder.string() + " does not exist"s);
@@ -60,23 +112,239 @@ void TrainingDatabase::BuildFromFolder(const std::filesystem::path& folder) {
     if (is_empty(folder)) {
          throw std::runtime_error(folder.string() + " is empty"s);
     }
-    for (const auto& sub : directory_iterator(folder)) {
-        if (sub.is_directory()) {
-            std::string name = sub.path().filename().string();
-            if (is_empty(sub)) {
-                continue;
-            }
-            if (name.size() == 1) {
-                Chars& data = data_dict_[name[0]];
-                for (const auto& file : directory_iterator(sub)) {
-                    data.emplace_back(file_normalizer_->Load(file.path()));
+
+    const size_t width = file_normalizer_->GetWidth();
+    std::unique_ptr<SampleCache> cache;
+    if (!cache_file_.empty()) {
+        cache = SampleCache::Open(cache_file_, width);
+    }
+
+    // Collect the files first. Each of them gets a slot in the matrix
+    // of its class, the order of the slots is the order of the files
+    std::vector<SampleFileInfo> infos;
+    std::vector<FileSlot> slots;
+    {
+        PROFILE_SCOPE("scan folder");
+        for (const auto& sub : directory_iterator(folder)) {
+            if (sub.is_directory()) {
+                std::string name = sub.path().filename().string();
+                if (is_empty(sub)) {
+                    continue;
                 }
-            } else { // not symbols
+                Chars& data = (name.size() == 1)
+                    ? data_dict_.try_emplace(name[0], width).first->second
+                    : non_chars_; // not symbols
+                const size_t first = data.GetCount();
+                size_t count = 0;
                 for (const auto& file : directory_iterator(sub)) {
-                    non_chars_.emplace_back(file_normalizer_->Load(file.path()));
+                    infos.push_back(SampleFileInfo::FromEntry(file, folder));
+                    slots.push_back({file.path(), &data, first + count++});
+                }
+                data.Resize(first + count);
+            }
+        }
+    }
+
+    // Take unchanged files from the cache, decode the rest
+    std::vector<const FileSlot*> missing;
+    for (size_t i = 0; i < slots.size(); ++i) {
+        std::span<const uint8_t> cached = cache ? cache->Find(infos[i]) : std::span<const uint8_t>();
+        if (cached.empty()) {
+            missing.push_back(&slots[i]);
+        } else {
+            std::copy(cached.begin(), cached.end(), slots[i].data->GetSample(slots[i].index));
+        }
+    }
+    DecodeFiles(missing);
+
+    // Rewrite the cache if files were added, changed or removed
+    if (cache_file_.empty() || (cache && missing.empty() && cache->GetSize() == infos.size())) {
+        return;
+    }
+    cache.reset();
+    PROFILE_SCOPE("write cache");
+    std::vector<SampleCache::Entry> entries;
+    entries.reserve(infos.size());
+    for (size_t i = 0; i < infos.size(); ++i) {
+        entries.push_back({&infos[i], {slots[i].data->GetSample(slots[i].index), width}});
+    }
+    try {
+        SampleCache::Write(cache_file_, width, entries);
+    } catch (const std::exception&) {
+        // The cache only speeds up later builds, the database is complete without it
+    }
+}
+
+void TrainingDatabase::BuildFromBundle(const std::filesystem::path& bundle) {
+    PROFILE_SCOPE("build database");
+    const GlyphBundle glyphs(bundle);
+    const size_t width = file_normalizer_->GetWidth();
+    if (glyphs.GetWidth() != width) {
+        throw std::runtime_error("Pixel count of "s + bundle.string()
+                                 + " does not match the input width of the network"s);
+    }
+    if (glyphs.GetCount() == 0) {
+        throw std::runtime_error(bundle.string() + " is empty"s);
+    }
+    for (const GlyphBundle::Label& label : glyphs.GetLabels()) {
+        if (label.count == 0) {
+            continue;
+        }
+        Chars& data = (label.name.size() == 1)
+            ? data_dict_.try_emplace(label.name[0], width).first->second
+            : non_chars_; // not symbols
+        const size_t first = data.GetCount();
+        data.Resize(first + label.count);
+        std::copy_n(glyphs.GetRecord(label.first), label.count * width, data.GetSample(first));
+    }
+}
+
+void TrainingDatabase::BuildFromZip(const std::filesystem::path& archive) {
+    PROFILE_SCOPE("build database");
+    const ZipArchive zip(archive);
+    const size_t width = file_normalizer_->GetWidth();
+    using Entry = ZipArchive::Entry;
+
+    // A single top-level folder of the label folders is the zipped training folder itself
+    std::vector<const Entry*> files;
+    for (const Entry& entry : zip.GetEntries()) {
+        if (!entry.IsDirectory()) {
+            files.push_back(&entry);
+        }
+    }
+    std::string_view root = files.empty() ? ""sv : std::string_view(files[0]->name);
+    root = root.substr(0, root.find('/') + 1);
+    bool nested = false;
+    for (const Entry* entry : files) {
+        if (root.empty() || !entry->name.starts_with(root)) {
+            root = {};
+            break;
+        }
+        nested = nested || entry->name.find('/', root.size()) != entry->name.npos;
+    }
+    if (!nested) {
+        root = {};
+    }
+
+    // Files of the label folders get slots in the order of the entries
+    struct ZipSlot {
+        const Entry* entry;
+        Chars* data;
+        size_t index;
+    };
+    std::vector<ZipSlot> slots;
+    for (const Entry* entry : files) {
+        const std::string_view name = std::string_view(entry->name).substr(root.size());
+        const size_t separator = name.find('/');
+        if (separator == 0 || separator == name.npos || name.find('/', separator + 1) != name.npos) {
+            continue;
+        }
+        Chars& data = (separator == 1)
+            ? data_dict_.try_emplace(name[0], width).first->second
+            : non_chars_; // not symbols
+        slots.push_back({entry, &data, data.GetCount()});
+        data.Resize(data.GetCount() + 1);
+    }
+    if (slots.empty()) {
+        throw std::runtime_error(archive.string() + " has no images"s);
+    }
+
+    // The threads take the entries in turn and extract them to their own
+    // buffers. The error of the first damaged entry is reported
+    std::atomic<size_t> next = 0;
+    std::mutex error_mutex;
+    size_t error_position = slots.size();
+    std::exception_ptr error;
+    const profiler::Context context = profiler::Context::Current();
+    auto decode = [&]() {
+        const profiler::ContextScope context_scope(context);
+        std::vector<uint8_t> buffer;
+        for (size_t i = next++; i < slots.size(); i = next++) {
+            const ZipSlot& slot = slots[i];
+            try {
+                PROFILE_SCOPE("decode");
+                std::span<const uint8_t> data = zip.Extract(*slot.entry, buffer);
+                std::span<uint8_t> sample(slot.data->GetSample(slot.index), width);
+                file_normalizer_->DecodeBytes(data, slot.entry->name, sample);
+            } catch (...) {
+                std::lock_guard lock(error_mutex);
+                if (i < error_position) {
+                    error_position = i;
+                    error = std::current_exception();
+                }
+            }
+        }
+    };
+
+    const size_t thread_count = std::min(threads_, slots.size());
+    if (thread_count == 1) {
+        decode();
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < thread_count; ++t) {
+            threads.emplace_back(decode);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
+    }
+}
+
+void TrainingDatabase::DecodeFiles(std::span<const FileSlot* const> files) {
+    // The threads take the files in turn by chunks, which their readers
+    // read in batches. If some files can't be read, the error of the first
+    // of them is reported, as in the serial order
+    std::atomic<size_t> next = 0;
+    std::mutex error_mutex;
+    size_t error_position = files.size();
+    std::exception_ptr error;
+    const profiler::Context context = profiler::Context::Current();
+    auto decode = [&]() {
+        const profiler::ContextScope context_scope(context);
+        BatchFileReader reader;
+        const size_t chunk = reader.GetCapacity();
+        for (size_t begin = next.fetch_add(chunk); begin < files.size(); begin = next.fetch_add(chunk)) {
+            const size_t end = std::min(files.size(), begin + chunk);
+            for (size_t i = begin; i < end; ++i) {
+                reader.Add(files[i]->path);
+            }
+            for (size_t i = begin; i < end; ++i) {
+                const FileSlot& slot = *files[i];
+                try {
+                    PROFILE_SCOPE("decode");
+                    std::span<const uint8_t> data = reader.Take();
+                    std::span<uint8_t> sample(slot.data->GetSample(slot.index), slot.data->GetWidth());
+                    file_normalizer_->DecodeBytes(data, slot.path, sample);
+                } catch (...) {
+                    std::lock_guard lock(error_mutex);
+                    if (i < error_position) {
+                        error_position = i;
+                        error = std::current_exception();
+                    }
                 }
             }
         }
+    };
+
+    const size_t thread_count = std::min(threads_, files.size());
+    if (thread_count == 0) {
+        return;
+    } else if (thread_count == 1) {
+        decode();
+    } else {
+        std::vector<std::thread> threads;
+        for (size_t t = 0; t < thread_count; ++t) {
+            threads.emplace_back(decode);
+        }
+        for (auto& thread : threads) {
+            thread.join();
+        }
+    }
+    if (error) {
+        std::rethrow_exception(error);
     }
 }
 
@@ -92,14 +360,14 @@ TrainingDatabase::CharPtrArray TrainingDatabase::CreateCharPtrArray() const {
     TrainingDatabase::CharPtrArray result;
     for (auto& it : data_dict_) {
         char c = it.first;
-        for (auto& vec : it.second) {
-            result.emplace_back(c, &vec);
+        for (size_t i = 0; i < it.second.GetCount(); ++i) {
+            result.emplace_back(c, it.second.GetSample(i));
         }
     }
     return result;
 }
 
-void TrainingDatabase::ShuffleCharPtrArray(TrainingDatabase::CharPtrArray& array) {
-    auto rnd = std::default_random_engine {};
-    std::shuffle(array.begin(), array.end(), rnd);
+void TrainingDatabase::ShuffleCharPtrArray(TrainingDatabase::CharPtrArray& array,
+                                           std::default_random_engine& engine) {
+    std::shuffle(array.begin(), array.end(), engine);
 }
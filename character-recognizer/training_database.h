@@ -1,45 +1,115 @@
 #pragma once
 
+#include <cstdint>
 #include <filesystem>
+#include <random>
+#include <span>
 #include <unordered_map>
 #include <vector>
 
+// Samples are stored as bytes, the network input is byte * sample_scale.
+// For gray pixels it gives exactly the values of ImageFileNormalizer::Load
+constexpr float sample_scale = 65793.0f / 16777216.0f;
+
 class FileNormalizerInterface {
 public:
     virtual std::vector<float> Load(const std::filesystem::path& file) const = 0;
+    // Loads the sample into the span, its size is GetWidth()
+    virtual void Load(const std::filesystem::path& file, std::span<float> values) const = 0;
+    // Loads the sample as bytes, the size of the span is GetWidth()
+    virtual void LoadBytes(const std::filesystem::path& file, std::span<uint8_t> sample) const = 0;
+    // The same from the contents of the file read by BatchFileReader
+    virtual void Decode(std::span<const uint8_t> data, const std::filesystem::path& file,
+                        std::span<float> values) const = 0;
+    virtual void DecodeBytes(std::span<const uint8_t> data, const std::filesystem::path& file,
+                             std::span<uint8_t> sample) const = 0;
+    // Number of values produced by Load
+    virtual size_t GetWidth() const = 0;
 };
 
+// Loads square BMP images with GlyphLoader, every thread has its own one.
+// It is thread-safe
 class ImageFileNormalizer : public FileNormalizerInterface {
 public:
     ImageFileNormalizer(size_t input_width);
     std::vector<float> Load(const std::filesystem::path& file) const override;
+    void Load(const std::filesystem::path& file, std::span<float> values) const override;
+    void LoadBytes(const std::filesystem::path& file, std::span<uint8_t> sample) const override;
+    void Decode(std::span<const uint8_t> data, const std::filesystem::path& file,
+                std::span<float> values) const override;
+    void DecodeBytes(std::span<const uint8_t> data, const std::filesystem::path& file,
+                     std::span<uint8_t> sample) const override;
+    size_t GetWidth() const override;
 
 private:
     size_t input_width_;
 };
 
+// Samples of one class in a row-major byte matrix [count x width]
+class SampleMatrix {
+public:
+    explicit SampleMatrix(size_t width);
+
+    size_t GetWidth() const;
+    size_t GetCount() const;
+    const uint8_t* GetSample(size_t index) const;
+    uint8_t* GetSample(size_t index);
+
+    // New samples are filled with zeros
+    void Resize(size_t count);
+
+private:
+    size_t width_;
+    std::vector<uint8_t> data_;
+};
+
 // Database for training neural networks
-// It loads images and stores them as normalized values
-// for neural network input
+// It loads images and stores them as bytes,
+// normalized values for neural network input are
+// calculated with sample_scale
 
 class TrainingDatabase {
 public:
-    using Char = std::vector<float>;
-    using Chars = std::vector<Char>;
+    using Chars = SampleMatrix;
     using CharsDict = std::unordered_map<char, Chars>;
-    using CharPtrArray = std::vector<std::pair<char, const Char*>>;
+    using CharPtrArray = std::vector<std::pair<char, const uint8_t*>>;
 
     TrainingDatabase(const FileNormalizerInterface* file_normalizer);
+    // Number of threads that decode files, each of them reads the files
+    // in batches with a BatchFileReader. The normalizer must be thread-safe
+    void SetThreads(size_t threads);
+    // Loaded samples are saved to the cache file, later builds take from it
+    // the samples of the files with the same path, size and modification time.
+    // An empty path disables the cache
+    void SetCacheFile(const std::filesystem::path& cache_file);
     void BuildFromFolder(const std::filesystem::path& folder);
+    // Takes the records of the glyph bundle (see GlyphBundle),
+    // its labels are the names of the folders
+    void BuildFromBundle(const std::filesystem::path& bundle);
+    // Decodes the images of the zip archive without extracting it. The archive
+    // has the folder layout, either of its contents or of the folder itself
+    // (a single top-level folder), files outside the label folders are skipped
+    void BuildFromZip(const std::filesystem::path& archive);
 
     const CharsDict& GetCharsDictionary() const;
     const Chars& GetNonChars() const;
     CharPtrArray CreateCharPtrArray() const;
 
-    static void ShuffleCharPtrArray(CharPtrArray& array);
+    static void ShuffleCharPtrArray(CharPtrArray& array, std::default_random_engine& engine);
 
 private:
     const FileNormalizerInterface* file_normalizer_;
+    std::filesystem::path cache_file_;
+    size_t threads_ = 1;
     CharsDict data_dict_;
     Chars non_chars_;
-};
\ No newline at end of file
+
+    // File and the place of its sample
+    struct FileSlot {
+        std::filesystem::path path;
+        Chars* data;
+        size_t index;
+    };
+
+    void DecodeFiles(std::span<const FileSlot* const> files);
+};
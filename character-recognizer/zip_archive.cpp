@@ -0,0 +1,727 @@
+#include "zip_archive.h"
+#include "bmp_image.h"
+#include "profiler.h"
+#include "training_database.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <fstream>
+#include <stdexcept>
+
+using namespace std::literals;
+
+namespace {
+
+// Signatures and fixed sizes of the records (APPNOTE.TXT of PKWARE).
+// Local header:          0 signature, 8 flags, 26 name length, 28 extra length, 30 name
+// Central header:        0 signature, 8 flags, 10 method, 16 crc, 20 compressed size,
+//                        24 size, 28 name length, 30 extra length, 32 comment length,
+//                        42 local header offset, 46 name
+// End of central dir:    0 signature, 10 entries, 12 directory size, 16 directory offset,
+//                        20 comment length, 22 comment
+// Zip64 end locator:     0 signature, 8 offset of the zip64 end of central dir
+// Zip64 end of cent dir: 0 signature, 32 entries, 40 directory size, 48 directory offset
+// Zip64 extra field 0x0001 keeps the 64-bit values in the order size, compressed
+// size, local offset, only of the 32-bit fields set to 0xffffffff
+constexpr uint32_t local_signature = 0x04034b50;
+constexpr uint32_t central_signature = 0x02014b50;
+constexpr uint32_t end_signature = 0x06054b50;
+constexpr uint32_t zip64_locator_signature = 0x07064b50;
+constexpr uint32_t zip64_end_signature = 0x06064b50;
+constexpr size_t local_size = 30;
+constexpr size_t central_size = 46;
+constexpr size_t end_size = 22;
+constexpr size_t zip64_locator_size = 20;
+constexpr size_t zip64_end_size = 56;
+constexpr uint16_t zip64_extra_id = 0x0001;
+constexpr uint16_t encrypted_flag = 0x0001;
+// A copy of 258 bytes takes at least 2 bits of the deflate data
+constexpr uint64_t max_deflate_ratio = 1032;
+
+template <typename T>
+T LoadLe(const std::byte* src) {
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value |= static_cast<T>(src[i]) << (8 * i);
+    }
+    return value;
+}
+
+constexpr std::array<uint32_t, 256> MakeCrcTable() {
+    std::array<uint32_t, 256> table{};
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+        }
+        table[i] = c;
+    }
+    return table;
+}
+
+constexpr std::array<uint32_t, 256> crc_table = MakeCrcTable();
+
+// Deflate decoder after the canonical Huffman decoding of zlib's puff.
+// The bits of the input go from the least significant one of each byte
+class BitReader {
+public:
+    explicit BitReader(std::span<const uint8_t> input)
+    : input_(input) {
+    }
+
+    uint32_t Bits(int count) {
+        // After every call fewer than 8 bits are left in the buffer
+        while (bit_count_ < count) {
+            if (position_ == input_.size()) {
+                throw std::runtime_error("Unexpected end of the deflate data"s);
+            }
+            bit_buffer_ |= static_cast<uint32_t>(input_[position_++]) << bit_count_;
+            bit_count_ += 8;
+        }
+        const uint32_t value = bit_buffer_ & ((1u << count) - 1);
+        bit_buffer_ >>= count;
+        bit_count_ -= count;
+        return value;
+    }
+
+    // Drops the rest of the current byte, returns the following bytes
+    std::span<const uint8_t> TakeBytes(size_t count) {
+        bit_buffer_ = 0;
+        bit_count_ = 0;
+        if (input_.size() - position_ < count) {
+            throw std::runtime_error("Unexpected end of the deflate data"s);
+        }
+        std::span<const uint8_t> bytes = input_.subspan(position_, count);
+        position_ += count;
+        return bytes;
+    }
+
+private:
+    std::span<const uint8_t> input_;
+    size_t position_ = 0;
+    uint32_t bit_buffer_ = 0;
+    int bit_count_ = 0;
+};
+
+constexpr int max_bits = 15;
+constexpr int max_literals = 288;
+constexpr int max_distances = 30;
+
+// Canonical Huffman code: the number of codes of each length
+// and the symbols in the order of their codes
+struct Huffman {
+    std::array<uint16_t, max_bits + 1> count;
+    std::array<uint16_t, max_literals> symbol;
+
+    // Returns the number of unused codes of the maximal length,
+    // throws if the lengths are over-subscribed
+    int Build(std::span<const uint8_t> lengths) {
+        count.fill(0);
+        for (uint8_t length : lengths) {
+            ++count[length];
+        }
+        if (count[0] == lengths.size()) {
+            return 0; // no codes, decoding fails on the first use
+        }
+        int left = 1;
+        for (int length = 1; length <= max_bits; ++length) {
+            left = left * 2 - count[length];
+            if (left < 0) {
+                throw std::runtime_error("Over-subscribed Huffman code in the deflate data"s);
+            }
+        }
+        std::array<uint16_t, max_bits + 1> offsets;
+        offsets[1] = 0;
+        for (int length = 1; length < max_bits; ++length) {
+            offsets[length + 1] = offsets[length] + count[length];
+        }
+        for (size_t s = 0; s < lengths.size(); ++s) {
+            if (lengths[s] != 0) {
+                symbol[offsets[lengths[s]]++] = static_cast<uint16_t>(s);
+            }
+        }
+        return left;
+    }
+
+    // The dynamic codes may be incomplete only of a single length-1 code
+    void BuildDynamic(std::span<const uint8_t> lengths) {
+        if (Build(lengths) > 0 && !(lengths.size() - count[0] == 1 && count[1] == 1)) {
+            throw std::runtime_error("Incomplete Huffman code in the deflate data"s);
+        }
+    }
+
+    int Decode(BitReader& reader) const {
+        int code = 0; // the bits read so far
+        int first = 0; // the first code of the current length
+        int index = 0; // the index of the first code of the current length in symbol
+        for (int length = 1; length <= max_bits; ++length) {
+            code |= static_cast<int>(reader.Bits(1));
+            const int codes = count[length];
+            if (code - codes < first) {
+                return symbol[index + (code - first)];
+            }
+            index += codes;
+            first = (first + codes) << 1;
+            code <<= 1;
+        }
+        throw std::runtime_error("Invalid Huffman code in the deflate data"s);
+    }
+};
+
+constexpr std::array<uint16_t, 29> length_base = {
+    3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31,
+    35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+constexpr std::array<uint8_t, 29> length_extra = {
+    0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2,
+    3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+constexpr std::array<uint16_t, 30> distance_base = {
+    1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193,
+    257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+constexpr std::array<uint8_t, 30> distance_extra = {
+    0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6,
+    7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+// Order of the lengths of the code length code
+constexpr std::array<uint8_t, 19> length_order = {
+    16, 17, 18, 0, 8, 7, 9, 6, 10, 5, 11, 4, 12, 3, 13, 2, 14, 1, 15};
+
+void InflateCodes(BitReader& reader, const Huffman& literals, const Huffman& distances,
+                  std::span<uint8_t> output, size_t& position) {
+    for (int symbol = literals.Decode(reader); symbol != 256; symbol = literals.Decode(reader)) {
+        if (symbol < 256) {
+            if (position == output.size()) {
+                throw std::runtime_error("The deflate data is longer than expected"s);
+            }
+            output[position++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+        symbol -= 257;
+        if (symbol >= static_cast<int>(length_base.size())) {
+            throw std::runtime_error("Invalid length code in the deflate data"s);
+        }
+        const size_t length = length_base[symbol] + reader.Bits(length_extra[symbol]);
+        const int distance_symbol = distances.Decode(reader);
+        if (distance_symbol >= max_distances) {
+            throw std::runtime_error("Invalid distance code in the deflate data"s);
+        }
+        const size_t distance = distance_base[distance_symbol] + reader.Bits(distance_extra[distance_symbol]);
+        if (distance > position) {
+            throw std::runtime_error("Distance too far back in the deflate data"s);
+        }
+        if (output.size() - position < length) {
+            throw std::runtime_error("The deflate data is longer than expected"s);
+        }
+        // Byte by byte: the copy may overlap its own output
+        for (size_t i = 0; i < length; ++i, ++position) {
+            output[position] = output[position - distance];
+        }
+    }
+}
+
+void BuildFixed(Huffman& literals, Huffman& distances) {
+    std::array<uint8_t, max_literals> lengths;
+    std::fill(lengths.begin(), lengths.begin() + 144, 8);
+    std::fill(lengths.begin() + 144, lengths.begin() + 256, 9);
+    std::fill(lengths.begin() + 256, lengths.begin() + 280, 7);
+    std::fill(lengths.begin() + 280, lengths.end(), 8);
+    literals.Build(lengths);
+    // The distance codes 30 and 31 are not used
+    std::fill(lengths.begin(), lengths.begin() + max_distances, 5);
+    distances.Build({lengths.data(), max_distances});
+}
+
+void BuildDynamic(BitReader& reader, Huffman& literals, Huffman& distances) {
+    const size_t literal_count = reader.Bits(5) + 257;
+    const size_t distance_count = reader.Bits(5) + 1;
+    const size_t code_count = reader.Bits(4) + 4;
+    if (literal_count > 286 || distance_count > max_distances) {
+        throw std::runtime_error("Too many codes in the deflate data"s);
+    }
+
+    std::array<uint8_t, max_literals + max_distances> lengths{};
+    for (size_t i = 0; i < code_count; ++i) {
+        lengths[length_order[i]] = static_cast<uint8_t>(reader.Bits(3));
+    }
+    Huffman length_code;
+    if (length_code.Build({lengths.data(), length_order.size()}) != 0) {
+        throw std::runtime_error("Incomplete Huffman code in the deflate data"s);
+    }
+
+    // The lengths of both codes form one sequence, repeats may cross from one to the other
+    const size_t total = literal_count + distance_count;
+    for (size_t i = 0; i < total;) {
+        const int symbol = length_code.Decode(reader);
+        if (symbol < 16) {
+            lengths[i++] = static_cast<uint8_t>(symbol);
+            continue;
+        }
+        uint8_t length = 0;
+        size_t repeat = 0;
+        if (symbol == 16) {
+            if (i == 0) {
+                throw std::runtime_error("Repeat of no length in the deflate data"s);
+            }
+            length = lengths[i - 1];
+            repeat = 3 + reader.Bits(2);
+        } else if (symbol == 17) {
+            repeat = 3 + reader.Bits(3);
+        } else {
+            repeat = 11 + reader.Bits(7);
+        }
+        if (total - i < repeat) {
+            throw std::runtime_error("Too many lengths in the deflate data"s);
+        }
+        std::fill_n(lengths.begin() + i, repeat, length);
+        i += repeat;
+    }
+    if (lengths[256] == 0) {
+        throw std::runtime_error("No end of block code in the deflate data"s);
+    }
+    literals.BuildDynamic({lengths.data(), literal_count});
+    distances.BuildDynamic({lengths.data() + literal_count, distance_count});
+}
+
+}
+
+void Inflate(std::span<const uint8_t> input, std::span<uint8_t> output) {
+    BitReader reader(input);
+    Huffman literals;
+    Huffman distances;
+    size_t position = 0;
+    bool last = false;
+    while (!last) {
+        last = reader.Bits(1) != 0;
+        const uint32_t type = reader.Bits(2);
+        if (type == 0) {
+            std::span<const uint8_t> header = reader.TakeBytes(4);
+            const uint16_t length = static_cast<uint16_t>(header[0] | header[1] << 8);
+            const uint16_t complement = static_cast<uint16_t>(header[2] | header[3] << 8);
+            if (length != static_cast<uint16_t>(~complement)) {
+                throw std::runtime_error("Damaged stored block in the deflate data"s);
+            }
+            if (output.size() - position < length) {
+                throw std::runtime_error("The deflate data is longer than expected"s);
+            }
+            std::span<const uint8_t> bytes = reader.TakeBytes(length);
+            std::copy(bytes.begin(), bytes.end(), output.begin() + position);
+            position += length;
+        } else if (type == 1 || type == 2) {
+            if (type == 1) {
+                BuildFixed(literals, distances);
+            } else {
+                BuildDynamic(reader, literals, distances);
+            }
+            InflateCodes(reader, literals, distances, output, position);
+        } else {
+            throw std::runtime_error("Invalid block type in the deflate data"s);
+        }
+    }
+    if (position != output.size()) {
+        throw std::runtime_error("The deflate data is shorter than expected"s);
+    }
+}
+
+uint32_t Crc32(std::span<const uint8_t> data) {
+    uint32_t crc = 0xffffffffu;
+    for (uint8_t byte : data) {
+        crc = crc_table[(crc ^ byte) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+bool ZipArchive::Entry::IsDirectory() const {
+    return !name.empty() && name.back() == '/';
+}
+
+ZipArchive::ZipArchive(const std::filesystem::path& file)
+: file_(file)
+, mapping_(std::make_unique<MappedFile>(file)) {
+    PROFILE_SCOPE("read zip directory");
+    const std::byte* data = mapping_->GetData();
+    const uint64_t file_size = mapping_->GetSize();
+    auto check = [&file](bool condition) {
+        if (!condition) {
+            throw std::runtime_error("The zip archive "s + file.string() + " is damaged"s);
+        }
+    };
+
+    // The end record is followed only by the comment of up to 65535 bytes
+    check(file_size >= end_size);
+    uint64_t end = file_size - end_size;
+    const uint64_t end_limit = file_size - std::min<uint64_t>(file_size, end_size + 0xffff);
+    while (LoadLe<uint32_t>(data + end) != end_signature
+           || end + end_size + LoadLe<uint16_t>(data + end + 20) != file_size) {
+        check(end > end_limit);
+        --end;
+    }
+    uint64_t entry_count = LoadLe<uint16_t>(data + end + 10);
+    uint64_t directory_size = LoadLe<uint32_t>(data + end + 12);
+    uint64_t directory_offset = LoadLe<uint32_t>(data + end + 16);
+    if (end >= zip64_locator_size
+        && LoadLe<uint32_t>(data + end - zip64_locator_size) == zip64_locator_signature) {
+        const uint64_t zip64_end = LoadLe<uint64_t>(data + end - zip64_locator_size + 8);
+        // The record lies before the locator, the sizes are compared
+        // before the offset so that nothing wraps around
+        check(end - zip64_locator_size >= zip64_end_size
+              && zip64_end <= end - zip64_locator_size - zip64_end_size
+              && LoadLe<uint32_t>(data + zip64_end) == zip64_end_signature);
+        entry_count = LoadLe<uint64_t>(data + zip64_end + 32);
+        directory_size = LoadLe<uint64_t>(data + zip64_end + 40);
+        directory_offset = LoadLe<uint64_t>(data + zip64_end + 48);
+    }
+    check(directory_offset <= file_size && directory_size <= file_size - directory_offset
+          && entry_count <= directory_size / central_size);
+
+    const std::byte* header = data + directory_offset;
+    const std::byte* const directory_end = header + directory_size;
+    entries_.reserve(entry_count);
+    for (uint64_t i = 0; i < entry_count; ++i) {
+        check(directory_end - header >= static_cast<ptrdiff_t>(central_size)
+              && LoadLe<uint32_t>(header) == central_signature);
+        Entry& entry = entries_.emplace_back();
+        entry.flags = LoadLe<uint16_t>(header + 8);
+        entry.method = LoadLe<uint16_t>(header + 10);
+        entry.crc = LoadLe<uint32_t>(header + 16);
+        entry.compressed_size = LoadLe<uint32_t>(header + 20);
+        entry.size = LoadLe<uint32_t>(header + 24);
+        entry.local_offset = LoadLe<uint32_t>(header + 42);
+        const size_t name_length = LoadLe<uint16_t>(header + 28);
+        const size_t extra_length = LoadLe<uint16_t>(header + 30);
+        const size_t comment_length = LoadLe<uint16_t>(header + 32);
+        const size_t record_size = central_size + name_length + extra_length + comment_length;
+        check(directory_end - header >= static_cast<ptrdiff_t>(record_size));
+        entry.name.assign(reinterpret_cast<const char*>(header + central_size), name_length);
+
+        // Values that don't fit 32 bits are in the zip64 extra field
+        const std::byte* extra = header + central_size + name_length;
+        const std::byte* const extra_end = extra + extra_length;
+        while (extra_end - extra >= 4) {
+            const uint16_t id = LoadLe<uint16_t>(extra);
+            const size_t size = LoadLe<uint16_t>(extra + 2);
+            check(static_cast<size_t>(extra_end - extra) - 4 >= size);
+            if (id == zip64_extra_id) {
+                const std::byte* value = extra + 4;
+                for (uint64_t* field : {&entry.size, &entry.compressed_size, &entry.local_offset}) {
+                    if (*field == 0xffffffffu) {
+                        check(extra + 4 + size - value >= 8);
+                        *field = LoadLe<uint64_t>(value);
+                        value += 8;
+                    }
+                }
+            }
+            extra += 4 + size;
+        }
+        check(entry.local_offset < directory_offset);
+        header += record_size;
+    }
+}
+
+bool ZipArchive::IsZip(const std::filesystem::path& file) {
+    std::error_code error;
+    if (!std::filesystem::is_regular_file(file, error)) {
+        return false;
+    }
+    // An archive without entries starts with the end record
+    std::ifstream in(file, std::ios::binary);
+    std::byte signature[4];
+    in.read(reinterpret_cast<char*>(signature), sizeof(signature));
+    return in && (LoadLe<uint32_t>(signature) == local_signature
+                  || LoadLe<uint32_t>(signature) == end_signature);
+}
+
+const std::vector<ZipArchive::Entry>& ZipArchive::GetEntries() const {
+    return entries_;
+}
+
+std::span<const uint8_t> ZipArchive::Extract(const Entry& entry, std::vector<uint8_t>& buffer) const {
+    auto fail = [this, &entry](const std::string& reason) {
+        throw std::runtime_error("Unable to extract "s + entry.name + " from "s
+                                 + file_.string() + ": "s + reason);
+    };
+    if (entry.flags & encrypted_flag) {
+        fail("the entry is encrypted"s);
+    }
+    if (entry.method != 0 && entry.method != 8) {
+        fail("compression method "s + std::to_string(entry.method) + " is not supported"s);
+    }
+
+    const std::byte* data = mapping_->GetData();
+    const uint64_t file_size = mapping_->GetSize();
+    const uint64_t local = entry.local_offset;
+    if (file_size - local < local_size || LoadLe<uint32_t>(data + local) != local_signature) {
+        fail("the local header is damaged"s);
+    }
+    // The local extra field may differ from the central one
+    const uint64_t start = local + local_size + LoadLe<uint16_t>(data + local + 26)
+                           + LoadLe<uint16_t>(data + local + 28);
+    // The size is checked before the buffer is allocated: a deflated
+    // entry expands at most max_deflate_ratio times
+    if (start > file_size || file_size - start < entry.compressed_size
+        || (entry.method == 0 && entry.compressed_size != entry.size)
+        || (entry.method == 8 && entry.size / max_deflate_ratio > entry.compressed_size)) {
+        fail("the entry is damaged"s);
+    }
+    std::span<const uint8_t> input(reinterpret_cast<const uint8_t*>(data + start),
+                                   static_cast<size_t>(entry.compressed_size));
+
+    buffer.resize(static_cast<size_t>(entry.size) + padding);
+    std::span<uint8_t> output(buffer.data(), static_cast<size_t>(entry.size));
+    if (entry.method == 0) {
+        std::copy(input.begin(), input.end(), output.begin());
+    } else {
+        try {
+            Inflate(input, output);
+        } catch (const std::exception& e) {
+            fail(e.what());
+        }
+    }
+    if (Crc32(output) != entry.crc) {
+        fail("CRC-32 mismatch"s);
+    }
+    return output;
+}
+
+namespace tests {
+
+void ZipArchiveReads() {
+    // Empty input and the check values of CRC-32
+    assert(Crc32({}) == 0);
+    const std::string check = "123456789"s;
+    assert(Crc32({reinterpret_cast<const uint8_t*>(check.data()), check.size()}) == 0xcbf43926u);
+
+    auto from_hex = [](std::string_view hex) {
+        std::vector<uint8_t> bytes;
+        for (size_t i = 0; i + 1 < hex.size(); i += 2) {
+            bytes.push_back(static_cast<uint8_t>(std::stoi(std::string(hex.substr(i, 2)), nullptr, 16)));
+        }
+        return bytes;
+    };
+
+    // A fixed Huffman block with back references
+    const std::string hello = "Hello, hello, hello glyphs!"s;
+    const std::vector<uint8_t> fixed = from_hex("f348cdc9c9d751c840a214d2732a0b328a1501"sv);
+    std::vector<uint8_t> output(hello.size());
+    Inflate(fixed, output);
+    assert(std::equal(output.begin(), output.end(), hello.begin()));
+
+    // A dynamic Huffman block
+    std::vector<uint8_t> expected(400);
+    for (size_t i = 0; i < expected.size(); ++i) {
+        expected[i] = static_cast<uint8_t>((i * i * 7 + i / 13) % 23 + 97);
+    }
+    const std::vector<uint8_t> dynamic = from_hex(
+        "bdd0890103210800b05945c40751440ed7ef16cd08498decdb2fa6b2fb3cf292c6ad1d7af577202d9308b105"
+        "d9d2d719b97fc930abef94b66bc69b1f0b09bfec054f9c9c4f58a10fd3dc6d0b94a8749f61b9c96b7b949776"
+        "dd58536f1f389143f401ada8b1696999c7c3682df00dc651cdc5ad0e9c0c94c64804530a378f1dde272dc915"
+        "e6cc0dd7ae32bea7297835dda5a3080ed2d3f77c60f0a60e3b95696fe27a2e9f05e808ebf0bd5dda394dfaf5"
+        "698a14847ae5f3b1c6bd63f317cb4fa9e91f553f"sv);
+    output.assign(expected.size(), 0);
+    Inflate(dynamic, output);
+    assert(output == expected);
+
+    // Damaged and truncated data
+    [[maybe_unused]] auto throws = [&output](std::span<const uint8_t> input) {
+        try {
+            Inflate(input, output);
+        } catch (const std::runtime_error&) {
+            return true;
+        }
+        return false;
+    };
+    assert(throws(std::span(dynamic).first(100)));
+    assert(throws(std::vector<uint8_t>{0x07}));
+    output.resize(hello.size() - 1);
+    assert(throws(fixed));
+
+    // An archive of a training folder: stored images, a deflated one
+    // of stored blocks, folder entries and a file outside the label folders
+    using namespace img_lib;
+    namespace fs = std::filesystem;
+    const fs::path dir = fs::temp_directory_path() / "zip_archive_test";
+    fs::remove_all(dir);
+    struct Member {
+        std::string name;
+        std::vector<uint8_t> data;
+        bool deflated;
+    };
+    std::vector<Member> members = {{"chars/"s, {}, false}, {"chars/readme.txt"s, {'h', 'i'}, false}};
+    Image image(32, 32, Color::Black());
+    for (const std::string& label : {"3"s, "8"s, "not_chars"s}) {
+        members.push_back({"chars/"s + label + "/"s, {}, false});
+        fs::create_directories(dir / "chars" / label);
+        for (int i = 0; i < 3; ++i) {
+            for (int y = 0; y < 32; ++y) {
+                for (int x = 0; x < 32; ++x) {
+                    const std::byte gray = static_cast<std::byte>(x * 5 + y * 3 + i + label[0]);
+                    image.GetPixel(x, y) = Color{gray, gray, gray, std::byte{255}};
+                }
+            }
+            const fs::path file = dir / "chars" / label / (std::to_string(i) + ".bmp"s);
+            [[maybe_unused]] bool saved = SaveBMP(file, image);
+            assert(saved);
+            std::ifstream in(file, std::ios::binary);
+            std::vector<uint8_t> data{std::istreambuf_iterator<char>(in), {}};
+            members.push_back({"chars/"s + label + "/"s + file.filename().string(), data, i == 1});
+        }
+    }
+
+    std::vector<uint8_t> zip;
+    std::vector<uint8_t> directory;
+    auto put = [](std::vector<uint8_t>& out, uint64_t value, size_t size) {
+        for (size_t i = 0; i < size; ++i) {
+            out.push_back(static_cast<uint8_t>(value >> (8 * i)));
+        }
+    };
+    for (const Member& member : members) {
+        std::vector<uint8_t> stored = member.data;
+        if (member.deflated) {
+            // Stored deflate blocks of up to 1000 bytes
+            stored.clear();
+            for (size_t begin = 0; begin < member.data.size(); begin += 1000) {
+                const size_t length = std::min<size_t>(1000, member.data.size() - begin);
+                put(stored, begin + length == member.data.size() ? 1 : 0, 1);
+                put(stored, length, 2);
+                put(stored, ~length & 0xffff, 2);
+                stored.insert(stored.end(), member.data.begin() + begin, member.data.begin() + begin + length);
+            }
+        }
+        const uint32_t crc = Crc32(member.data);
+        const uint64_t offset = zip.size();
+        put(zip, local_signature, 4);
+        put(zip, 20, 2); // version needed
+        put(zip, 0, 2);
+        put(zip, member.deflated ? 8 : 0, 2);
+        put(zip, 0, 4); // time and date
+        put(zip, crc, 4);
+        put(zip, stored.size(), 4);
+        put(zip, member.data.size(), 4);
+        put(zip, member.name.size(), 2);
+        put(zip, 0, 2);
+        zip.insert(zip.end(), member.name.begin(), member.name.end());
+        zip.insert(zip.end(), stored.begin(), stored.end());
+
+        put(directory, central_signature, 4);
+        put(directory, 20, 2); // version made by
+        put(directory, 20, 2);
+        put(directory, 0, 2);
+        put(directory, member.deflated ? 8 : 0, 2);
+        put(directory, 0, 4);
+        put(directory, crc, 4);
+        put(directory, stored.size(), 4);
+        put(directory, member.data.size(), 4);
+        put(directory, member.name.size(), 2);
+        put(directory, 0, 6); // extra, comment, disk
+        put(directory, 0, 6); // attributes
+        put(directory, offset, 4);
+        directory.insert(directory.end(), member.name.begin(), member.name.end());
+    }
+    const uint64_t directory_offset = zip.size();
+    zip.insert(zip.end(), directory.begin(), directory.end());
+    put(zip, end_signature, 4);
+    put(zip, 0, 4); // disks
+    put(zip, members.size(), 2);
+    put(zip, members.size(), 2);
+    put(zip, directory.size(), 4);
+    put(zip, directory_offset, 4);
+    put(zip, 0, 2);
+    {
+        std::ofstream out(dir / "chars.zip", std::ios::binary);
+        out.write(reinterpret_cast<const char*>(zip.data()), zip.size());
+    }
+
+    assert(ZipArchive::IsZip(dir / "chars.zip"));
+    assert(!ZipArchive::IsZip(dir / "chars" / "3" / "0.bmp"));
+    const ZipArchive archive(dir / "chars.zip");
+    assert(archive.GetEntries().size() == members.size());
+    std::vector<uint8_t> buffer;
+    for (size_t i = 0; i < members.size(); ++i) {
+        const ZipArchive::Entry& entry = archive.GetEntries()[i];
+        assert(entry.name == members[i].name && entry.IsDirectory() == members[i].data.empty());
+        std::span<const uint8_t> data = archive.Extract(entry, buffer);
+        assert(std::equal(data.begin(), data.end(), members[i].data.begin(), members[i].data.end()));
+    }
+
+    // A size beyond the expansion of deflate is rejected before the allocation
+    ZipArchive::Entry oversized = archive.GetEntries()[4];
+    assert(oversized.method == 8);
+    oversized.size = uint64_t{1} << 40;
+    [[maybe_unused]] bool rejected = false;
+    try {
+        archive.Extract(oversized, buffer);
+    } catch (const std::runtime_error&) {
+        rejected = true;
+    }
+    assert(rejected && buffer.capacity() < (uint64_t{1} << 20));
+
+    // The database of the archive is the database of the folder
+    const ImageFileNormalizer normalizer(1024);
+    TrainingDatabase from_folder(&normalizer);
+    from_folder.BuildFromFolder(dir / "chars");
+    TrainingDatabase from_zip(&normalizer);
+    from_zip.SetThreads(3);
+    from_zip.BuildFromZip(dir / "chars.zip");
+    [[maybe_unused]] auto same = [](const SampleMatrix& a, const SampleMatrix& b) {
+        if (a.GetCount() != b.GetCount()) {
+            return false;
+        }
+        // The folder is scanned in the order of the file system, the archive
+        // in the order of its entries
+        std::vector<std::vector<uint8_t>> samples_a;
+        std::vector<std::vector<uint8_t>> samples_b;
+        for (size_t i = 0; i < a.GetCount(); ++i) {
+            samples_a.emplace_back(a.GetSample(i), a.GetSample(i) + a.GetWidth());
+            samples_b.emplace_back(b.GetSample(i), b.GetSample(i) + b.GetWidth());
+        }
+        std::sort(samples_a.begin(), samples_a.end());
+        std::sort(samples_b.begin(), samples_b.end());
+        return samples_a == samples_b;
+    };
+    assert(from_zip.GetCharsDictionary().size() == 2);
+    for ([[maybe_unused]] const auto& [c, chars] : from_folder.GetCharsDictionary()) {
+        assert(same(chars, from_zip.GetCharsDictionary().at(c)));
+    }
+    assert(same(from_folder.GetNonChars(), from_zip.GetNonChars()));
+
+    // A damaged entry is reported
+    zip[zip.size() - directory.size() - end_size - 40] ^= 0x55;
+    {
+        std::ofstream out(dir / "chars.zip", std::ios::binary);
+        out.write(reinterpret_cast<const char*>(zip.data()), zip.size());
+    }
+    [[maybe_unused]] bool reported = false;
+    try {
+        TrainingDatabase damaged(&normalizer);
+        damaged.BuildFromZip(dir / "chars.zip");
+    } catch (const std::runtime_error&) {
+        reported = true;
+    }
+    assert(reported);
+
+    // A zip64 locator that points far away or to a record overlapping
+    // the locator in a file shorter than the record
+    for (uint64_t zip64_end : {uint64_t{1} << 62, uint64_t{0}}) {
+        std::vector<uint8_t> truncated;
+        put(truncated, local_signature, 4);
+        put(truncated, zip64_locator_signature, 4);
+        put(truncated, 0, 4);
+        put(truncated, zip64_end, 8);
+        put(truncated, 1, 4);
+        put(truncated, end_signature, 4);
+        put(truncated, 0, end_size - 4);
+        assert(truncated.size() == 46);
+        {
+            std::ofstream out(dir / "truncated.zip", std::ios::binary);
+            out.write(reinterpret_cast<const char*>(truncated.data()), truncated.size());
+        }
+        [[maybe_unused]] bool refused = false;
+        try {
+            ZipArchive damaged(dir / "truncated.zip");
+        } catch (const std::runtime_error&) {
+            refused = true;
+        }
+        assert(refused);
+    }
+    fs::remove_all(dir);
+}
+
+}
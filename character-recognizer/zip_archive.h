@@ -0,0 +1,63 @@
+#pragma once
+
+#include "mapped_file.h"
+
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// Reader of zip archives (with Zip64 extensions). The archive is mapped
+// to memory and its central directory is parsed once, the entries are
+// extracted without temporary files. Stored and deflated entries are
+// supported, the deflate decoder is built in. Extraction of different
+// entries may run in parallel, each thread with its own buffer
+
+class ZipArchive {
+public:
+    struct Entry {
+        std::string name; // path in the archive, the separator is '/'
+        uint16_t method = 0; // 0 stored, 8 deflated
+        uint16_t flags = 0;
+        uint32_t crc = 0;
+        uint64_t compressed_size = 0;
+        uint64_t size = 0;
+        uint64_t local_offset = 0; // of the local header
+
+        bool IsDirectory() const;
+    };
+
+    // Readable bytes after the data returned by Extract, as after BatchFileReader::Take
+    static constexpr size_t padding = 64;
+
+    // Throws if the central directory is damaged
+    explicit ZipArchive(const std::filesystem::path& file);
+
+    // True if the file starts as a zip archive
+    static bool IsZip(const std::filesystem::path& file);
+
+    const std::vector<Entry>& GetEntries() const;
+
+    // Returns the contents of the entry in the buffer and checks its CRC-32.
+    // Throws if the entry is damaged, encrypted or compressed by another method
+    std::span<const uint8_t> Extract(const Entry& entry, std::vector<uint8_t>& buffer) const;
+
+private:
+    std::filesystem::path file_;
+    std::unique_ptr<MappedFile> mapping_;
+    std::vector<Entry> entries_;
+};
+
+// Decompresses raw deflate data (RFC 1951). The output must have
+// the exact size of the decompressed data. Throws if the data is damaged
+void Inflate(std::span<const uint8_t> input, std::span<uint8_t> output);
+
+uint32_t Crc32(std::span<const uint8_t> data);
+
+namespace tests {
+
+void ZipArchiveReads();
+
+}